@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#include "opencv2/opencv.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include "facerec.hpp"
+
+using namespace cv;
+using namespace std;
+
+static void read_csv(const string& filename, vector<Mat>& images, vector<int>& labels, char separator = ';') {
+    std::ifstream file(filename.c_str(), ifstream::in);
+    if (!file)
+        throw std::exception();
+    string line, path, classlabel;
+    while (getline(file, line)) {
+        stringstream liness(line);
+        getline(liness, path, separator);
+        getline(liness, classlabel);
+        images.push_back(imread(path, 0));
+        labels.push_back(atoi(classlabel.c_str()));
+    }
+}
+
+// Measures the recall@k and the query time of the HNSW index for several
+// beam widths against the exact linear scan.
+static void benchmark(const Mat& gallery, const Mat& queries, int k) {
+    int numQueries = queries.rows;
+    LinearIndex linear;
+    linear.build(gallery);
+    vector<vector<int> > expected(numQueries);
+    vector<double> dists;
+    int64 t0 = getTickCount();
+    for(int i = 0; i < numQueries; i++)
+        linear.knn(queries.row(i), k, expected[i], dists);
+    double linearTime = (getTickCount() - t0) * 1e6 / getTickFrequency() / numQueries;
+    HNSWIndex hnsw;
+    t0 = getTickCount();
+    hnsw.build(gallery);
+    double buildTime = (getTickCount() - t0) / getTickFrequency();
+    cout << gallery.rows << " samples, " << gallery.cols << " dimensions, "
+            << numQueries << " queries, k = " << k << endl;
+    cout << "linear scan: " << fixed << setprecision(1) << linearTime << " us/query, "
+            << setprecision(2) << linear.memory() / (1024.0 * 1024.0) << " MB" << endl;
+    cout << "hnsw build: " << setprecision(2) << buildTime << " s, "
+            << hnsw.memory() / (1024.0 * 1024.0) << " MB" << endl;
+    cout << setw(10) << "efSearch" << setw(10) << "recall" << setw(14) << "query [us]"
+            << setw(10) << "speedup" << endl;
+    int efs[] = { 10, 20, 40, 80, 160, 320 };
+    for(int e = 0; e < 6; e++) {
+        if(efs[e] < k)
+            continue;
+        hnsw.setEfSearch(efs[e]);
+        int found = 0;
+        vector<int> actual;
+        t0 = getTickCount();
+        for(int i = 0; i < numQueries; i++) {
+            hnsw.knn(queries.row(i), k, actual, dists);
+            for(int j = 0; j < actual.size(); j++)
+                found += std::count(expected[i].begin(), expected[i].end(), actual[j]);
+        }
+        double queryTime = (getTickCount() - t0) * 1e6 / getTickFrequency() / numQueries;
+        cout << setw(10) << efs[e]
+                << setw(10) << setprecision(3) << found / (double) (numQueries * k)
+                << setw(14) << setprecision(1) << queryTime
+                << setw(9) << setprecision(1) << linearTime / queryTime << "x" << endl;
+    }
+}
+
+// Benchmarks the HNSW index against the exact linear scan, either on
+// synthetic projections with a decaying spectrum like Eigenfaces projections
+// or on the projections of an Eigenfaces model computed from the images in a
+// CSV file (every 10th image is a query).
+//
+//      bench_hnsw [samples=100000] [dims=100] [queries=500] [k=10]
+//      bench_hnsw <csv.ext> [num_components=100] [k=1]
+//
+int main(int argc, const char *argv[]) {
+    if((argc > 1) && (atoi(argv[1]) == 0)) {
+        vector<Mat> images, queryImages;
+        vector<int> labels;
+        try {
+            read_csv(argv[1], images, labels);
+        } catch (exception& e) {
+            cerr << "Error opening file \"" << argv[1] << "\"." << endl;
+            exit(1);
+        }
+        int numComponents = (argc > 2) ? atoi(argv[2]) : 100;
+        int k = (argc > 3) ? atoi(argv[3]) : 1;
+        vector<Mat> train;
+        vector<int> trainLabels;
+        for(int i = 0; i < images.size(); i++) {
+            if(i % 10 == 9) {
+                queryImages.push_back(images[i]);
+            } else {
+                train.push_back(images[i]);
+                trainLabels.push_back(labels[i]);
+            }
+        }
+        Eigenfaces model(train, trainLabels, numComponents);
+        Mat queries;
+        for(int i = 0; i < queryImages.size(); i++)
+            queries.push_back(subspace::project(model.eigenvectors(), model.mean(), queryImages[i].reshape(1,1)));
+        benchmark(model.projections(), queries, k);
+        return 0;
+    }
+    int numSamples = (argc > 1) ? atoi(argv[1]) : 100000;
+    int dims = (argc > 2) ? atoi(argv[2]) : 100;
+    int numQueries = (argc > 3) ? atoi(argv[3]) : 500;
+    int k = (argc > 4) ? atoi(argv[4]) : 10;
+    if((numSamples <= 0) || (dims <= 0) || (numQueries <= 0) || (k <= 0)) {
+        cout << "usage: " << argv[0] << " [samples] [dims] [queries] [k]" << endl;
+        cout << "       " << argv[0] << " <csv.ext> [num_components] [k]" << endl;
+        exit(1);
+    }
+    // the variance of the components decays like the eigenvalues of faces
+    RNG rng(12345);
+    Mat gallery(numSamples, dims, CV_64FC1), queries(numQueries, dims, CV_64FC1);
+    rng.fill(gallery, RNG::NORMAL, 0.0, 1.0);
+    rng.fill(queries, RNG::NORMAL, 0.0, 1.0);
+    for(int j = 0; j < dims; j++) {
+        double scale = 1.0 / std::sqrt(1.0 + j);
+        for(int i = 0; i < numSamples; i++)
+            gallery.at<double>(i,j) *= scale;
+        for(int i = 0; i < numQueries; i++)
+            queries.at<double>(i,j) *= scale;
+    }
+    benchmark(gallery, queries, k);
+    return 0;
+}
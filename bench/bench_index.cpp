@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#include "opencv2/opencv.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "index.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Benchmarks the gallery indices on synthetic projections, which look like
+// the projections of a Fisherfaces model: the samples of each class are
+// scattered around the class mean. Reports the build time, the memory and
+// the query time of each index, the speedup over the linear scan and checks
+// that all indices give the answers of the linear scan.
+//
+//      bench_index [samples=100000] [dims=20] [classes=1000] [queries=1000]
+//
+int main(int argc, const char *argv[]) {
+    int numSamples = (argc > 1) ? atoi(argv[1]) : 100000;
+    int dims = (argc > 2) ? atoi(argv[2]) : 20;
+    int numClasses = (argc > 3) ? atoi(argv[3]) : 1000;
+    int numQueries = (argc > 4) ? atoi(argv[4]) : 1000;
+    if((numSamples <= 0) || (dims <= 0) || (numClasses <= 0) || (numQueries <= 0)) {
+        cout << "usage: " << argv[0] << " [samples] [dims] [classes] [queries]" << endl;
+        exit(1);
+    }
+    // class means and samples around them
+    RNG rng(12345);
+    Mat means(numClasses, dims, CV_64FC1);
+    rng.fill(means, RNG::NORMAL, 0.0, 1.0);
+    Mat data(numSamples, dims, CV_64FC1);
+    for(int i = 0; i < numSamples; i++) {
+        Mat row = data.row(i);
+        rng.fill(row, RNG::NORMAL, 0.0, 0.1);
+        add(row, means.row(i % numClasses), row);
+    }
+    // queries are new samples of the classes
+    Mat queries(numQueries, dims, CV_64FC1);
+    for(int i = 0; i < numQueries; i++) {
+        Mat row = queries.row(i);
+        rng.fill(row, RNG::NORMAL, 0.0, 0.1);
+        add(row, means.row(rng.uniform(0, numClasses)), row);
+    }
+    cout << numSamples << " samples, " << dims << " dimensions, "
+            << numQueries << " queries" << endl;
+    cout << setw(10) << "index" << setw(12) << "build [ms]" << setw(14) << "memory [MB]"
+            << setw(14) << "query [us]" << setw(10) << "speedup" << setw(10) << "exact" << endl;
+    const char* names[] = { "linear", "kdtree", "balltree" };
+    vector<int> expected(numQueries);
+    double linearTime = 0.0;
+    for(int type = GalleryIndex::LINEAR; type <= GalleryIndex::BALLTREE; type++) {
+        Ptr<GalleryIndex> index = createGalleryIndex(type);
+        int64 t0 = getTickCount();
+        index->build(data);
+        double buildTime = (getTickCount() - t0) * 1000.0 / getTickFrequency();
+        int agree = 0;
+        t0 = getTickCount();
+        for(int i = 0; i < numQueries; i++) {
+            int nearest = index->nearest(queries.row(i));
+            if(type == GalleryIndex::LINEAR)
+                expected[i] = nearest;
+            agree += (nearest == expected[i]);
+        }
+        double queryTime = (getTickCount() - t0) * 1e6 / getTickFrequency() / numQueries;
+        if(type == GalleryIndex::LINEAR)
+            linearTime = queryTime;
+        cout << setw(10) << names[type]
+                << setw(12) << fixed << setprecision(1) << buildTime
+                << setw(14) << setprecision(2) << index->memory() / (1024.0 * 1024.0)
+                << setw(14) << setprecision(1) << queryTime
+                << setw(9) << setprecision(1) << linearTime / queryTime << "x"
+                << setw(6) << agree << "/" << numQueries << endl;
+    }
+    return 0;
+}
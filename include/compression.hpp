@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+
+#ifndef __COMPRESSION_HPP__
+#define __COMPRESSION_HPP__
+
+#include "opencv2/opencv.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+// A byte-oriented LZ77 codec in the spirit of LZ4, which compresses the
+// sections of binary models (see ModelWriter::compress). A compressed block
+// is a sequence of
+//
+//      token       literal length (high nibble), match length - 4 (low nibble)
+//      literals    [literal length bytes]
+//      offset      2 bytes, little endian, distance of the match (1..65535)
+//
+// where a nibble of 15 is continued by bytes of 255 up to the first smaller
+// byte. The last sequence has no offset and no match. The decoder only
+// copies bytes, which is fast enough to decode a gallery while it's read,
+// and the long runs of zeros of histograms become a single match.
+namespace cv {
+
+namespace impl {
+
+// Minimum length of a match.
+const int LZ_MIN_MATCH = 4;
+// Maximum distance of a match.
+const int LZ_MAX_OFFSET = 65535;
+// Number of bits of the hash table of the compressor.
+const int LZ_HASH_BITS = 12;
+
+inline unsigned int lz_read32(const uchar* p) {
+    unsigned int v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline unsigned int lz_hash(unsigned int v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes a length continued by bytes of 255.
+inline uchar* lz_put_length(uchar* dst, size_t length) {
+    for(; length >= 255; length -= 255)
+        *dst++ = 255;
+    *dst++ = static_cast<uchar>(length);
+    return dst;
+}
+
+// Writes a sequence of numLiterals literals followed by a match of length
+// matchLength at offset (no match if matchLength is 0), returns the end of
+// the sequence or 0 if it doesn't fit before end.
+inline uchar* lz_put_sequence(uchar* dst, const uchar* end, const uchar* literals,
+        size_t numLiterals, size_t offset, size_t matchLength) {
+    size_t need = 1 + numLiterals/255 + 1 + numLiterals + 2 + matchLength/255 + 1;
+    if(need > static_cast<size_t>(end - dst))
+        return 0;
+    uchar* token = dst++;
+    *token = static_cast<uchar>(std::min<size_t>(numLiterals, 15) << 4);
+    if(numLiterals >= 15)
+        dst = lz_put_length(dst, numLiterals - 15);
+    std::memcpy(dst, literals, numLiterals);
+    dst += numLiterals;
+    if(matchLength == 0)
+        return dst;
+    *dst++ = static_cast<uchar>(offset & 0xff);
+    *dst++ = static_cast<uchar>(offset >> 8);
+    size_t length = matchLength - LZ_MIN_MATCH;
+    *token |= static_cast<uchar>(std::min<size_t>(length, 15));
+    if(length >= 15)
+        dst = lz_put_length(dst, length - 15);
+    return dst;
+}
+
+// Compresses n bytes of src into dst, which holds capacity bytes. Returns
+// the compressed size, or 0 if the result doesn't fit into dst.
+inline size_t lz_compress(const uchar* src, size_t n, uchar* dst, size_t capacity) {
+    vector<int> table(1 << LZ_HASH_BITS, -1);
+    uchar* out = dst;
+    uchar* end = dst + capacity;
+    size_t anchor = 0;
+    size_t i = 0;
+    while(i + LZ_MIN_MATCH <= n) {
+        unsigned int sequence = lz_read32(src + i);
+        int& slot = table[lz_hash(sequence)];
+        int ref = slot;
+        slot = static_cast<int>(i);
+        if((ref < 0) || (i - ref > LZ_MAX_OFFSET) || (lz_read32(src + ref) != sequence)) {
+            i++;
+            continue;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while((i + length < n) && (src[ref + length] == src[i + length]))
+            length++;
+        out = lz_put_sequence(out, end, src + anchor, i - anchor, i - ref, length);
+        if(out == 0)
+            return 0;
+        i += length;
+        anchor = i;
+    }
+    out = lz_put_sequence(out, end, src + anchor, n - anchor, 0, 0);
+    return (out == 0) ? 0 : out - dst;
+}
+
+// Reads a length continued by bytes of 255, returns false at the end of
+// the input.
+inline bool lz_get_length(const uchar*& src, const uchar* end, size_t& length) {
+    uchar b;
+    do {
+        if(src == end)
+            return false;
+        b = *src++;
+        length += b;
+    } while(b == 255);
+    return true;
+}
+
+// Decompresses the size bytes of src into exactly n bytes of dst, returns
+// false if the input is corrupted.
+inline bool lz_decompress(const uchar* src, size_t size, uchar* dst, size_t n) {
+    const uchar* in = src;
+    const uchar* inEnd = src + size;
+    uchar* out = dst;
+    uchar* outEnd = dst + n;
+    while(in < inEnd) {
+        uchar token = *in++;
+        size_t numLiterals = token >> 4;
+        if((numLiterals == 15) && !lz_get_length(in, inEnd, numLiterals))
+            return false;
+        if((numLiterals > static_cast<size_t>(inEnd - in)) || (numLiterals > static_cast<size_t>(outEnd - out)))
+            return false;
+        std::memcpy(out, in, numLiterals);
+        in += numLiterals;
+        out += numLiterals;
+        // the last sequence has no match
+        if(in == inEnd)
+            break;
+        if(inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t length = token & 15;
+        if((length == 15) && !lz_get_length(in, inEnd, length))
+            return false;
+        length += LZ_MIN_MATCH;
+        if((offset == 0) || (offset > static_cast<size_t>(out - dst)) || (length > static_cast<size_t>(outEnd - out)))
+            return false;
+        // the match may overlap the output, for example a run of zeros
+        const uchar* match = out - offset;
+        if(offset >= length) {
+            std::memcpy(out, match, length);
+            out += length;
+        } else {
+            for(size_t k = 0; k < length; k++)
+                *out++ = *match++;
+        }
+    }
+    return out == outEnd;
+}
+
+} // namespace impl
+
+} // namespace cv
+
+#endif
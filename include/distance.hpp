@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __DISTANCE_HPP__
+#define __DISTANCE_HPP__
+
+#include "opencv2/opencv.hpp"
+
+#include <cfloat>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+namespace cv {
+
+// The namespace impl provides the raw distance kernels. They work on
+// contiguous vectors and do not validate their input.
+namespace impl {
+
+// Number of bins summed up before the partial distance is compared against
+// the bound of the caller.
+const int DISTANCE_BLOCK_SIZE = 64;
+
+// Chi-square distance of the first n bins of a template t and a query q:
+//
+//      d(t,q) = sum_i (t_i - q_i)^2 / t_i
+//
+// Bins with t_i == 0 are skipped, which gives the same result as
+// cv::compareHist with CV_COMP_CHISQR (with t as first histogram).
+inline double chisquare(const float* t, const float* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 eps = _mm256_set1_ps((float) DBL_EPSILON);
+    const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256 vt = _mm256_loadu_ps(t + i);
+        __m256 nonzero = _mm256_cmp_ps(_mm256_and_ps(vt, absmask), eps, _CMP_GT_OQ);
+        // skip blocks where the template is all zero
+        if(_mm256_movemask_ps(nonzero) == 0)
+            continue;
+        __m256 d = _mm256_sub_ps(vt, _mm256_loadu_ps(q + i));
+        __m256 r = _mm256_and_ps(_mm256_div_ps(_mm256_mul_ps(d, d), vt), nonzero);
+        s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(r)));
+        s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(r, 1)));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 eps = _mm_set1_ps((float) DBL_EPSILON);
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 4; i += 4) {
+        __m128 vt = _mm_loadu_ps(t + i);
+        __m128 nonzero = _mm_cmpgt_ps(_mm_and_ps(vt, absmask), eps);
+        if(_mm_movemask_ps(nonzero) == 0)
+            continue;
+        __m128 d = _mm_sub_ps(vt, _mm_loadu_ps(q + i));
+        __m128 r = _mm_and_ps(_mm_div_ps(_mm_mul_ps(d, d), vt), nonzero);
+        s0 = _mm_add_pd(s0, _mm_cvtps_pd(r));
+        s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(r, r)));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t eps = vdupq_n_f32((float) DBL_EPSILON);
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 4; i += 4) {
+        float32x4_t vt = vld1q_f32(t + i);
+        uint32x4_t nonzero = vcgtq_f32(vabsq_f32(vt), eps);
+        if(vmaxvq_u32(nonzero) == 0)
+            continue;
+        float32x4_t d = vsubq_f32(vt, vld1q_f32(q + i));
+        float32x4_t r = vdivq_f32(vmulq_f32(d, d), vt);
+        r = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(r), nonzero));
+        s0 = vaddq_f64(s0, vcvt_f64_f32(vget_low_f32(r)));
+        s1 = vaddq_f64(s1, vcvt_high_f64_f32(r));
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        double b = t[i];
+        if(std::abs(b) > DBL_EPSILON) {
+            double a = b - q[i];
+            result += a*a/b;
+        }
+    }
+    return result;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Adds the chi-square terms d^2/t of four 32-bit integer lanes to s0, s1.
+// The terms are computed in double precision, lanes with t == 0 add 0.
+inline void chisquare_epi32(__m128i t, __m128i d, __m128d& s0, __m128d& s1) {
+    const __m128d z = _mm_setzero_pd();
+    __m128d t0 = _mm_cvtepi32_pd(t);
+    __m128d t1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(t, t));
+    __m128d d0 = _mm_cvtepi32_pd(d);
+    __m128d d1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(d, d));
+    s0 = _mm_add_pd(s0, _mm_and_pd(_mm_div_pd(_mm_mul_pd(d0, d0), t0), _mm_cmpneq_pd(t0, z)));
+    s1 = _mm_add_pd(s1, _mm_and_pd(_mm_div_pd(_mm_mul_pd(d1, d1), t1), _mm_cmpneq_pd(t1, z)));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+// See the SSE2 version, d holds the absolute differences.
+inline void chisquare_u32(uint32x4_t t, uint32x4_t d, float64x2_t& s0, float64x2_t& s1) {
+    const float64x2_t z = vdupq_n_f64(0.0);
+    float64x2_t t0 = vcvtq_f64_u64(vmovl_u32(vget_low_u32(t)));
+    float64x2_t t1 = vcvtq_f64_u64(vmovl_high_u32(t));
+    float64x2_t d0 = vcvtq_f64_u64(vmovl_u32(vget_low_u32(d)));
+    float64x2_t d1 = vcvtq_f64_u64(vmovl_high_u32(d));
+    float64x2_t r0 = vdivq_f64(vmulq_f64(d0, d0), t0);
+    float64x2_t r1 = vdivq_f64(vmulq_f64(d1, d1), t1);
+    s0 = vaddq_f64(s0, vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(r0), vcgtq_f64(t0, z))));
+    s1 = vaddq_f64(s1, vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(r1), vcgtq_f64(t1, z))));
+}
+#endif
+
+// Chi-square distance of the first n bins of a template t and a query q
+// given as integer counts (both with the same scale):
+//
+//      d(t,q) = sum_i (t_i - q_i)^2 / t_i
+//
+// The differences are computed in integer arithmetic, the terms and their
+// sum in double precision, so the result equals the sum of the terms up to
+// the rounding of the sum. Bins with t_i == 0 are skipped.
+inline double chisquare(const unsigned char* t, const unsigned char* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i z = _mm_setzero_si128();
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 16; i += 16) {
+        __m128i vt = _mm_loadu_si128((const __m128i*)(t + i));
+        // skip blocks where the template is all zero
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(vt, z)) == 0xFFFF)
+            continue;
+        __m128i vq = _mm_loadu_si128((const __m128i*)(q + i));
+        __m128i t16[2] = { _mm_unpacklo_epi8(vt, z), _mm_unpackhi_epi8(vt, z) };
+        __m128i q16[2] = { _mm_unpacklo_epi8(vq, z), _mm_unpackhi_epi8(vq, z) };
+        for(int k = 0; k < 2; k++) {
+            __m128i t32[2] = { _mm_unpacklo_epi16(t16[k], z), _mm_unpackhi_epi16(t16[k], z) };
+            __m128i q32[2] = { _mm_unpacklo_epi16(q16[k], z), _mm_unpackhi_epi16(q16[k], z) };
+            chisquare_epi32(t32[0], _mm_sub_epi32(t32[0], q32[0]), s0, s1);
+            chisquare_epi32(t32[1], _mm_sub_epi32(t32[1], q32[1]), s0, s1);
+        }
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 16; i += 16) {
+        uint8x16_t vt = vld1q_u8(t + i);
+        if(vmaxvq_u8(vt) == 0)
+            continue;
+        uint8x16_t d = vabdq_u8(vt, vld1q_u8(q + i));
+        uint16x8_t t16[2] = { vmovl_u8(vget_low_u8(vt)), vmovl_high_u8(vt) };
+        uint16x8_t d16[2] = { vmovl_u8(vget_low_u8(d)), vmovl_high_u8(d) };
+        for(int k = 0; k < 2; k++) {
+            chisquare_u32(vmovl_u16(vget_low_u16(t16[k])), vmovl_u16(vget_low_u16(d16[k])), s0, s1);
+            chisquare_u32(vmovl_high_u16(t16[k]), vmovl_high_u16(d16[k]), s0, s1);
+        }
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        if(t[i] != 0) {
+            int a = t[i] - q[i];
+            result += static_cast<double>(a*a)/t[i];
+        }
+    }
+    return result;
+}
+
+// See impl::chisquare for unsigned char counts. The differences of 16-bit
+// counts are widened to 32 bit, they're squared in double precision.
+inline double chisquare(const unsigned short* t, const unsigned short* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i z = _mm_setzero_si128();
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m128i vt = _mm_loadu_si128((const __m128i*)(t + i));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi16(vt, z)) == 0xFFFF)
+            continue;
+        __m128i vq = _mm_loadu_si128((const __m128i*)(q + i));
+        __m128i t32[2] = { _mm_unpacklo_epi16(vt, z), _mm_unpackhi_epi16(vt, z) };
+        __m128i q32[2] = { _mm_unpacklo_epi16(vq, z), _mm_unpackhi_epi16(vq, z) };
+        for(int k = 0; k < 2; k++)
+            chisquare_epi32(t32[k], _mm_sub_epi32(t32[k], q32[k]), s0, s1);
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 8; i += 8) {
+        uint16x8_t vt = vld1q_u16(t + i);
+        if(vmaxvq_u16(vt) == 0)
+            continue;
+        uint16x8_t d = vabdq_u16(vt, vld1q_u16(q + i));
+        chisquare_u32(vmovl_u16(vget_low_u16(vt)), vmovl_u16(vget_low_u16(d)), s0, s1);
+        chisquare_u32(vmovl_high_u16(vt), vmovl_high_u16(d), s0, s1);
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        if(t[i] != 0) {
+            double a = static_cast<double>(t[i]) - q[i];
+            result += a*a/t[i];
+        }
+    }
+    return result;
+}
+
+// Chi-square distance with early termination: the bins are processed in
+// blocks of DISTANCE_BLOCK_SIZE and the partial sum is returned as soon as
+// it exceeds bound. A result greater than bound is therefore only a lower
+// bound of the real distance.
+inline double chisquare(const float* t, const float* q, int n, double bound) {
+    double result = 0.0;
+    for(int i = 0; i < n; i += DISTANCE_BLOCK_SIZE) {
+        result += chisquare(t + i, q + i, std::min(DISTANCE_BLOCK_SIZE, n - i));
+        if(result > bound)
+            break;
+    }
+    return result;
+}
+
+// Histogram intersection distance of the first n bins of a template t and a
+// query q:
+//
+//      d(t,q) = sum_i max(t_i - q_i, 0) = sum_i t_i - sum_i min(t_i, q_i)
+//
+// For histograms summing up to 1 this is 1 - the intersection of t and q
+// (cv::compareHist with CV_COMP_INTERSECT), but unlike the intersection it
+// decreases with similarity. Bins with t_i == 0 contribute nothing.
+inline double intersection(const float* t, const float* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 z = _mm256_setzero_ps();
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256 r = _mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(t + i), _mm256_loadu_ps(q + i)), z);
+        s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(r)));
+        s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(r, 1)));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 z = _mm_setzero_ps();
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 4; i += 4) {
+        __m128 r = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(t + i), _mm_loadu_ps(q + i)), z);
+        s0 = _mm_add_pd(s0, _mm_cvtps_pd(r));
+        s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(r, r)));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t z = vdupq_n_f32(0.0f);
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 4; i += 4) {
+        float32x4_t r = vmaxq_f32(vsubq_f32(vld1q_f32(t + i), vld1q_f32(q + i)), z);
+        s0 = vaddq_f64(s0, vcvt_f64_f32(vget_low_f32(r)));
+        s1 = vaddq_f64(s1, vcvt_high_f64_f32(r));
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        double a = static_cast<double>(t[i]) - q[i];
+        if(a > 0.0)
+            result += a;
+    }
+    return result;
+}
+
+// L1 (Manhattan) distance of the first n bins of a template t and a query q:
+//
+//      d(t,q) = sum_i |t_i - q_i|
+//
+inline double l1(const float* t, const float* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256 r = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(t + i), _mm256_loadu_ps(q + i)), absmask);
+        s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(r)));
+        s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(r, 1)));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 4; i += 4) {
+        __m128 r = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(t + i), _mm_loadu_ps(q + i)), absmask);
+        s0 = _mm_add_pd(s0, _mm_cvtps_pd(r));
+        s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(r, r)));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 4; i += 4) {
+        float32x4_t r = vabdq_f32(vld1q_f32(t + i), vld1q_f32(q + i));
+        s0 = vaddq_f64(s0, vcvt_f64_f32(vget_low_f32(r)));
+        s1 = vaddq_f64(s1, vcvt_high_f64_f32(r));
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining bins
+    for(; i < n; i++)
+        result += std::abs(static_cast<double>(t[i]) - q[i]);
+    return result;
+}
+
+// Intersection (see above) and L1 distance of the first n bins of a
+// template t and a query q given as integer counts. The terms are computed
+// with saturating byte arithmetic, max(t-q,0) and |t-q| = max(t-q,0) +
+// max(q-t,0), and summed up exactly in 64-bit integers.
+inline double intersection(const unsigned char* t, const unsigned char* q, int n) {
+    uint64 result = 0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i z = _mm_setzero_si128();
+    __m128i s = _mm_setzero_si128();
+    for(; i <= n - 16; i += 16) {
+        __m128i d = _mm_subs_epu8(_mm_loadu_si128((const __m128i*)(t + i)), _mm_loadu_si128((const __m128i*)(q + i)));
+        s = _mm_add_epi64(s, _mm_sad_epu8(d, z));
+    }
+    uint64 buf[2];
+    _mm_storeu_si128((__m128i*) buf, s);
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t s = vdupq_n_u64(0);
+    for(; i <= n - 16; i += 16) {
+        uint8x16_t d = vqsubq_u8(vld1q_u8(t + i), vld1q_u8(q + i));
+        s = vpadalq_u32(s, vpaddlq_u16(vpaddlq_u8(d)));
+    }
+    result = vaddvq_u64(s);
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        if(t[i] > q[i])
+            result += t[i] - q[i];
+    }
+    return static_cast<double>(result);
+}
+
+inline double l1(const unsigned char* t, const unsigned char* q, int n) {
+    uint64 result = 0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i s = _mm_setzero_si128();
+    for(; i <= n - 16; i += 16) {
+        __m128i vt = _mm_loadu_si128((const __m128i*)(t + i));
+        __m128i vq = _mm_loadu_si128((const __m128i*)(q + i));
+        // the sum of absolute differences is a single instruction
+        s = _mm_add_epi64(s, _mm_sad_epu8(vt, vq));
+    }
+    uint64 buf[2];
+    _mm_storeu_si128((__m128i*) buf, s);
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t s = vdupq_n_u64(0);
+    for(; i <= n - 16; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(t + i), vld1q_u8(q + i));
+        s = vpadalq_u32(s, vpaddlq_u16(vpaddlq_u8(d)));
+    }
+    result = vaddvq_u64(s);
+#endif
+    // remaining bins
+    for(; i < n; i++)
+        result += (t[i] > q[i]) ? t[i] - q[i] : q[i] - t[i];
+    return static_cast<double>(result);
+}
+
+// See the unsigned char kernels, the 16-bit terms are widened to 64 bit
+// before they are summed up.
+inline double intersection(const unsigned short* t, const unsigned short* q, int n) {
+    uint64 result = 0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i z = _mm_setzero_si128();
+    __m128i s = _mm_setzero_si128();
+    for(; i <= n - 8; i += 8) {
+        __m128i d = _mm_subs_epu16(_mm_loadu_si128((const __m128i*)(t + i)), _mm_loadu_si128((const __m128i*)(q + i)));
+        __m128i d32 = _mm_add_epi32(_mm_unpacklo_epi16(d, z), _mm_unpackhi_epi16(d, z));
+        s = _mm_add_epi64(s, _mm_add_epi64(_mm_unpacklo_epi32(d32, z), _mm_unpackhi_epi32(d32, z)));
+    }
+    uint64 buf[2];
+    _mm_storeu_si128((__m128i*) buf, s);
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t s = vdupq_n_u64(0);
+    for(; i <= n - 8; i += 8) {
+        uint16x8_t d = vqsubq_u16(vld1q_u16(t + i), vld1q_u16(q + i));
+        s = vpadalq_u32(s, vpaddlq_u16(d));
+    }
+    result = vaddvq_u64(s);
+#endif
+    // remaining bins
+    for(; i < n; i++) {
+        if(t[i] > q[i])
+            result += t[i] - q[i];
+    }
+    return static_cast<double>(result);
+}
+
+inline double l1(const unsigned short* t, const unsigned short* q, int n) {
+    uint64 result = 0;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i z = _mm_setzero_si128();
+    __m128i s = _mm_setzero_si128();
+    for(; i <= n - 8; i += 8) {
+        __m128i vt = _mm_loadu_si128((const __m128i*)(t + i));
+        __m128i vq = _mm_loadu_si128((const __m128i*)(q + i));
+        __m128i d = _mm_or_si128(_mm_subs_epu16(vt, vq), _mm_subs_epu16(vq, vt));
+        __m128i d32 = _mm_add_epi32(_mm_unpacklo_epi16(d, z), _mm_unpackhi_epi16(d, z));
+        s = _mm_add_epi64(s, _mm_add_epi64(_mm_unpacklo_epi32(d32, z), _mm_unpackhi_epi32(d32, z)));
+    }
+    uint64 buf[2];
+    _mm_storeu_si128((__m128i*) buf, s);
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t s = vdupq_n_u64(0);
+    for(; i <= n - 8; i += 8) {
+        uint16x8_t d = vabdq_u16(vld1q_u16(t + i), vld1q_u16(q + i));
+        s = vpadalq_u32(s, vpaddlq_u16(d));
+    }
+    result = vaddvq_u64(s);
+#endif
+    // remaining bins
+    for(; i < n; i++)
+        result += (t[i] > q[i]) ? t[i] - q[i] : q[i] - t[i];
+    return static_cast<double>(result);
+}
+
+// Squared Euclidean distance of the first n elements of a template t and a
+// query q:
+//
+//      d(t,q) = sum_i (t_i - q_i)^2
+//
+inline double sqeuclidean(const float* t, const float* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__)
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256 r = _mm256_sub_ps(_mm256_loadu_ps(t + i), _mm256_loadu_ps(q + i));
+        __m256d r0 = _mm256_cvtps_pd(_mm256_castps256_ps128(r));
+        __m256d r1 = _mm256_cvtps_pd(_mm256_extractf128_ps(r, 1));
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(r0, r0));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(r1, r1));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 4; i += 4) {
+        __m128 r = _mm_sub_ps(_mm_loadu_ps(t + i), _mm_loadu_ps(q + i));
+        __m128d r0 = _mm_cvtps_pd(r);
+        __m128d r1 = _mm_cvtps_pd(_mm_movehl_ps(r, r));
+        s0 = _mm_add_pd(s0, _mm_mul_pd(r0, r0));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(r1, r1));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 4; i += 4) {
+        float32x4_t r = vsubq_f32(vld1q_f32(t + i), vld1q_f32(q + i));
+        float64x2_t r0 = vcvt_f64_f32(vget_low_f32(r));
+        float64x2_t r1 = vcvt_high_f64_f32(r);
+        s0 = vfmaq_f64(s0, r0, r0);
+        s1 = vfmaq_f64(s1, r1, r1);
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining elements
+    for(; i < n; i++) {
+        double a = static_cast<double>(t[i]) - q[i];
+        result += a * a;
+    }
+    return result;
+}
+
+// Squared Euclidean distance of the first n elements of two double vectors,
+// see above.
+inline double sqeuclidean(const double* t, const double* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__)
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256d r0 = _mm256_sub_pd(_mm256_loadu_pd(t + i), _mm256_loadu_pd(q + i));
+        __m256d r1 = _mm256_sub_pd(_mm256_loadu_pd(t + i + 4), _mm256_loadu_pd(q + i + 4));
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(r0, r0));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(r1, r1));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    for(; i <= n - 4; i += 4) {
+        __m128d r0 = _mm_sub_pd(_mm_loadu_pd(t + i), _mm_loadu_pd(q + i));
+        __m128d r1 = _mm_sub_pd(_mm_loadu_pd(t + i + 2), _mm_loadu_pd(q + i + 2));
+        s0 = _mm_add_pd(s0, _mm_mul_pd(r0, r0));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(r1, r1));
+    }
+    double buf[2];
+    _mm_storeu_pd(buf, _mm_add_pd(s0, s1));
+    result = buf[0] + buf[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float64x2_t s0 = vdupq_n_f64(0.0);
+    float64x2_t s1 = vdupq_n_f64(0.0);
+    for(; i <= n - 4; i += 4) {
+        float64x2_t r0 = vsubq_f64(vld1q_f64(t + i), vld1q_f64(q + i));
+        float64x2_t r1 = vsubq_f64(vld1q_f64(t + i + 2), vld1q_f64(q + i + 2));
+        s0 = vfmaq_f64(s0, r0, r0);
+        s1 = vfmaq_f64(s1, r1, r1);
+    }
+    result = vaddvq_f64(vaddq_f64(s0, s1));
+#endif
+    // remaining elements
+    for(; i < n; i++) {
+        double a = t[i] - q[i];
+        result += a * a;
+    }
+    return result;
+}
+
+// Squared Euclidean distance with early termination, see the bounded
+// impl::chisquare.
+inline double sqeuclidean(const float* t, const float* q, int n, double bound) {
+    double result = 0.0;
+    for(int i = 0; i < n; i += DISTANCE_BLOCK_SIZE) {
+        result += sqeuclidean(t + i, q + i, std::min(DISTANCE_BLOCK_SIZE, n - i));
+        if(result > bound)
+            break;
+    }
+    return result;
+}
+
+// Smallest template value used by the log-likelihood statistic, empty
+// template bins would give an infinite distance otherwise.
+const double LOG_LIKELIHOOD_EPSILON = 1e-6;
+
+// Sums up the terms of a metric (see ChiSquareTerm) over the first n bins of
+// a template t and a query q.
+template <typename _Term, typename _Tp>
+inline double sum_terms(const _Tp* t, const _Tp* q, int n) {
+    double result = 0.0;
+    for(int i = 0; i < n; i++)
+        result += _Term::term(t[i], q[i]);
+    return result;
+}
+
+// The metrics are described by their term per bin, the distance of two
+// histograms is the sum of all terms. Every term is nonnegative, so a partial
+// sum is a lower bound of the distance. Bins with t_i == 0 contribute
+// zero()*q_i, which lets sparse templates only visit their non-zero bins.
+// A homogeneous metric satisfies d(s*t, s*q) = s*d(t,q), so it can be
+// computed on unnormalized counts. cell computes the distance of n bins with
+// the fastest kernel available.
+struct ChiSquareTerm {
+    enum { homogeneous = 1 };
+    static double zero() { return 0.0; }
+    static double term(double t, double q) {
+        if(t == 0.0)
+            return 0.0;
+        double a = t - q;
+        return a*a/t;
+    }
+    static double cell(const float* t, const float* q, int n) { return chisquare(t, q, n); }
+    static double cell(const unsigned char* t, const unsigned char* q, int n) { return chisquare(t, q, n); }
+    static double cell(const unsigned short* t, const unsigned short* q, int n) { return chisquare(t, q, n); }
+};
+
+// See impl::intersection.
+struct IntersectionTerm {
+    enum { homogeneous = 1 };
+    static double zero() { return 0.0; }
+    static double term(double t, double q) { return (t > q) ? t - q : 0.0; }
+    static double cell(const float* t, const float* q, int n) { return intersection(t, q, n); }
+    static double cell(const unsigned char* t, const unsigned char* q, int n) { return intersection(t, q, n); }
+    static double cell(const unsigned short* t, const unsigned short* q, int n) { return intersection(t, q, n); }
+};
+
+// See impl::l1.
+struct L1Term {
+    enum { homogeneous = 1 };
+    static double zero() { return 1.0; }
+    static double term(double t, double q) { return std::abs(t - q); }
+    static double cell(const float* t, const float* q, int n) { return l1(t, q, n); }
+    static double cell(const unsigned char* t, const unsigned char* q, int n) { return l1(t, q, n); }
+    static double cell(const unsigned short* t, const unsigned short* q, int n) { return l1(t, q, n); }
+};
+
+// The log-likelihood statistic of Ahonen et al., with the query q as sample
+// and the template t as model:
+//
+//      d(t,q) = - sum_i q_i * log(t_i)
+//
+// Template values are clamped to LOG_LIKELIHOOD_EPSILON. The histograms must
+// be normalized, the statistic isn't homogeneous.
+struct LogLikelihoodTerm {
+    enum { homogeneous = 0 };
+    static double zero() { return -std::log(LOG_LIKELIHOOD_EPSILON); }
+    static double term(double t, double q) { return -q * std::log(std::max(t, LOG_LIKELIHOOD_EPSILON)); }
+    template <typename _Tp>
+    static double cell(const _Tp* t, const _Tp* q, int n) { return sum_terms<LogLikelihoodTerm>(t, q, n); }
+};
+
+// Number of set bits of a word. GCC and Clang emit a single POPCNT
+// instruction when compiled for a CPU which has it (e.g. -mpopcnt).
+inline int popcount(uint64 x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return static_cast<int>(__popcnt64(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Hamming distance of two binary codes of n words.
+inline int hamming(const uint64* a, const uint64* b, int n) {
+    int result = 0;
+    for(int i = 0; i < n; i++)
+        result += popcount(a[i] ^ b[i]);
+    return result;
+}
+
+// A half-precision (IEEE 754 binary16) float, stored as its bit pattern.
+struct float16 {
+    unsigned short bits;
+};
+
+// Converts a float to the nearest half, ties to even. Values beyond the
+// range of a half become infinite.
+inline float16 to_float16(float f) {
+    unsigned int x;
+    std::memcpy(&x, &f, sizeof(x));
+    unsigned int sign = (x >> 16) & 0x8000u;
+    unsigned int absx = x & 0x7fffffffu;
+    float16 h;
+    if(absx >= 0x7f800000u) {
+        // infinity or NaN
+        h.bits = static_cast<unsigned short>(sign | 0x7c00u | ((absx > 0x7f800000u) ? 0x200u : 0u));
+    } else if(absx >= 0x477ff000u) {
+        // rounds to 65520 or more
+        h.bits = static_cast<unsigned short>(sign | 0x7c00u);
+    } else if(absx < 0x33000000u) {
+        // rounds to zero
+        h.bits = static_cast<unsigned short>(sign);
+    } else if(absx < 0x38800000u) {
+        // subnormal half in units of 2^-24
+        unsigned int shift = 126u - (absx >> 23);
+        unsigned int m = (absx & 0x7fffffu) | 0x800000u;
+        unsigned int v = m >> shift;
+        unsigned int rest = m & ((1u << shift) - 1u);
+        unsigned int halfway = 1u << (shift - 1u);
+        if((rest > halfway) || ((rest == halfway) && (v & 1u)))
+            v++;
+        h.bits = static_cast<unsigned short>(sign | v);
+    } else {
+        // rebias the exponent, a carry of the rounding goes to the exponent
+        unsigned int v = (absx - 0x38000000u) >> 13;
+        unsigned int rest = absx & 0x1fffu;
+        if((rest > 0x1000u) || ((rest == 0x1000u) && (v & 1u)))
+            v++;
+        h.bits = static_cast<unsigned short>(sign | v);
+    }
+    return h;
+}
+
+// Converts a half to a float, which is exact.
+inline float to_float(float16 h) {
+    unsigned int sign = static_cast<unsigned int>(h.bits & 0x8000u) << 16;
+    unsigned int exponent = (h.bits >> 10) & 0x1fu;
+    unsigned int mantissa = h.bits & 0x3ffu;
+    unsigned int x;
+    if(exponent == 0) {
+        if(mantissa == 0) {
+            x = sign;
+        } else {
+            // normalize a subnormal half
+            exponent = 113;
+            while(!(mantissa & 0x400u)) {
+                mantissa <<= 1;
+                exponent--;
+            }
+            x = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+    } else if(exponent == 31) {
+        x = sign | 0x7f800000u | (mantissa << 13);
+    } else {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// Squared Euclidean distance of the first n elements of a half template t
+// and a query q, see above. With F16C four halves are converted at once.
+inline double sqeuclidean(const float16* t, const double* q, int n) {
+    double result = 0.0;
+    int i = 0;
+#if defined(__AVX__) && defined(__F16C__)
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    for(; i <= n - 8; i += 8) {
+        __m256 h = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i)));
+        __m256d r0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(h)), _mm256_loadu_pd(q + i));
+        __m256d r1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(h, 1)), _mm256_loadu_pd(q + i + 4));
+        s0 = _mm256_add_pd(s0, _mm256_mul_pd(r0, r0));
+        s1 = _mm256_add_pd(s1, _mm256_mul_pd(r1, r1));
+    }
+    double buf[4];
+    _mm256_storeu_pd(buf, _mm256_add_pd(s0, s1));
+    result = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+#endif
+    // remaining elements
+    for(; i < n; i++) {
+        double a = to_float(t[i]) - q[i];
+        result += a * a;
+    }
+    return result;
+}
+
+// Squared Euclidean distance of the first n elements of an int8 template
+// with the values scale*t_i and a query q:
+//
+//      d(t,q) = sum_i (scale*t_i - q_i)^2
+//
+inline double sqeuclidean(const schar* t, double scale, const double* q, int n) {
+    double s0 = 0.0, s1 = 0.0;
+    int i = 0;
+    for(; i <= n - 2; i += 2) {
+        double a0 = scale * t[i] - q[i];
+        double a1 = scale * t[i + 1] - q[i + 1];
+        s0 += a0 * a0;
+        s1 += a1 * a1;
+    }
+    for(; i < n; i++) {
+        double a = scale * t[i] - q[i];
+        s0 += a * a;
+    }
+    return s0 + s1;
+}
+
+// Adds a times the first n elements of a half vector t to y.
+inline void axpy(const float16* t, double a, double* y, int n) {
+    int i = 0;
+#if defined(__AVX__) && defined(__F16C__)
+    __m256d va = _mm256_set1_pd(a);
+    for(; i <= n - 4; i += 4) {
+        __m128 h = _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(t + i)));
+        __m256d r = _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(va, _mm256_cvtps_pd(h)));
+        _mm256_storeu_pd(y + i, r);
+    }
+#endif
+    for(; i < n; i++)
+        y[i] += a * to_float(t[i]);
+}
+
+// Adds a times the first n elements of an int8 vector t to y.
+inline void axpy(const schar* t, double a, double* y, int n) {
+    for(int i = 0; i < n; i++)
+        y[i] += a * t[i];
+}
+
+} // namespace impl
+
+// Calculates the Chi-square distance between a template histogram t and a
+// query histogram q, both continuous CV_32FC1 matrices with the same number
+// of elements. The computation stops early once the distance exceeds bound,
+// in which case the returned (partial) distance is greater than bound.
+//
+//      double d = chisquare(histograms.row(i), query);
+//
+inline double chisquare(const Mat& t, const Mat& q, double bound = DBL_MAX) {
+    if((t.type() != CV_32FC1) || (q.type() != CV_32FC1))
+        CV_Error(CV_StsUnmatchedFormats, "Only CV_32FC1 histograms are supported.");
+    if(t.total() != q.total())
+        CV_Error(CV_StsBadArg, "Both histograms must have the same number of bins.");
+    if(!t.isContinuous() || !q.isContinuous())
+        CV_Error(CV_StsBadArg, "Histograms must be continuous.");
+    return impl::chisquare(t.ptr<float>(), q.ptr<float>(), (int) t.total(), bound);
+}
+
+} // namespace cv
+
+#endif
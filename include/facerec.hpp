@@ -24,6 +24,13 @@
 #include "subspace.hpp"
 #include "helper.hpp"
 #include "lbp.hpp"
+#include "distance.hpp"
+#include "gallery.hpp"
+#include "index.hpp"
+#include "model.hpp"
+#include "journal.hpp"
+
+#include <cstdio>
 
 using namespace std;
 
@@ -41,8 +48,19 @@ public:
     // Gets a prediction from a FaceRecognizer.
     virtual int predict(const Mat& src) = 0;
 
-    // Serializes this object to a given filename.
-    virtual void save(const string& filename) const {
+    // Serializes this object to a given filename. Filenames ending in ".bin"
+    // get the binary model format (see ModelWriter), written with the flags
+    // of the writer (ModelWriter::COMPRESS), all others are written with
+    // cv::FileStorage.
+    virtual void save(const string& filename, int flags = 0) const {
+        if(isModelFilename(filename)) {
+            ModelWriter fs(filename, flags);
+            if (!fs.isOpened())
+                CV_Error(CV_StsError, "File can't be opened for writing!");
+            this->save(fs);
+            fs.release();
+            return;
+        }
         FileStorage fs(filename, FileStorage::WRITE);
         if (!fs.isOpened())
             CV_Error(CV_StsError, "File can't be opened for writing!");
@@ -50,13 +68,59 @@ public:
         fs.release();
     }
 
-    // Deserializes this object from a given filename.
+    // Deserializes this object from a given filename. Binary models are
+    // recognized by their magic number, all other files are read with
+    // cv::FileStorage.
     virtual void load(const string& filename) {
+        if(isModelFile(filename)) {
+            ModelReader fs(filename);
+            this->load(fs);
+            _mapping.release();
+            return;
+        }
         FileStorage fs(filename, FileStorage::READ);
         if (!fs.isOpened())
             CV_Error(CV_StsError, "File can't be opened for writing!");
         this->load(fs);
         fs.release();
+        _mapping.release();
+    }
+
+    // Serializes this object to a stream (opened in binary mode) in the
+    // binary model format. The sections are written as they are serialized,
+    // so the stream may be a pipe or a socket.
+    virtual void save(std::ostream& stream, int flags = 0) const {
+        ModelWriter fs(stream, flags);
+        this->save(fs);
+        fs.release();
+    }
+
+    // Deserializes this object from a stream in the binary model format,
+    // which is read in one pass up to the end of the model.
+    virtual void load(std::istream& stream) {
+        ModelReader fs(stream);
+        if (!fs.isOpened())
+            CV_Error(CV_StsError, "Stream can't be read!");
+        this->load(fs);
+        _mapping.release();
+    }
+
+    // Loads a binary model for read-only serving: the file is mapped into
+    // memory and the matrices of the model are headers over the mapped
+    // pages, so processes serving the same model share its memory. The
+    // accessors of a mapped model return copies, which stay valid when
+    // another file is mapped.
+    //
+    // Compressed sections (see ModelWriter::COMPRESS) are decoded into
+    // private memory instead, so they are neither shared nor free to map.
+    // Models meant for mapping are best saved without compression, which
+    // trades the smaller file for the shared pages.
+    virtual void map(const string& filename) {
+        ModelReader fs(filename, ModelReader::MAP);
+        if (!fs.isOpened())
+            CV_Error(CV_StsError, "File can't be opened for reading!");
+        this->load(fs);
+        _mapping = fs.mapping();
     }
 
     // Serializes this object to a given cv::FileStorage.
@@ -64,6 +128,23 @@ public:
 
     // Deserializes this object from a given cv::FileStorage.
     virtual void load(const FileStorage& node) = 0;
+
+    // Serializes this object to a binary model file.
+    virtual void save(ModelWriter& fs) const = 0;
+
+    // Deserializes this object from a binary model file.
+    virtual void load(const ModelReader& fs) = 0;
+
+protected:
+    // mapping of a model loaded with map
+    Ptr<impl::MappedFile> _mapping;
+
+    // Returns m, or a copy of it for a mapped model. The matrices of a
+    // mapped model don't own their data, so they must not outlive the
+    // mapping.
+    Mat detached(const Mat& m) const {
+        return _mapping.empty() ? m : m.clone();
+    }
 };
 
 // Turk, M., and Pentland, A. "Eigenfaces for recognition.". Journal of
@@ -72,29 +153,98 @@ class Eigenfaces: public FaceRecognizer {
 
 private:
     int _num_components;
-    vector<Mat> _projections;
+    // storage precision of the eigenvectors and projections (see PackedMat)
+    int _precision;
+    // projections of the training samples (one per row) and their index
+    PackedMat _projections;
+    int _index_type;
+    Ptr<GalleryIndex> _index;
     vector<int> _labels;
-    Mat _eigenvectors;
+    PackedMat _eigenvectors;
     Mat _eigenvalues;
     Mat _mean;
+    // journal of the enrolled samples, see openJournal
+    Ptr<GalleryJournal> _journal;
+
+    // Returns the projections, which are read back from an index that
+    // spills them (see GalleryIndex::spills).
+    PackedMat packedProjections() const {
+        if(_index->spills())
+            return PackedMat(_index->samples(), _precision);
+        return _projections;
+    }
+
+    // Drops the projections if the index spills them.
+    void spill() {
+        if(_index->spills())
+            _projections.clear();
+    }
 
 public:
     using FaceRecognizer::save;
     using FaceRecognizer::load;
 
-    // Initializes an empty Eigenfaces model.
-    Eigenfaces(int num_components = 0) :
-        _num_components(num_components) { }
+    // Initializes an empty Eigenfaces model. The nearest projection is
+    // searched with the given index (see GalleryIndex), the approximate HNSW
+    // and IVFPQ indices scale to galleries with millions of faces, IVFPQ
+    // also compresses them to a few bytes per face. The HASHING index
+    // predicts in two stages: a Hamming scan of binary codes and an exact
+    // re-ranking of its shortlist.
+    //
+    // The eigenvectors and projections are stored with the given precision
+    // (see PackedMat), in memory and in saved models. Half floats or int8
+    // codes lose little accuracy, the projection of a query and the linear
+    // index work on the packed values directly.
+    Eigenfaces(int num_components = 0, int index = GalleryIndex::LINEAR,
+            int precision = PackedMat::FLOAT64) :
+        _num_components(num_components),
+        _precision(precision),
+        _projections(precision),
+        _index_type(index),
+        _index(createGalleryIndex(index, precision)),
+        _eigenvectors(precision) { }
 
     // Initializes and computes an Eigenfaces model with images in src and
     // corresponding labels in labels. num_components will be kept for
     // classification.
     Eigenfaces(const vector<Mat>& src, const vector<int>& labels,
-            int num_components = 0) :
-        _num_components(num_components) {
+            int num_components = 0, int index = GalleryIndex::LINEAR,
+            int precision = PackedMat::FLOAT64) :
+        _num_components(num_components),
+        _precision(precision),
+        _projections(precision),
+        _index_type(index),
+        _index(createGalleryIndex(index, precision)),
+        _eigenvectors(precision) {
         train(src, labels);
     }
 
+    // Copies a model, see operator=.
+    Eigenfaces(const Eigenfaces& other) :
+        FaceRecognizer(other) {
+        *this = other;
+    }
+
+    // Copies a model. The copy gets its own index over its own projections,
+    // and doesn't append to the journal of other.
+    Eigenfaces& operator=(const Eigenfaces& other) {
+        if(this == &other)
+            return *this;
+        FaceRecognizer::operator=(other);
+        _num_components = other._num_components;
+        _precision = other._precision;
+        _projections = other.packedProjections();
+        _index_type = other._index_type;
+        _labels = other._labels;
+        _eigenvectors = other._eigenvectors;
+        _eigenvalues = other._eigenvalues;
+        _mean = other._mean;
+        _journal.release();
+        _index = copyGalleryIndex(*other._index, _precision, _projections);
+        spill();
+        return *this;
+    }
+
     // Computes an Eigenfaces model with images in src and corresponding labels
     // in labels.
     void train(const vector<Mat>& src, const vector<int>& labels) {
@@ -115,28 +265,84 @@ public:
         // copy the PCA results
         _mean = pca.mean.reshape(1,1); // store the mean vector
         _eigenvalues = pca.eigenvalues.clone(); // store the eigenvectors
-        _eigenvectors = transpose(pca.eigenvectors); // OpenCV stores the Eigenvectors by row (??)
+        _eigenvectors = PackedMat(transpose(pca.eigenvectors), _precision); // OpenCV stores the Eigenvectors by row (??)
         _labels = vector<int>(labels); // store labels for projections
         // save projections
-        for(int sampleIdx = 0; sampleIdx < data.rows; sampleIdx++) {
-            Mat p = subspace::project(_eigenvectors, _mean, data.row(sampleIdx));
-            this->_projections.push_back(p);
-        }
+        _projections = PackedMat(project(_eigenvectors, _mean, data), _precision);
+        _index->build(_projections);
+        spill();
     }
 
     // Predicts the label of a query image in src.
     int predict(const Mat& src) {
-        Mat q = subspace::project(_eigenvectors, _mean, src.reshape(1,1));
-        double minDist = numeric_limits<double>::max();
-        int minClass = -1;
-        for(int sampleIdx = 0; sampleIdx < _projections.size(); sampleIdx++) {
-            double dist = norm(_projections[sampleIdx], q, NORM_L2);
-            if(dist < minDist) {
-                minDist = dist;
-                minClass = _labels[sampleIdx];
-            }
+        Mat q = project(_eigenvectors, _mean, src.reshape(1,1));
+        int sampleIdx = _index->nearest(q);
+        return (sampleIdx < 0) ? -1 : _labels[sampleIdx];
+    }
+
+    // Adds the image in src with the given label to a computed model, the
+    // eigenvectors are kept.
+    void enroll(const Mat& src, int label) {
+        if(_eigenvectors.empty())
+            CV_Error(CV_StsError, "The model has to be computed before enrolling faces.");
+        Mat p = project(_eigenvectors, _mean, src.reshape(1,1));
+        if(!_index->spills())
+            _projections.push_back(p);
+        _labels.push_back(label);
+        _index->add(p);
+        if(!_journal.empty())
+            _journal->append(label, p);
+    }
+
+    // Opens the gallery journal in filename (see GalleryJournal) for this
+    // computed model: the samples enrolled since the model was saved are
+    // replayed from the journal, and all further enrollments are appended
+    // to it, so persisting an enrollment only writes its projection.
+    void openJournal(const string& filename) {
+        if(_eigenvectors.empty())
+            CV_Error(CV_StsError, "The model has to be computed before opening a journal.");
+        int n = static_cast<int>(_labels.size());
+        Ptr<GalleryJournal> journal = new GalleryJournal(filename, n,
+                CV_64FC1, _eigenvectors.cols());
+        vector<int> labels;
+        Mat templates;
+        journal->replay(n, labels, templates);
+        for(int sampleIdx = 0; sampleIdx < templates.rows; sampleIdx++) {
+            if(!_index->spills())
+                _projections.push_back(templates.row(sampleIdx));
+            _labels.push_back(labels[sampleIdx]);
+            _index->add(templates.row(sampleIdx));
         }
-        return minClass;
+        _journal = journal;
+    }
+
+    // Folds the journal into the base model: the model is saved to filename,
+    // which is replaced atomically, and the journal is reset.
+    void compact(const string& filename) {
+        // the temporary file keeps the extension, which selects the format
+        size_t dot = filename.find_last_of('.');
+        if((dot == string::npos) || (filename.find_first_of("/\\", dot) != string::npos))
+            dot = filename.size();
+        string tmp = filename.substr(0, dot) + ".tmp" + filename.substr(dot);
+        save(tmp);
+#if defined(_WIN32)
+        // rename doesn't replace existing files on Windows
+        std::remove(filename.c_str());
+#endif
+        if(std::rename(tmp.c_str(), filename.c_str()) != 0)
+            CV_Error(CV_StsError, "Could not replace the model " + filename + ".");
+        if(!_journal.empty())
+            _journal->reset(static_cast<int>(_labels.size()));
+    }
+
+    // Replaces the index of this model, for example by an HNSWIndex with
+    // other parameters, and builds it over the projections.
+    void setIndex(const Ptr<GalleryIndex>& index) {
+        _projections = packedProjections();
+        _index = index;
+        _index_type = index->type();
+        _index->build(_projections);
+        spill();
     }
 
     // See cv::FaceRecognizer::load.
@@ -145,10 +351,23 @@ public:
         fs["num_components"] >> _num_components;
         fs["mean"] >> _mean;
         fs["eigenvalues"] >> _eigenvalues;
-        fs["eigenvectors"] >> _eigenvectors;
-        // read sequences
-        readFileNodeList(fs["projections"], _projections);
+        // models without a precision store doubles
+        fs["precision"] >> _precision;
+        _eigenvectors.load(fs, "eigenvectors");
+        // read sequences, packed projections are a single matrix
+        if(_precision == PackedMat::FLOAT64) {
+            vector<Mat> projections;
+            readFileNodeList(fs["projections"], projections);
+            _projections = PackedMat(asRowMatrix(projections, CV_64FC1), _precision);
+        } else {
+            _projections.load(fs, "projections");
+        }
         readFileNodeList(fs["labels"], _labels);
+        // models without an index type use the linear scan
+        fs["index"] >> _index_type;
+        _index = createGalleryIndex(_index_type, _precision);
+        _index->load(fs.root(), _projections);
+        spill();
     }
 
     // See cv::FaceRecognizer::save.
@@ -157,20 +376,69 @@ public:
         fs << "num_components" << _num_components;
         fs << "mean" << _mean;
         fs << "eigenvalues" << _eigenvalues;
-        fs << "eigenvectors" << _eigenvectors;
-        // write sequences
-        writeFileNodeList(fs, "projections", _projections);
+        fs << "precision" << _precision;
+        _eigenvectors.save(fs, "eigenvectors");
+        // write sequences, one matrix per projection
+        PackedMat packed = packedProjections();
+        if(_precision == PackedMat::FLOAT64) {
+            vector<Mat> projections;
+            for(int sampleIdx = 0; sampleIdx < packed.rows(); sampleIdx++)
+                projections.push_back(packed.data().row(sampleIdx));
+            writeFileNodeList(fs, "projections", projections);
+        } else {
+            packed.save(fs, "projections");
+        }
         writeFileNodeList(fs, "labels", _labels);
+        fs << "index" << _index_type;
+        _index->save(fs);
+    }
+
+    // See cv::FaceRecognizer::load, the projections are a single matrix.
+    void load(const ModelReader& fs) {
+        fs["num_components"] >> _num_components;
+        fs["mean"] >> _mean;
+        fs["eigenvalues"] >> _eigenvalues;
+        fs["precision"] >> _precision;
+        _eigenvectors.load(fs, "eigenvectors");
+        _projections.load(fs, "projections");
+        fs["labels"] >> _labels;
+        fs["index"] >> _index_type;
+        _index = createGalleryIndex(_index_type, _precision);
+        _index->load(fs.root(), _projections);
+        spill();
+    }
+
+    // See cv::FaceRecognizer::save.
+    void save(ModelWriter& fs) const {
+        fs << "num_components" << _num_components;
+        fs << "mean" << _mean;
+        fs << "eigenvalues" << _eigenvalues;
+        fs << "precision" << _precision;
+        _eigenvectors.save(fs, "eigenvectors");
+        packedProjections().save(fs, "projections");
+        fs << "labels" << _labels;
+        fs << "index" << _index_type;
+        _index->save(fs);
     }
 
+    // Returns the projections of the training samples (one per row).
+    Mat projections() const { return detached(packedProjections().unpack()); }
+
+    // Returns the index of this model, which may reference the projections
+    // of this model (see GalleryIndex::build).
+    Ptr<GalleryIndex> index() const { return _index; }
+
     // Returns the eigenvectors of this PCA.
-    Mat eigenvectors() const { return _eigenvectors; }
+    Mat eigenvectors() const { return detached(_eigenvectors.unpack()); }
+
+    // Returns the storage precision of the eigenvectors and projections.
+    int precision() const { return _precision; }
 
     // Returns the eigenvalues of this PCA.
-    Mat eigenvalues() const { return _eigenvalues; }
+    Mat eigenvalues() const { return detached(_eigenvalues); }
 
     // Returns the sample mean of this PCA.
-    Mat mean() const { return _mean; }
+    Mat mean() const { return detached(_mean); }
 
     // Returns the number of components used in this PCA.
     int num_components() const { return _num_components; }
@@ -184,30 +452,90 @@ class Fisherfaces: public FaceRecognizer {
 
 private:
     int _num_components;
-    Mat _eigenvectors;
+    // storage precision of the eigenvectors and projections (see PackedMat)
+    int _precision;
+    PackedMat _eigenvectors;
     Mat _eigenvalues;
     Mat _mean;
-    vector<Mat> _projections;
+    // projections of the training samples (one per row) and their index
+    PackedMat _projections;
+    int _index_type;
+    Ptr<GalleryIndex> _index;
     vector<int> _labels;
 
+    // Returns the projections, which are read back from an index that
+    // spills them (see GalleryIndex::spills).
+    PackedMat packedProjections() const {
+        if(_index->spills())
+            return PackedMat(_index->samples(), _precision);
+        return _projections;
+    }
+
+    // Drops the projections if the index spills them.
+    void spill() {
+        if(_index->spills())
+            _projections.clear();
+    }
+
 public:
     using FaceRecognizer::save;
     using FaceRecognizer::load;
 
-    // Initializes an empty Fisherfaces model.
-    Fisherfaces(int num_components = 0) :
-        _num_components(num_components) {}
+    // Initializes an empty Fisherfaces model. The nearest projection is
+    // searched with the given index (see GalleryIndex), a KD-tree or ball
+    // tree is usually faster than the linear scan for the few components of
+    // a Fisherfaces model. The eigenvectors and projections are stored with
+    // the given precision, see Eigenfaces.
+    Fisherfaces(int num_components = 0, int index = GalleryIndex::LINEAR,
+            int precision = PackedMat::FLOAT64) :
+        _num_components(num_components),
+        _precision(precision),
+        _eigenvectors(precision),
+        _projections(precision),
+        _index_type(index),
+        _index(createGalleryIndex(index, precision)) {}
 
     // Initializes and computes a Fisherfaces model with images in src and
     // corresponding labels in labels. num_components will be kept for
     // classification.
     Fisherfaces(const vector<Mat>& src,
             const vector<int>& labels,
-            int num_components = 0) :
-        _num_components(num_components) {
+            int num_components = 0,
+            int index = GalleryIndex::LINEAR,
+            int precision = PackedMat::FLOAT64) :
+        _num_components(num_components),
+        _precision(precision),
+        _eigenvectors(precision),
+        _projections(precision),
+        _index_type(index),
+        _index(createGalleryIndex(index, precision)) {
         train(src, labels);
     }
 
+    // Copies a model, see operator=.
+    Fisherfaces(const Fisherfaces& other) :
+        FaceRecognizer(other) {
+        *this = other;
+    }
+
+    // Copies a model, the copy gets its own index over its own projections.
+    Fisherfaces& operator=(const Fisherfaces& other) {
+        if(this == &other)
+            return *this;
+        FaceRecognizer::operator=(other);
+        _num_components = other._num_components;
+        _precision = other._precision;
+        _eigenvectors = other._eigenvectors;
+        _eigenvalues = other._eigenvalues;
+        _mean = other._mean;
+        _projections = other.packedProjections();
+        _index_type = other._index_type;
+        _labels = other._labels;
+        _index = copyGalleryIndex(*other._index, _precision, _projections);
+        spill();
+        return *this;
+    }
+
     ~Fisherfaces() { }
 
     // Computes a Fisherfaces model with images in src and corresponding labels
@@ -234,28 +562,21 @@ public:
         lda.eigenvalues().convertTo(_eigenvalues, CV_64FC1);
         // Now calculate the projection matrix as pca.eigenvectors * lda.eigenvectors.
         // Note: OpenCV stores the eigenvectors by row, so we need to transpose it!
-        gemm(pca.eigenvectors, lda.eigenvectors(), 1.0, Mat(), 0.0, _eigenvectors, CV_GEMM_A_T);
+        Mat eigenvectors;
+        gemm(pca.eigenvectors, lda.eigenvectors(), 1.0, Mat(), 0.0, eigenvectors, CV_GEMM_A_T);
+        _eigenvectors = PackedMat(eigenvectors, _precision);
         // store the projections of the original data
-        for(int sampleIdx = 0; sampleIdx < data.rows; sampleIdx++) {
-            Mat p = subspace::project(_eigenvectors, _mean, data.row(sampleIdx));
-            _projections.push_back(p);
-        }
+        _projections = PackedMat(project(_eigenvectors, _mean, data), _precision);
+        _index->build(_projections);
+        spill();
     }
 
     // Predicts the label of a query image in src.
     int predict(const Mat& src) {
-        Mat q = subspace::project(_eigenvectors, _mean, src.reshape(1,1));
+        Mat q = project(_eigenvectors, _mean, src.reshape(1,1));
         // find 1-nearest neighbor
-        double minDist = numeric_limits<double>::max();
-        int minClass = -1;
-        for(int sampleIdx = 0; sampleIdx < _projections.size(); sampleIdx++) {
-            double dist = norm(_projections[sampleIdx], q, NORM_L2);
-            if(dist < minDist) {
-                minDist = dist;
-                minClass = _labels[sampleIdx];
-            }
-        }
-        return minClass;
+        int sampleIdx = _index->nearest(q);
+        return (sampleIdx < 0) ? -1 : _labels[sampleIdx];
     }
 
     // See cv::FaceRecognizer::load.
@@ -264,9 +585,22 @@ public:
         fs["num_components"] >> _num_components;
         fs["mean"] >> _mean;
         fs["eigenvalues"] >> _eigenvalues;
-        fs["eigenvectors"] >> _eigenvectors;
-        // read sequences
-        readFileNodeList(fs["projections"], _projections);
+        // models without a precision store doubles
+        fs["precision"] >> _precision;
+        _eigenvectors.load(fs, "eigenvectors");
+        // models without an index type use the linear scan
+        fs["index"] >> _index_type;
+        _index = createGalleryIndex(_index_type, _precision);
+        // read sequences, packed projections are a single matrix
+        if(_precision == PackedMat::FLOAT64) {
+            vector<Mat> projections;
+            readFileNodeList(fs["projections"], projections);
+            _projections = PackedMat(asRowMatrix(projections, CV_64FC1), _precision);
+        } else {
+            _projections.load(fs, "projections");
+        }
+        _index->load(fs.root(), _projections);
+        spill();
         readFileNodeList(fs["labels"], _labels);
     }
 
@@ -276,20 +610,76 @@ public:
         fs << "num_components" << _num_components;
         fs << "mean" << _mean;
         fs << "eigenvalues" << _eigenvalues;
-        fs << "eigenvectors" << _eigenvectors;
-        // write sequences
-        writeFileNodeList(fs, "projections", _projections);
+        fs << "precision" << _precision;
+        _eigenvectors.save(fs, "eigenvectors");
+        fs << "index" << _index_type;
+        // write sequences, one matrix per projection
+        PackedMat packed = packedProjections();
+        if(_precision == PackedMat::FLOAT64) {
+            vector<Mat> projections;
+            for(int sampleIdx = 0; sampleIdx < packed.rows(); sampleIdx++)
+                projections.push_back(packed.data().row(sampleIdx));
+            writeFileNodeList(fs, "projections", projections);
+        } else {
+            packed.save(fs, "projections");
+        }
         writeFileNodeList(fs, "labels", _labels);
+        _index->save(fs);
+    }
+
+    // See cv::FaceRecognizer::load, the projections are a single matrix.
+    void load(const ModelReader& fs) {
+        fs["num_components"] >> _num_components;
+        fs["mean"] >> _mean;
+        fs["eigenvalues"] >> _eigenvalues;
+        fs["precision"] >> _precision;
+        _eigenvectors.load(fs, "eigenvectors");
+        fs["index"] >> _index_type;
+        _index = createGalleryIndex(_index_type, _precision);
+        _projections.load(fs, "projections");
+        _index->load(fs.root(), _projections);
+        spill();
+        fs["labels"] >> _labels;
     }
 
+    // See cv::FaceRecognizer::save.
+    void save(ModelWriter& fs) const {
+        fs << "num_components" << _num_components;
+        fs << "mean" << _mean;
+        fs << "eigenvalues" << _eigenvalues;
+        fs << "precision" << _precision;
+        _eigenvectors.save(fs, "eigenvectors");
+        fs << "index" << _index_type;
+        packedProjections().save(fs, "projections");
+        fs << "labels" << _labels;
+        _index->save(fs);
+    }
+
+    // Replaces the index of this model and builds it over the projections,
+    // see Eigenfaces::setIndex.
+    void setIndex(const Ptr<GalleryIndex>& index) {
+        _projections = packedProjections();
+        _index = index;
+        _index_type = index->type();
+        _index->build(_projections);
+        spill();
+    }
+
+    // Returns the index of this model, which may reference the projections
+    // of this model (see GalleryIndex::build).
+    Ptr<GalleryIndex> index() const { return _index; }
+
     // Returns the eigenvectors of this Fisherfaces model.
-    Mat eigenvectors() const { return _eigenvectors; }
+    Mat eigenvectors() const { return detached(_eigenvectors.unpack()); }
+
+    // Returns the storage precision of the eigenvectors and projections.
+    int precision() const { return _precision; }
 
     // Returns the eigenvalues of this Fisherfaces model.
-    Mat eigenvalues() const { return _eigenvalues; }
+    Mat eigenvalues() const { return detached(_eigenvalues); }
 
     // Returns the sample mean of this Fisherfaces model.
-    Mat mean() const { return _eigenvalues; }
+    Mat mean() const { return detached(_eigenvalues); }
 
     // Returns the number of components used in this Fisherfaces model.
     int num_components() const { return _num_components; }
@@ -297,7 +687,6 @@ public:
 
 // Face Recognition based on Local Binary Patterns.
 //
-// TODO Allow to change the distance metric.
 // TODO Allow to change LBP computation (Extended LBP used right now).
 // TODO Optimize, Optimize, Optimize!
 //
@@ -310,12 +699,112 @@ class LBPH : public FaceRecognizer {
 private:
     int _grid_x;
     int _grid_y;
+    // overlap of neighbouring cells and further grids (see spatial_histogram)
+    double _overlap;
+    vector<Size> _grids;
     int _radius;
     int _neighbors;
+    int _format;
+    HistogramMetric _metric;
+    // quantization of the local variance (joint LBP/VAR codes if var_bins > 0)
+    int _var_bins;
+    vector<float> _var_cuts;
+    // PCA of the templates (projected templates if num_components > 0)
+    int _num_components;
+    bool _whiten;
+    HistogramProjection _projection;
+    Mat _projections;
 
-    vector<Mat> _histograms;
+    // spatial histograms of the training samples and their lower bounds
+    Ptr<HistogramGallery> _gallery;
+    HistogramCascade _cascade;
     vector<int> _labels;
 
+    // Returns the number of possible codes.
+    int numPatterns() const {
+        return static_cast<int>(std::pow(2, _neighbors)) * std::max(_var_bins, 1);
+    }
+
+    // Calculates the spatial histogram (raw counts) of an image.
+    Mat histogram(const Mat& src) const {
+        Mat var_image;
+        if(_var_bins > 0)
+            var_image = varlbp(src, _radius, _neighbors);
+        return histogram(src, var_image);
+    }
+
+    // Calculates the spatial histogram (raw counts) of an image with a given
+    // VAR image (only used for joint LBP/VAR codes).
+    Mat histogram(const Mat& src, const Mat& var_image) const {
+        // calculate lbp image
+        Mat lbp_image = elbp(src, _radius, _neighbors);
+        if(_var_bins > 0)
+            lbp_image = lbpvar(lbp_image, var_image, _var_cuts);
+        // get spatial histogram from this lbp image
+        if((_overlap == 0.0) && _grids.empty())
+            return spatial_histogram(
+                    lbp_image, /* lbp_image */
+                    numPatterns(), /* number of possible patterns */
+                    _grid_x, /* grid size x */
+                    _grid_y, /* grid size y */
+                    false /* cells are normalized by the gallery */);
+        // overlapping cells and several grids come from an integral histogram
+        vector<Size> grids(1, Size(_grid_x, _grid_y));
+        grids.insert(grids.end(), _grids.begin(), _grids.end());
+        return spatial_histogram(lbp_image, numPatterns(), grids, _overlap, false);
+    }
+
+    // Checks the overlap and the further grids.
+    void checkGrids() const {
+        if((_overlap < 0.0) || (_overlap >= 1.0))
+            CV_Error(CV_StsBadArg, "The overlap must be in [0,1).");
+        for(int i = 0; i < _grids.size(); i++)
+            if((_grids[i].width <= 0) || (_grids[i].height <= 0))
+                CV_Error(CV_StsBadArg, "The grid must have at least one cell.");
+    }
+
+    // Finds the nearest template with the lower bounds of the cascade: the
+    // candidates are visited in the order of their bound, and the search
+    // stops once a bound exceeds the best distance. Gives the same answer as
+    // the exhaustive search, see predict.
+    int predict_cascade(const HistogramQuery& query) const {
+        HistogramQuery coarse = _cascade.query(query);
+        vector<pair<double,int> > candidates(_gallery->size());
+        for(int sampleIdx = 0; sampleIdx < candidates.size(); sampleIdx++)
+            candidates[sampleIdx] = make_pair(_cascade.bound(sampleIdx, coarse), sampleIdx);
+        std::sort(candidates.begin(), candidates.end());
+        double minDist = numeric_limits<double>::max();
+        int minIdx = -1;
+        for(int k = 0; k < candidates.size(); k++) {
+            if(candidates[k].first > minDist)
+                break;
+            int sampleIdx = candidates[k].second;
+            double dist = _gallery->distance(sampleIdx, query, minDist);
+            // ties go to the first template, like in the exhaustive search
+            if((dist < minDist) || ((dist == minDist) && (sampleIdx < minIdx))) {
+                minDist = dist;
+                minIdx = sampleIdx;
+            }
+        }
+        return (minIdx < 0) ? -1 : _labels[minIdx];
+    }
+
+    // Finds the nearest projected template, see predict.
+    int predict_projected(const Mat& src) const {
+        Mat q = _projection.project(histogram(src).reshape(1,1));
+        double minDist = numeric_limits<double>::max();
+        int minClass = -1;
+        for(int sampleIdx = 0; sampleIdx < _projections.rows; sampleIdx++) {
+            double dist = impl::sqeuclidean(_projections.ptr<float>(sampleIdx),
+                    q.ptr<float>(), _projections.cols, minDist);
+            if(dist < minDist) {
+                minDist = dist;
+                minClass = _labels[sampleIdx];
+            }
+        }
+        return minClass;
+    }
+
 public:
     using FaceRecognizer::save;
     using FaceRecognizer::load;
@@ -325,25 +814,73 @@ public:
     //
     // radius, neighbors are used in the local binary patterns creation.
     // grid_x, grid_y control the grid size of the spatial histograms.
-    LBPH(int radius=1, int neighbors=8, int grid_x=8, int grid_y=8) :
+    // format is the storage format of the templates (see HistogramGallery).
+    // metric compares the spatial histograms, weights optionally weight the
+    // grid_x*grid_y cells (see HistogramMetric).
+    // var_bins > 0 combines the codes with the local variance quantized into
+    // var_bins bins, whose cut values are learned in train (see lbpvar).
+    // num_components > 0 projects the templates onto num_components principal
+    // components learned in train, which are (optionally whitened and)
+    // compared with the Euclidean distance instead of metric, see
+    // HistogramProjection. The cell weights still apply.
+    // overlap > 0 lets neighbouring cells overlap by this fraction of the
+    // cell size, grids are further grid sizes, whose cells are appended to
+    // the grid_x*grid_y cells (the weights cover all cells). Both take the
+    // histograms from an integral histogram (see IntegralHistogram).
+    LBPH(int radius=1, int neighbors=8, int grid_x=8, int grid_y=8,
+            int format=HistogramGallery::DENSE,
+            int metric=HistogramMetric::CHISQUARE, const Mat& weights=Mat(),
+            int var_bins=0, int num_components=0, bool whiten=false,
+            double overlap=0.0, const vector<Size>& grids=vector<Size>()) :
         _grid_x(grid_x),
         _grid_y(grid_y),
+        _overlap(overlap),
+        _grids(grids),
         _radius(radius),
-        _neighbors(neighbors) {}
+        _neighbors(neighbors),
+        _format(format),
+        _metric(metric, weights),
+        _var_bins(var_bins),
+        _num_components(num_components),
+        _whiten(whiten),
+        _gallery(createHistogramGallery(format, numPatterns(), _metric)),
+        _cascade(numPatterns(), _metric) {
+        checkGrids();
+    }
 
     // Initializes and computes this LBPH Model. The current implementation is
     // rather fixed as it uses the Extended Local Binary Patterns per default.
     //
     // (radius=1), (neighbors=8) are used in the local binary patterns creation.
     // (grid_x=8), (grid_y=8) controls the grid size of the spatial histograms.
+    // (format=HistogramGallery::DENSE) is the storage format of the templates.
+    // (metric=HistogramMetric::CHISQUARE) compares the spatial histograms,
+    // with optional cell weights.
+    // (var_bins=0) is the number of bins of the local variance.
+    // (num_components=0), (whiten=false) control the PCA of the templates.
+    // (overlap=0.0), (grids=vector<Size>()) add overlapping cells and grids.
     LBPH(const vector<Mat>& src,
             const vector<int>& labels,
             int radius=1, int neighbors=8,
-            int grid_x=8, int grid_y=8) :
+            int grid_x=8, int grid_y=8,
+            int format=HistogramGallery::DENSE,
+            int metric=HistogramMetric::CHISQUARE, const Mat& weights=Mat(),
+            int var_bins=0, int num_components=0, bool whiten=false,
+            double overlap=0.0, const vector<Size>& grids=vector<Size>()) :
                 _grid_x(grid_x),
                 _grid_y(grid_y),
+                _overlap(overlap),
+                _grids(grids),
                 _radius(radius),
-                _neighbors(neighbors) {
+                _neighbors(neighbors),
+                _format(format),
+                _metric(metric, weights),
+                _var_bins(var_bins),
+                _num_components(num_components),
+                _whiten(whiten),
+                _gallery(createHistogramGallery(format, numPatterns(), _metric)),
+                _cascade(numPatterns(), _metric) {
+        checkGrids();
         train(src, labels);
     }
 
@@ -355,37 +892,48 @@ public:
         assert(src.size() == labels.size());
         // store given labels
         _labels = labels;
+        // learn the quantization of the local variance
+        vector<Mat> var_images(src.size());
+        if(_var_bins > 0) {
+            for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++)
+                var_images[sampleIdx] = varlbp(src[sampleIdx], _radius, _neighbors);
+            _var_cuts = varlbp_cuts(var_images, _var_bins);
+        }
         // store the spatial histograms of the original data
-        for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++) {
-            // calculate lbp image
-            Mat lbp_image = elbp(src[sampleIdx], _radius, _neighbors);
-            // get spatial histogram from this lbp image
-            Mat p = spatial_histogram(
-                    lbp_image, /* lbp_image */
-                    std::pow(2, _neighbors), /* number of possible patterns */
-                    _grid_x, /* grid size x */
-                    _grid_y, /* grid size y */
-                    true);
-            // add to templates
-            _histograms.push_back(p);
+        _gallery->clear();
+        _projections.release();
+        if(_num_components <= 0) {
+            for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++)
+                _gallery->add(histogram(src[sampleIdx], var_images[sampleIdx]));
+            _cascade.compute(*_gallery);
+            return;
         }
+        // or learn the PCA and store the projected histograms only
+        vector<Mat> hists;
+        for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++)
+            hists.push_back(histogram(src[sampleIdx], var_images[sampleIdx]));
+        _projection = HistogramProjection(numPatterns(), _metric, _num_components, _whiten);
+        // the projection keeps at most as many components as samples, the
+        // requested number is kept for retraining
+        _projection.compute(hists);
+        _projections = _projection.project(asRowMatrix(hists, CV_32FC1));
     }
 
     // Predicts the label of a query image in src.
     int predict(const Mat& src) {
+        if(_num_components > 0)
+            return predict_projected(src);
         // get the spatial histogram from input image
-        Mat lbp_image = elbp(src, _radius, _neighbors);
-        Mat query = spatial_histogram(
-                lbp_image, /* lbp_image */
-                std::pow(2, _neighbors), /* number of possible patterns */
-                _grid_x, /* grid size x */
-                _grid_y, /* grid size y */
-                true /* normed histograms */);
-        // find 1-nearest neighbor
+        Mat hist = histogram(src);
+        HistogramQuery query = _gallery->query(hist);
+        if(!_cascade.empty())
+            return predict_cascade(query);
+        // find 1-nearest neighbor, candidates are abandoned as soon as their
+        // partial distance exceeds the best distance found so far
         double minDist = numeric_limits<double>::max();
         int minClass = -1;
-        for(int sampleIdx = 0; sampleIdx < _histograms.size(); sampleIdx++) {
-            double dist = compareHist(_histograms[sampleIdx], query, CV_COMP_CHISQR);
+        for(int sampleIdx = 0; sampleIdx < _gallery->size(); sampleIdx++) {
+            double dist = _gallery->distance(sampleIdx, query, minDist);
             if(dist < minDist) {
                 minDist = dist;
                 minClass = _labels[sampleIdx];
@@ -395,33 +943,310 @@ public:
     }
 
     // See cv::FaceRecognizer::load.
-    void load(const FileStorage& fs) {
+    void load(const FileStorage& fs) { deserialize(fs); }
+
+    // See cv::FaceRecognizer::save.
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    // See cv::FaceRecognizer::load.
+    void load(const ModelReader& fs) { deserialize(fs); }
+
+    // See cv::FaceRecognizer::save.
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    // Getter functions.
+    int neighbors() { return _neighbors; }
+    int radius() { return _radius; }
+    int grid_x() { return _grid_x; }
+    int grid_y() { return _grid_y; }
+    double overlap() { return _overlap; }
+    vector<Size> grids() { return _grids; }
+    int format() { return _format; }
+    int metric() { return _metric.type(); }
+    Mat weights() { return _metric.weights(); }
+    int var_bins() { return _var_bins; }
+    int num_components() { return _num_components; }
+    bool whiten() { return _whiten; }
+
+private:
+    // The formats share the serialization code.
+    template<typename _Storage>
+    void deserialize(const _Storage& fs) {
         fs["radius"] >> _radius;
         fs["neighbors"] >> _neighbors;
         fs["grid_x"] >> _grid_x;
         fs["grid_y"] >> _grid_y;
+        // models without overlap and further grids have a single grid
+        vector<int> grids;
+        fs["overlap"] >> _overlap;
+        fs["grids"] >> grids;
+        _grids.clear();
+        for(int i = 0; i + 1 < grids.size(); i += 2)
+            _grids.push_back(Size(grids[i], grids[i+1]));
+        checkGrids();
+        // models without a format store dense histograms
+        fs["format"] >> _format;
+        _metric.load(fs.root());
+        fs["var_bins"] >> _var_bins;
+        _var_cuts.clear();
+        readFileNodeList(fs["var_cuts"], _var_cuts);
         //read matrices
-        readFileNodeList(fs["histograms"], _histograms);
+        _gallery = createHistogramGallery(_format, numPatterns(), _metric);
+        _gallery->load(fs.root());
+        // models without the cells of the cascade get them selected anew
+        _cascade = HistogramCascade(numPatterns(), _metric);
+        _cascade.load(fs.root(), *_gallery);
+        // models without a projection store the histograms only
+        int whiten;
+        fs["num_components"] >> _num_components;
+        fs["whiten"] >> whiten;
+        _whiten = (whiten != 0);
+        _projection = HistogramProjection(numPatterns(), _metric, _num_components, _whiten);
+        _projections.release();
+        if(_num_components > 0) {
+            _projection.load(fs.root());
+            fs["projections"] >> _projections;
+        }
         readFileNodeList(fs["labels"], _labels);
     }
 
-    // See cv::FaceRecognizer::save.
-    void save(FileStorage& fs) const {
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
         fs << "radius" << _radius;
         fs << "neighbors" << _neighbors;
         fs << "grid_x" << _grid_x;
         fs << "grid_y" << _grid_y;
+        fs << "overlap" << _overlap;
+        if(!_grids.empty()) {
+            vector<int> grids;
+            for(int i = 0; i < _grids.size(); i++) {
+                grids.push_back(_grids[i].width);
+                grids.push_back(_grids[i].height);
+            }
+            fs << "grids" << grids;
+        }
+        fs << "format" << _format;
+        _metric.save(fs);
+        fs << "var_bins" << _var_bins;
+        writeFileNodeList(fs, "var_cuts", _var_cuts);
         // write matrices
-        writeFileNodeList(fs, "histograms", _histograms);
+        _gallery->save(fs);
+        _cascade.save(fs);
+        fs << "num_components" << _num_components;
+        fs << "whiten" << (int) _whiten;
+        if(_num_components > 0) {
+            _projection.save(fs);
+            fs << "projections" << _projections;
+        }
         writeFileNodeList(fs, "labels", _labels);
     }
+};
+
+// Face Recognition based on Local Binary Patterns of several scales, for
+// example the radii 1, 2 and 3 with 8 neighbors each. The codes of all scales
+// are computed in a single sweep over the image (see multiscale_elbp) and
+// each scale gets its own spatial histograms. The distance of two faces is
+// the weighted sum of the distances of the scales:
+//
+//      d(t,q) = sum_s w_s * d(t_s,q_s)
+//
+// The scales share the grid, the storage format and the metric.
+class MultiScaleLBPH : public FaceRecognizer {
+
+private:
+    vector<int> _radii;
+    vector<int> _neighbors;
+    vector<double> _scale_weights;
+    int _grid_x;
+    int _grid_y;
+    int _format;
+    HistogramMetric _metric;
+
+    // spatial histograms of the training samples, one gallery per scale
+    vector<Ptr<HistogramGallery> > _galleries;
+    vector<int> _labels;
+
+    // Creates the empty galleries and checks the configuration.
+    void init() {
+        if(_radii.empty() || (_radii.size() != _neighbors.size()))
+            CV_Error(CV_StsBadArg, "Expected a number of neighbors for each radius.");
+        if(_scale_weights.empty())
+            _scale_weights.assign(_radii.size(), 1.0);
+        if(_scale_weights.size() != _radii.size())
+            CV_Error(CV_StsBadArg, "Expected a weight for each scale.");
+        _galleries.clear();
+        for(int s = 0; s < _radii.size(); s++) {
+            if(_scale_weights[s] < 0.0)
+                CV_Error(CV_StsBadArg, "Scale weights must be nonnegative.");
+            _galleries.push_back(createHistogramGallery(_format, std::pow(2, _neighbors[s]), _metric));
+        }
+    }
+
+    // Calculates the spatial histograms (raw counts) of all scales.
+    vector<Mat> histograms(const Mat& src) const {
+        vector<Mat> lbp_images;
+        multiscale_elbp(src, lbp_images, _radii, _neighbors);
+        vector<Mat> hists;
+        for(int s = 0; s < lbp_images.size(); s++)
+            hists.push_back(spatial_histogram(lbp_images[s], std::pow(2, _neighbors[s]),
+                    _grid_x, _grid_y, false /* cells are normalized by the gallery */));
+        return hists;
+    }
+
+    // Calculates the weighted distance between the sample at idx and the
+    // queries of all scales, see HistogramGallery::distance.
+    double distance(int idx, const vector<HistogramQuery>& queries, double bound) const {
+        double result = 0.0;
+        for(int s = 0; s < _galleries.size(); s++) {
+            double w = _scale_weights[s];
+            if(w == 0.0)
+                continue;
+            result += w * _galleries[s]->distance(idx, queries[s], (bound - result) / w);
+            if(result > bound)
+                break;
+        }
+        return result;
+    }
+
+public:
+    using FaceRecognizer::save;
+    using FaceRecognizer::load;
+
+    // Initializes an empty multi-scale LBPH model.
+    //
+    // radii, neighbors are the (radius, neighbors) pairs of the scales.
+    // scale_weights weight the distances of the scales (1 per default).
+    // grid_x, grid_y control the grid size of the spatial histograms.
+    // format, metric are used for the histograms of all scales (see LBPH).
+    MultiScaleLBPH(const vector<int>& radii, const vector<int>& neighbors,
+            const vector<double>& scale_weights=vector<double>(),
+            int grid_x=8, int grid_y=8,
+            int format=HistogramGallery::DENSE,
+            int metric=HistogramMetric::CHISQUARE) :
+        _radii(radii),
+        _neighbors(neighbors),
+        _scale_weights(scale_weights),
+        _grid_x(grid_x),
+        _grid_y(grid_y),
+        _format(format),
+        _metric(metric) {
+        init();
+    }
+
+    // Initializes and computes a multi-scale LBPH model, see above.
+    MultiScaleLBPH(const vector<Mat>& src,
+            const vector<int>& labels,
+            const vector<int>& radii, const vector<int>& neighbors,
+            const vector<double>& scale_weights=vector<double>(),
+            int grid_x=8, int grid_y=8,
+            int format=HistogramGallery::DENSE,
+            int metric=HistogramMetric::CHISQUARE) :
+                _radii(radii),
+                _neighbors(neighbors),
+                _scale_weights(scale_weights),
+                _grid_x(grid_x),
+                _grid_y(grid_y),
+                _format(format),
+                _metric(metric) {
+        init();
+        train(src, labels);
+    }
+
+    ~MultiScaleLBPH() { }
+
+    // Computes a multi-scale LBPH model with images in src and
+    // corresponding labels in labels.
+    void train(const vector<Mat>& src, const vector<int>& labels) {
+        assert(src.size() == labels.size());
+        _labels = labels;
+        for(int s = 0; s < _galleries.size(); s++)
+            _galleries[s]->clear();
+        for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++) {
+            vector<Mat> hists = histograms(src[sampleIdx]);
+            for(int s = 0; s < _galleries.size(); s++)
+                _galleries[s]->add(hists[s]);
+        }
+    }
+
+    // Predicts the label of a query image in src.
+    int predict(const Mat& src) {
+        vector<Mat> hists = histograms(src);
+        vector<HistogramQuery> queries;
+        for(int s = 0; s < _galleries.size(); s++)
+            queries.push_back(_galleries[s]->query(hists[s]));
+        // find 1-nearest neighbor with early abandoning, see LBPH::predict
+        double minDist = numeric_limits<double>::max();
+        int minClass = -1;
+        for(int sampleIdx = 0; sampleIdx < _labels.size(); sampleIdx++) {
+            double dist = distance(sampleIdx, queries, minDist);
+            if(dist < minDist) {
+                minDist = dist;
+                minClass = _labels[sampleIdx];
+            }
+        }
+        return minClass;
+    }
+
+    // See cv::FaceRecognizer::load.
+    void load(const FileStorage& fs) { deserialize(fs); }
+
+    // See cv::FaceRecognizer::save.
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    // See cv::FaceRecognizer::load.
+    void load(const ModelReader& fs) { deserialize(fs); }
+
+    // See cv::FaceRecognizer::save.
+    void save(ModelWriter& fs) const { serialize(fs); }
 
     // Getter functions.
-    int neighbors() { return _neighbors; }
-    int radius() { return _radius; }
+    vector<int> radii() { return _radii; }
+    vector<int> neighbors() { return _neighbors; }
+    vector<double> scale_weights() { return _scale_weights; }
     int grid_x() { return _grid_x; }
     int grid_y() { return _grid_y; }
+    int format() { return _format; }
+    int metric() { return _metric.type(); }
+
+private:
+    // The formats share the serialization code.
+    template<typename _Storage>
+    void deserialize(const _Storage& fs) {
+        _radii.clear();
+        _neighbors.clear();
+        _scale_weights.clear();
+        _labels.clear();
+        readFileNodeList(fs["radii"], _radii);
+        readFileNodeList(fs["neighbors"], _neighbors);
+        readFileNodeList(fs["scale_weights"], _scale_weights);
+        fs["grid_x"] >> _grid_x;
+        fs["grid_y"] >> _grid_y;
+        fs["format"] >> _format;
+        _metric.load(fs.root());
+        init();
+        // read matrices of each scale
+        for(int s = 0; s < _galleries.size(); s++)
+            _galleries[s]->load(fs["scale_" + num2str(s)]);
+        readFileNodeList(fs["labels"], _labels);
+    }
 
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        writeFileNodeList(fs, "radii", _radii);
+        writeFileNodeList(fs, "neighbors", _neighbors);
+        writeFileNodeList(fs, "scale_weights", _scale_weights);
+        fs << "grid_x" << _grid_x;
+        fs << "grid_y" << _grid_y;
+        fs << "format" << _format;
+        _metric.save(fs);
+        // write matrices of each scale
+        for(int s = 0; s < _galleries.size(); s++) {
+            fs << "scale_" + num2str(s) << "{";
+            _galleries[s]->save(fs);
+            fs << "}";
+        }
+        writeFileNodeList(fs, "labels", _labels);
+    }
 };
 
 }
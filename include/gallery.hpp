@@ -0,0 +1,925 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __GALLERY_HPP__
+#define __GALLERY_HPP__
+
+#include "opencv2/opencv.hpp"
+#include "helper.hpp"
+#include "distance.hpp"
+#include "subspace.hpp"
+#include "model.hpp"
+
+using namespace std;
+
+namespace cv {
+
+namespace impl {
+
+// Converts a spatial histogram into a CV_32FC1 row, in which each cell of
+// numPatterns bins sums up to 1. The scale applied to each cell (1/sum, or 0
+// for an empty cell) is returned in scales.
+inline void normalize_cells(const Mat& src, int numPatterns, Mat& hist, Mat& scales) {
+    src.reshape(1,1).convertTo(hist, CV_32FC1);
+    int numCells = hist.cols / numPatterns;
+    scales.create(1, numCells, CV_32FC1);
+    float* h = hist.ptr<float>();
+    for(int c = 0; c < numCells; c++) {
+        float* cell = h + c*numPatterns;
+        double sum = 0.0;
+        for(int b = 0; b < numPatterns; b++)
+            sum += cell[b];
+        float scale = (sum > 0.0) ? static_cast<float>(1.0/sum) : 0.0f;
+        for(int b = 0; b < numPatterns; b++)
+            cell[b] *= scale;
+        scales.at<float>(0,c) = scale;
+    }
+}
+
+// Copies the given cells (of cellSize columns each) of all rows of src.
+inline Mat select_cells(const Mat& src, const vector<int>& cells, int cellSize) {
+    Mat dst(src.rows, static_cast<int>(cells.size())*cellSize, src.type());
+    for(int k = 0; k < cells.size(); k++) {
+        Mat cell = dst.colRange(k*cellSize, (k+1)*cellSize);
+        src.colRange(cells[k]*cellSize, (cells[k]+1)*cellSize).copyTo(cell);
+    }
+    return dst;
+}
+
+} // namespace impl
+
+// The distance metric used to compare spatial histograms. The distance is
+// summed up over the cells of the histograms, optionally with a weight per
+// cell (for the weighted Chi-square distance of Ahonen et al.):
+//
+//      d(t,q) = sum_c w_c * d(t_c,q_c)
+//
+// See impl::ChiSquareTerm for the metrics on a single cell.
+class HistogramMetric {
+
+private:
+    int _type;
+    Mat _weights;
+
+public:
+    // Available metrics.
+    enum {
+        CHISQUARE = 0,
+        WEIGHTED_CHISQUARE = 1,
+        INTERSECTION = 2,
+        L1 = 3,
+        LOG_LIKELIHOOD = 4
+    };
+
+    // Initializes a metric of the given type with optional (nonnegative)
+    // cell weights, which are required for WEIGHTED_CHISQUARE.
+    HistogramMetric(int type = CHISQUARE, const Mat& weights = Mat()) :
+        _type(type) {
+        if((type < CHISQUARE) || (type > LOG_LIKELIHOOD))
+            CV_Error(CV_StsBadArg, "Unknown histogram metric.");
+        if((type == WEIGHTED_CHISQUARE) && weights.empty())
+            CV_Error(CV_StsBadArg, "The weighted Chi-square distance needs a weight per cell.");
+        if(!weights.empty()) {
+            weights.reshape(1,1).convertTo(_weights, CV_32FC1);
+            for(int c = 0; c < _weights.cols; c++)
+                if(_weights.at<float>(0,c) < 0.0f)
+                    CV_Error(CV_StsBadArg, "Cell weights must be nonnegative.");
+        }
+    }
+
+    // Returns the type of this metric.
+    int type() const { return _type; }
+
+    // Returns the cell weights (1 x numCells CV_32FC1) or an empty matrix.
+    const Mat& weights() const { return _weights; }
+
+    // Checks if the weights match a spatial histogram with numCells cells.
+    void check(int numCells) const {
+        if(!_weights.empty() && (_weights.cols != numCells))
+            CV_Error(CV_StsBadArg, "Expected a weight for each cell of the spatial histogram.");
+    }
+
+    // Serializes this metric to a given cv::FileStorage (or ModelWriter).
+    template<typename _Storage>
+    void save(_Storage& fs) const {
+        fs << "metric" << _type;
+        if(!_weights.empty())
+            fs << "weights" << _weights;
+    }
+
+    // Deserializes a metric from a given cv::FileNode (or ModelNode). Models
+    // without a metric use the Chi-square distance.
+    template<typename _Node>
+    void load(const _Node& fn) {
+        int type;
+        Mat weights;
+        fn["metric"] >> type;
+        fn["weights"] >> weights;
+        *this = HistogramMetric(type, weights);
+    }
+};
+
+// A query histogram, prepared by HistogramGallery::query for the distance
+// computations of a gallery.
+struct HistogramQuery {
+    // spatial histogram with normalized cells (CV_32FC1)
+    Mat hist;
+    // integer counts and their scale per cell (quantized formats only)
+    Mat counts;
+    Mat scales;
+};
+
+// A HistogramGallery holds the spatial histograms (templates) of a LBPH model
+// and computes the distance between a query histogram and a template. A
+// spatial histogram is a 1 x (numCells*numPatterns) row, made up of one
+// histogram with numPatterns bins for each cell. Histograms are passed with
+// raw counts (or already normalized), each cell is normalized by the gallery.
+class HistogramGallery {
+protected:
+    int _numPatterns;
+    HistogramMetric _metric;
+
+    // Returns the weight of each cell, or NULL if the cells are unweighted.
+    const float* weights() const {
+        return _metric.weights().empty() ? 0 : _metric.weights().ptr<float>();
+    }
+
+public:
+    // Available storage formats.
+    enum {
+        DENSE = 0,
+        SPARSE = 1,
+        QUANTIZED_8U = 2,
+        QUANTIZED_16U = 3
+    };
+
+    // Initializes an empty gallery for cells with numPatterns bins, which
+    // compares histograms with the given metric.
+    HistogramGallery(int numPatterns, const HistogramMetric& metric) :
+        _numPatterns(numPatterns),
+        _metric(metric) {
+        if(numPatterns <= 0)
+            CV_Error(CV_StsBadArg, "The number of patterns must be positive.");
+    }
+
+    //! virtual destructor
+    virtual ~HistogramGallery() {}
+
+    // Returns the storage format of this gallery.
+    virtual int format() const = 0;
+
+    // Returns the metric of this gallery.
+    const HistogramMetric& metric() const { return _metric; }
+
+    // Appends a spatial histogram as template.
+    virtual void add(const Mat& hist) = 0;
+
+    // Removes all templates.
+    virtual void clear() = 0;
+
+    // Returns the number of templates.
+    virtual int size() const = 0;
+
+    // Returns the template at idx as dense spatial histogram with normalized
+    // cells.
+    virtual Mat histogram(int idx) const = 0;
+
+    // Prepares a spatial histogram for the distance computations.
+    virtual HistogramQuery query(const Mat& hist) const {
+        HistogramQuery q;
+        impl::normalize_cells(hist, _numPatterns, q.hist, q.scales);
+        return q;
+    }
+
+    // Calculates the distance between the template at idx and a query with
+    // the metric of this gallery. The computation may stop once the distance
+    // exceeds bound, in which case the (partial) result is greater than bound.
+    virtual double distance(int idx, const HistogramQuery& query, double bound) const = 0;
+
+    // Returns a gallery in the same format, which holds the given cells of
+    // all templates and compares them with metric (whose weights belong to
+    // the given cells). The cells are copied as they are stored, so the
+    // distance on them gives exactly the terms of the full distance.
+    virtual Ptr<HistogramGallery> subset(const vector<int>& cells, const HistogramMetric& metric) const = 0;
+
+    // Serializes the templates to a given cv::FileStorage.
+    virtual void save(FileStorage& fs) const = 0;
+
+    // Deserializes the templates from a given cv::FileNode.
+    virtual void load(const FileNode& fn) = 0;
+
+    // Serializes the templates to a binary model file.
+    virtual void save(ModelWriter& fs) const = 0;
+
+    // Deserializes the templates from a binary model file.
+    virtual void load(const ModelNode& fn) = 0;
+};
+
+// Stores the templates as rows of a contiguous CV_32FC1 matrix.
+class DenseHistogramGallery : public HistogramGallery {
+
+private:
+    typedef double (DenseHistogramGallery::*DistanceFunc)(int, const HistogramQuery&, double) const;
+
+    Mat _histograms;
+    DistanceFunc _distance;
+
+    template <typename _Term>
+    double accumulate(int idx, const HistogramQuery& query, double bound) const {
+        const float* t = _histograms.ptr<float>(idx);
+        const float* q = query.hist.ptr<float>();
+        const float* w = weights();
+        int numCells = _histograms.cols / _numPatterns;
+        double result = 0.0;
+        for(int c = 0; c < numCells; c++) {
+            int offset = c*_numPatterns;
+            double d = _Term::cell(t + offset, q + offset, _numPatterns);
+            result += w ? w[c]*d : d;
+            if(result > bound)
+                break;
+        }
+        return result;
+    }
+
+    static DistanceFunc select(int metric) {
+        switch(metric) {
+        case HistogramMetric::INTERSECTION: return &DenseHistogramGallery::accumulate<impl::IntersectionTerm>;
+        case HistogramMetric::L1: return &DenseHistogramGallery::accumulate<impl::L1Term>;
+        case HistogramMetric::LOG_LIKELIHOOD: return &DenseHistogramGallery::accumulate<impl::LogLikelihoodTerm>;
+        default: return &DenseHistogramGallery::accumulate<impl::ChiSquareTerm>;
+        }
+    }
+
+public:
+    DenseHistogramGallery(int numPatterns, const HistogramMetric& metric = HistogramMetric()) :
+        HistogramGallery(numPatterns, metric),
+        _distance(select(metric.type())) {}
+
+    int format() const { return DENSE; }
+
+    void add(const Mat& hist) {
+        Mat h, scales;
+        impl::normalize_cells(hist, _numPatterns, h, scales);
+        _metric.check(scales.cols);
+        _histograms.push_back(h);
+    }
+
+    void clear() { _histograms.release(); }
+
+    int size() const { return _histograms.rows; }
+
+    Mat histogram(int idx) const { return _histograms.row(idx); }
+
+    double distance(int idx, const HistogramQuery& query, double bound) const {
+        return (this->*_distance)(idx, query, bound);
+    }
+
+    Ptr<HistogramGallery> subset(const vector<int>& cells, const HistogramMetric& metric) const {
+        DenseHistogramGallery* result = new DenseHistogramGallery(_numPatterns, metric);
+        result->_histograms = impl::select_cells(_histograms, cells, _numPatterns);
+        return result;
+    }
+
+    // Writes one matrix per template, which is the format of the first LBPH
+    // models.
+    void save(FileStorage& fs) const {
+        vector<Mat> histograms;
+        for(int sampleIdx = 0; sampleIdx < _histograms.rows; sampleIdx++)
+            histograms.push_back(_histograms.row(sampleIdx));
+        writeFileNodeList(fs, "histograms", histograms);
+    }
+
+    void load(const FileNode& fn) {
+        vector<Mat> histograms;
+        readFileNodeList(fn["histograms"], histograms);
+        _histograms = asRowMatrix(histograms, CV_32FC1);
+    }
+
+    // Writes all templates as a single (compressed) matrix.
+    void save(ModelWriter& fs) const {
+        fs.compress("histograms", _histograms);
+    }
+
+    void load(const ModelNode& fn) {
+        fn["histograms"] >> _histograms;
+    }
+};
+
+// Stores the non-zero bins of each template cell as (bin, value) pairs in a
+// compressed row (CSR-like) layout:
+//
+//      _offsets[i*numCells+c] .. _offsets[i*numCells+c+1]
+//
+// is the range of the pairs of cell c in template i, _bins holds the bin
+// index within the cell and _values the bin value. The distance only visits
+// the non-zero template bins, the empty bins are accounted for by the sum of
+// the (normalized) query cell:
+//
+//      d(t_c,q_c) = zero*sum_i q_i + sum_{t_i != 0} (term(t_i,q_i) - zero*q_i)
+//
+// See impl::ChiSquareTerm for zero and term.
+class SparseHistogramGallery : public HistogramGallery {
+
+private:
+    typedef double (SparseHistogramGallery::*DistanceFunc)(int, const HistogramQuery&, double) const;
+
+    int _numCells;
+    vector<int> _offsets;
+    vector<unsigned short> _bins;
+    vector<float> _values;
+    DistanceFunc _distance;
+
+    template <typename _Term>
+    double accumulate(int idx, const HistogramQuery& query, double bound) const {
+        const float* q = query.hist.ptr<float>();
+        const float* qs = query.scales.ptr<float>();
+        const float* w = weights();
+        const double zero = _Term::zero();
+        double result = 0.0;
+        for(int c = 0; c < _numCells; c++) {
+            int cellIdx = idx*_numCells + c;
+            const float* cell = q + c*_numPatterns;
+            // a non-empty query cell sums up to 1
+            double d = (qs[c] != 0.0f) ? zero : 0.0;
+            for(int k = _offsets[cellIdx]; k < _offsets[cellIdx+1]; k++) {
+                double qv = cell[_bins[k]];
+                d += _Term::term(_values[k], qv) - zero*qv;
+            }
+            result += w ? w[c]*d : d;
+            if(result > bound)
+                break;
+        }
+        return result;
+    }
+
+    static DistanceFunc select(int metric) {
+        switch(metric) {
+        case HistogramMetric::INTERSECTION: return &SparseHistogramGallery::accumulate<impl::IntersectionTerm>;
+        case HistogramMetric::L1: return &SparseHistogramGallery::accumulate<impl::L1Term>;
+        case HistogramMetric::LOG_LIKELIHOOD: return &SparseHistogramGallery::accumulate<impl::LogLikelihoodTerm>;
+        default: return &SparseHistogramGallery::accumulate<impl::ChiSquareTerm>;
+        }
+    }
+
+public:
+    // Initializes an empty gallery for cells with numPatterns bins.
+    SparseHistogramGallery(int numPatterns, const HistogramMetric& metric = HistogramMetric()) :
+        HistogramGallery(numPatterns, metric),
+        _numCells(0),
+        _distance(select(metric.type())) {
+        if(numPatterns > 65536)
+            CV_Error(CV_StsBadArg, "The sparse format supports at most 65536 patterns per cell.");
+        _offsets.push_back(0);
+    }
+
+    int format() const { return SPARSE; }
+
+    void add(const Mat& hist) {
+        Mat h, scales;
+        impl::normalize_cells(hist, _numPatterns, h, scales);
+        if(h.cols % _numPatterns != 0)
+            CV_Error(CV_StsBadArg, "Expected a spatial histogram with numPatterns bins per cell.");
+        if(size() == 0)
+            _numCells = h.cols / _numPatterns;
+        else if(h.cols != _numCells*_numPatterns)
+            CV_Error(CV_StsBadArg, "All templates must have the same number of bins.");
+        _metric.check(_numCells);
+        const float* p = h.ptr<float>();
+        for(int c = 0; c < _numCells; c++) {
+            const float* cell = p + c*_numPatterns;
+            for(int b = 0; b < _numPatterns; b++) {
+                if(cell[b] != 0.0f) {
+                    _bins.push_back(static_cast<unsigned short>(b));
+                    _values.push_back(cell[b]);
+                }
+            }
+            _offsets.push_back(static_cast<int>(_values.size()));
+        }
+    }
+
+    void clear() {
+        _numCells = 0;
+        _offsets.assign(1, 0);
+        _bins.clear();
+        _values.clear();
+    }
+
+    int size() const { return (_numCells == 0) ? 0 : (static_cast<int>(_offsets.size())-1)/_numCells; }
+
+    Mat histogram(int idx) const {
+        Mat h = Mat::zeros(1, _numCells*_numPatterns, CV_32FC1);
+        float* p = h.ptr<float>();
+        for(int c = 0; c < _numCells; c++) {
+            int cellIdx = idx*_numCells + c;
+            for(int k = _offsets[cellIdx]; k < _offsets[cellIdx+1]; k++)
+                p[c*_numPatterns + _bins[k]] = _values[k];
+        }
+        return h;
+    }
+
+    double distance(int idx, const HistogramQuery& query, double bound) const {
+        return (this->*_distance)(idx, query, bound);
+    }
+
+    Ptr<HistogramGallery> subset(const vector<int>& cells, const HistogramMetric& metric) const {
+        SparseHistogramGallery* result = new SparseHistogramGallery(_numPatterns, metric);
+        result->_numCells = static_cast<int>(cells.size());
+        for(int sampleIdx = 0; sampleIdx < size(); sampleIdx++) {
+            for(int k = 0; k < cells.size(); k++) {
+                int cellIdx = sampleIdx*_numCells + cells[k];
+                for(int i = _offsets[cellIdx]; i < _offsets[cellIdx+1]; i++) {
+                    result->_bins.push_back(_bins[i]);
+                    result->_values.push_back(_values[i]);
+                }
+                result->_offsets.push_back(static_cast<int>(result->_values.size()));
+            }
+        }
+        return result;
+    }
+
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    void load(const FileNode& fn) { deserialize(fn); }
+
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    void load(const ModelNode& fn) { deserialize(fn); }
+
+private:
+    // The formats share the serialization code.
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        fs << "num_cells" << _numCells;
+        fs << "offsets" << Mat(_offsets);
+        writeCompressed(fs, "bins", Mat(_bins));
+        writeCompressed(fs, "values", Mat(_values));
+    }
+
+    template<typename _Node>
+    void deserialize(const _Node& fn) {
+        clear();
+        fn["num_cells"] >> _numCells;
+        Mat offsets, bins, values;
+        fn["offsets"] >> offsets;
+        fn["bins"] >> bins;
+        fn["values"] >> values;
+        if(!offsets.empty()) {
+            Mat_<int> m = offsets.reshape(1,1);
+            _offsets.assign(m.begin(), m.end());
+        }
+        if(!bins.empty()) {
+            Mat_<unsigned short> m = bins.reshape(1,1);
+            _bins.assign(m.begin(), m.end());
+        }
+        if(!values.empty()) {
+            Mat_<float> m = values.reshape(1,1);
+            _values.assign(m.begin(), m.end());
+        }
+    }
+};
+
+// Stores the templates as integer counts (CV_8UC1 or CV_16UC1) with a scale
+// per cell, so that count*scale is the normalized bin value. Counts that
+// don't fit into the type are saturated. If a query cell has the same scale
+// as the template cell (the common case of equally sized faces), homogeneous
+// metrics are computed on the integer counts directly, for example:
+//
+//      sum_i (s*t_i - s*q_i)^2 / (s*t_i) = s * sum_i (t_i - q_i)^2 / t_i
+//
+// The histograms passed to this gallery must hold raw counts.
+class QuantizedHistogramGallery : public HistogramGallery {
+
+private:
+    typedef double (QuantizedHistogramGallery::*DistanceFunc)(int, const HistogramQuery&, double) const;
+
+    int _depth;
+    Mat _counts;
+    Mat _scales;
+    DistanceFunc _distance;
+
+    // Converts a spatial histogram of raw counts into the storage type.
+    Mat quantize(const Mat& hist, Mat& scales) const {
+        Mat h, counts, unused;
+        hist.reshape(1,1).convertTo(h, CV_32FC1);
+        for(int i = 0; i < h.cols; i++) {
+            float v = h.at<float>(0,i);
+            if(v != std::floor(v))
+                CV_Error(CV_StsBadArg, "Quantized histograms need raw (integer) counts.");
+        }
+        h.convertTo(counts, _depth);
+        // the scales are taken from the (saturated) counts
+        impl::normalize_cells(counts, _numPatterns, unused, scales);
+        return counts;
+    }
+
+    template <typename _Tp, typename _Term>
+    double accumulate(int idx, const HistogramQuery& query, double bound) const {
+        const _Tp* t = _counts.ptr<_Tp>(idx);
+        const _Tp* q = query.counts.ptr<_Tp>();
+        const float* ts = _scales.ptr<float>(idx);
+        const float* qs = query.scales.ptr<float>();
+        const float* qh = query.hist.ptr<float>();
+        const float* w = weights();
+        double result = 0.0;
+        for(int c = 0; c < _scales.cols; c++) {
+            int offset = c*_numPatterns;
+            double d = 0.0;
+            if(_Term::homogeneous && (ts[c] == qs[c])) {
+                d = ts[c] * _Term::cell(t + offset, q + offset, _numPatterns);
+            } else {
+                // compare on normalized values
+                for(int b = offset; b < offset + _numPatterns; b++)
+                    d += _Term::term(ts[c] * static_cast<double>(t[b]), qh[b]);
+            }
+            result += w ? w[c]*d : d;
+            if(result > bound)
+                break;
+        }
+        return result;
+    }
+
+    template <typename _Tp>
+    static DistanceFunc select(int metric) {
+        switch(metric) {
+        case HistogramMetric::INTERSECTION: return &QuantizedHistogramGallery::accumulate<_Tp, impl::IntersectionTerm>;
+        case HistogramMetric::L1: return &QuantizedHistogramGallery::accumulate<_Tp, impl::L1Term>;
+        case HistogramMetric::LOG_LIKELIHOOD: return &QuantizedHistogramGallery::accumulate<_Tp, impl::LogLikelihoodTerm>;
+        default: return &QuantizedHistogramGallery::accumulate<_Tp, impl::ChiSquareTerm>;
+        }
+    }
+
+public:
+    // Initializes an empty gallery for cells with numPatterns bins, which
+    // stores counts with the given depth (CV_8U or CV_16U).
+    QuantizedHistogramGallery(int numPatterns, int depth, const HistogramMetric& metric = HistogramMetric()) :
+        HistogramGallery(numPatterns, metric),
+        _depth(depth) {
+        if((depth != CV_8U) && (depth != CV_16U))
+            CV_Error(CV_StsBadArg, "Quantized histograms are stored as CV_8U or CV_16U.");
+        _distance = (depth == CV_8U) ? select<unsigned char>(metric.type()) : select<unsigned short>(metric.type());
+    }
+
+    int format() const { return (_depth == CV_8U) ? QUANTIZED_8U : QUANTIZED_16U; }
+
+    void add(const Mat& hist) {
+        Mat scales;
+        Mat counts = quantize(hist, scales);
+        _metric.check(scales.cols);
+        _counts.push_back(counts);
+        _scales.push_back(scales);
+    }
+
+    void clear() {
+        _counts.release();
+        _scales.release();
+    }
+
+    int size() const { return _counts.rows; }
+
+    Mat histogram(int idx) const {
+        Mat h;
+        _counts.row(idx).convertTo(h, CV_32FC1);
+        for(int c = 0; c < _scales.cols; c++) {
+            Mat cell = h.colRange(c*_numPatterns, (c+1)*_numPatterns);
+            cell.convertTo(cell, CV_32FC1, _scales.at<float>(idx,c));
+        }
+        return h;
+    }
+
+    HistogramQuery query(const Mat& hist) const {
+        HistogramQuery q;
+        q.counts = quantize(hist, q.scales);
+        Mat unused;
+        impl::normalize_cells(q.counts, _numPatterns, q.hist, unused);
+        return q;
+    }
+
+    double distance(int idx, const HistogramQuery& query, double bound) const {
+        return (this->*_distance)(idx, query, bound);
+    }
+
+    // The subset keeps the (saturated) counts and the scales of the cells.
+    Ptr<HistogramGallery> subset(const vector<int>& cells, const HistogramMetric& metric) const {
+        QuantizedHistogramGallery* result = new QuantizedHistogramGallery(_numPatterns, _depth, metric);
+        result->_counts = impl::select_cells(_counts, cells, _numPatterns);
+        result->_scales = impl::select_cells(_scales, cells, 1);
+        return result;
+    }
+
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    void load(const FileNode& fn) { deserialize(fn); }
+
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    void load(const ModelNode& fn) { deserialize(fn); }
+
+private:
+    // The formats share the serialization code.
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        writeCompressed(fs, "counts", _counts);
+        fs << "scales" << _scales;
+    }
+
+    template<typename _Node>
+    void deserialize(const _Node& fn) {
+        clear();
+        fn["counts"] >> _counts;
+        fn["scales"] >> _scales;
+    }
+};
+
+// Creates an empty gallery in the given format for cells with numPatterns
+// bins, which compares histograms with the given metric.
+inline Ptr<HistogramGallery> createHistogramGallery(int format, int numPatterns,
+        const HistogramMetric& metric = HistogramMetric()) {
+    switch(format) {
+    case HistogramGallery::DENSE: return new DenseHistogramGallery(numPatterns, metric);
+    case HistogramGallery::SPARSE: return new SparseHistogramGallery(numPatterns, metric);
+    case HistogramGallery::QUANTIZED_8U: return new QuantizedHistogramGallery(numPatterns, CV_8U, metric);
+    case HistogramGallery::QUANTIZED_16U: return new QuantizedHistogramGallery(numPatterns, CV_16U, metric);
+    default:
+        CV_Error(CV_StsBadArg, "Unknown histogram gallery format."); break;
+    }
+    return Ptr<HistogramGallery>();
+}
+
+// A PCA (or whitened PCA) projection of spatial histograms, which reduces the
+// templates to a few hundred dimensions. Each cell is normalized and mapped
+// to the square root of its bins first (Hellinger mapping), so the Euclidean
+// distance of the projections approximates the distance of the histograms:
+//
+//      sum_i (sqrt(t_i) - sqrt(q_i))^2 = 2 - 2*sum_i sqrt(t_i*q_i)
+//
+// Cell weights of the metric are applied as sqrt(w_c) to the mapped cells.
+// A whitened projection scales each component to unit variance.
+class HistogramProjection {
+
+private:
+    int _numPatterns;
+    HistogramMetric _metric;
+    int _num_components;
+    bool _whiten;
+    // (whitened) eigenvectors as columns and the mean of the mapped histograms
+    Mat _eigenvectors;
+    Mat _mean;
+
+    // Maps a spatial histogram to the square root of its normalized cells.
+    Mat map(const Mat& hist) const {
+        Mat h, scales;
+        impl::normalize_cells(hist, _numPatterns, h, scales);
+        _metric.check(scales.cols);
+        const Mat& weights = _metric.weights();
+        float* v = h.ptr<float>();
+        for(int c = 0; c < scales.cols; c++) {
+            float w = weights.empty() ? 1.0f : std::sqrt(weights.at<float>(0,c));
+            float* cell = v + c*_numPatterns;
+            for(int b = 0; b < _numPatterns; b++)
+                cell[b] = w * std::sqrt(cell[b]);
+        }
+        return h;
+    }
+
+public:
+    // Initializes an empty projection for cells with numPatterns bins, which
+    // keeps num_components components.
+    HistogramProjection(int numPatterns = 1, const HistogramMetric& metric = HistogramMetric(),
+            int num_components = 0, bool whiten = false) :
+        _numPatterns(numPatterns),
+        _metric(metric),
+        _num_components(num_components),
+        _whiten(whiten) {}
+
+    // Learns the projection from the spatial histograms in src.
+    void compute(const vector<Mat>& src) {
+        if(src.empty())
+            CV_Error(CV_StsBadArg, "Empty training data was given.");
+        Mat data;
+        for(int sampleIdx = 0; sampleIdx < src.size(); sampleIdx++)
+            data.push_back(map(src[sampleIdx]));
+        // clip number of components to be valid
+        if((_num_components <= 0) || (_num_components > data.rows))
+            _num_components = data.rows;
+        data.convertTo(data, CV_64FC1);
+        PCA pca(data, Mat(), CV_PCA_DATA_AS_ROW, _num_components);
+        _num_components = pca.eigenvectors.rows;
+        _mean = pca.mean.reshape(1,1);
+        _mean.convertTo(_mean, CV_32FC1);
+        Mat eigenvectors = transpose(pca.eigenvectors);
+        if(_whiten) {
+            // components without variance are damped instead of amplified
+            double eps = 1e-6 * std::max(pca.eigenvalues.at<double>(0), DBL_MIN);
+            for(int k = 0; k < eigenvectors.cols; k++) {
+                Mat column = eigenvectors.col(k);
+                column *= 1.0 / std::sqrt(pca.eigenvalues.at<double>(k) + eps);
+            }
+        }
+        eigenvectors.convertTo(_eigenvectors, CV_32FC1);
+    }
+
+    // Projects the spatial histograms in the rows of src, the result is a
+    // src.rows x num_components CV_32FC1 matrix.
+    Mat project(const Mat& src) const {
+        if(_eigenvectors.empty())
+            CV_Error(CV_StsError, "The projection has not been computed.");
+        Mat data;
+        for(int sampleIdx = 0; sampleIdx < src.rows; sampleIdx++)
+            data.push_back(map(src.row(sampleIdx)));
+        return subspace::project(_eigenvectors, _mean, data);
+    }
+
+    // Returns the number of components.
+    int num_components() const { return _num_components; }
+
+    // Returns true if the components are whitened.
+    bool whiten() const { return _whiten; }
+
+    // Serializes this projection to a given cv::FileStorage (or ModelWriter).
+    template<typename _Storage>
+    void save(_Storage& fs) const {
+        fs << "projection_mean" << _mean;
+        fs << "projection_eigenvectors" << _eigenvectors;
+    }
+
+    // Deserializes a projection from a given cv::FileNode (or ModelNode).
+    template<typename _Node>
+    void load(const _Node& fn) {
+        fn["projection_mean"] >> _mean;
+        fn["projection_eigenvectors"] >> _eigenvectors;
+        _num_components = _eigenvectors.cols;
+    }
+};
+
+// Cheap lower bounds for the distances of a gallery. Every term of a metric
+// is nonnegative, so the distance summed up over a subset of the cells never
+// exceeds the distance over all cells. The cascade selects the cells with
+// the highest variance over the templates, which contribute most to the
+// distances, and gives their partial distance as bound. The selected cells
+// are kept in the format of the gallery (see HistogramGallery::subset), so
+// the bound sums up exactly the terms of the full distance. A nearest
+// neighbor search can skip all templates, whose bound doesn't beat the best
+// distance found so far.
+//
+// The selected cells are saved with a model, loading only copies them from
+// the gallery.
+class HistogramCascade {
+
+private:
+    int _numPatterns;
+    int _numCells;
+    HistogramMetric _metric;
+    // number of cells of the gallery, the selected cells and their histograms
+    int _galleryCells;
+    vector<int> _cells;
+    Ptr<HistogramGallery> _coarse;
+
+    // Copies the selected cells of the templates.
+    void build(const HistogramGallery& gallery) {
+        const float* w = _metric.weights().empty() ? 0 : _metric.weights().ptr<float>();
+        Mat weights(1, static_cast<int>(_cells.size()), CV_32FC1);
+        for(int k = 0; k < _cells.size(); k++)
+            weights.at<float>(0,k) = w ? w[_cells[k]] : 1.0f;
+        _coarse = gallery.subset(_cells, HistogramMetric(_metric.type(), w ? weights : Mat()));
+    }
+
+    // Returns true if cells are numCells distinct cells of a gallery with
+    // galleryCells cells.
+    bool isSelection(const vector<int>& cells, int galleryCells) const {
+        if((cells.size() != _numCells) || (galleryCells <= _numCells))
+            return false;
+        vector<bool> seen(galleryCells, false);
+        for(int k = 0; k < cells.size(); k++) {
+            if((cells[k] < 0) || (cells[k] >= galleryCells) || seen[cells[k]])
+                return false;
+            seen[cells[k]] = true;
+        }
+        return true;
+    }
+
+public:
+    // Initializes an empty cascade for cells with numPatterns bins, which
+    // bounds the distances with numCells cells.
+    HistogramCascade(int numPatterns = 1, const HistogramMetric& metric = HistogramMetric(),
+            int numCells = 8) :
+        _numPatterns(numPatterns),
+        _numCells(numCells),
+        _metric(metric),
+        _galleryCells(0) {}
+
+    // Returns true if this cascade gives no bounds.
+    bool empty() const { return _coarse.empty(); }
+
+    // Returns the selected cells.
+    const vector<int>& cells() const { return _cells; }
+
+    // Selects the cells with the highest (weighted) variance over the
+    // templates of a gallery and copies them. The cascade stays empty if the
+    // templates have no more than numCells cells.
+    void compute(const HistogramGallery& gallery) {
+        _cells.clear();
+        _coarse.release();
+        _galleryCells = 0;
+        if(gallery.size() == 0)
+            return;
+        int numCells = gallery.histogram(0).cols / _numPatterns;
+        if(numCells <= _numCells)
+            return;
+        // variance of each bin over all templates
+        Mat sum = Mat::zeros(1, numCells*_numPatterns, CV_64FC1);
+        Mat sqsum = Mat::zeros(1, numCells*_numPatterns, CV_64FC1);
+        for(int sampleIdx = 0; sampleIdx < gallery.size(); sampleIdx++) {
+            Mat h = gallery.histogram(sampleIdx);
+            const float* p = h.ptr<float>();
+            double* s = sum.ptr<double>();
+            double* s2 = sqsum.ptr<double>();
+            for(int b = 0; b < h.cols; b++) {
+                s[b] += p[b];
+                s2[b] += static_cast<double>(p[b])*p[b];
+            }
+        }
+        // summed up per cell
+        const float* w = _metric.weights().empty() ? 0 : _metric.weights().ptr<float>();
+        Mat variance = Mat::zeros(1, numCells, CV_64FC1);
+        double n = gallery.size();
+        for(int c = 0; c < numCells; c++) {
+            double v = 0.0;
+            for(int b = c*_numPatterns; b < (c+1)*_numPatterns; b++) {
+                double mean = sum.at<double>(0,b) / n;
+                v += sqsum.at<double>(0,b) / n - mean*mean;
+            }
+            variance.at<double>(0,c) = w ? w[c]*v : v;
+        }
+        Mat indices = argsort(variance, false);
+        for(int k = 0; k < _numCells; k++)
+            _cells.push_back(indices.at<int>(k));
+        _galleryCells = numCells;
+        build(gallery);
+    }
+
+    // Prepares a query of the gallery (see HistogramGallery::query) for the
+    // bound computations. The selected cells are taken from all parts of the
+    // query (the normalized histogram, the counts and the scales), so the
+    // bound compares the same values as the full distance.
+    HistogramQuery query(const HistogramQuery& query) const {
+        HistogramQuery coarse;
+        coarse.hist = impl::select_cells(query.hist, _cells, _numPatterns);
+        if(!query.counts.empty())
+            coarse.counts = impl::select_cells(query.counts, _cells, _numPatterns);
+        if(!query.scales.empty())
+            coarse.scales = impl::select_cells(query.scales, _cells, 1);
+        return coarse;
+    }
+
+    // Returns a lower bound of the distance between the template at idx and
+    // the query, the distance on the selected cells. Its terms equal those
+    // of the full distance, but are summed up in another order, so the bound
+    // is lowered by the rounding error of the sums.
+    double bound(int idx, const HistogramQuery& query) const {
+        return _coarse->distance(idx, query, DBL_MAX) * (1.0 - 2.0 * _galleryCells * DBL_EPSILON);
+    }
+
+    // Serializes the selected cells to a given cv::FileStorage (or
+    // ModelWriter).
+    template<typename _Storage>
+    void save(_Storage& fs) const {
+        writeFileNodeList(fs, "cascade_cells", _cells);
+    }
+
+    // Deserializes the selected cells from a given cv::FileNode (or
+    // ModelNode) and copies them from the templates of gallery. Models
+    // without a selection (or one which doesn't fit the gallery) get the
+    // cells selected anew.
+    template<typename _Node>
+    void load(const _Node& fn, const HistogramGallery& gallery) {
+        vector<int> cells;
+        readFileNodeList(fn["cascade_cells"], cells);
+        int numCells = (gallery.size() == 0) ? 0 : gallery.histogram(0).cols / _numPatterns;
+        if(!isSelection(cells, numCells)) {
+            compute(gallery);
+            return;
+        }
+        _cells = cells;
+        _galleryCells = numCells;
+        build(gallery);
+    }
+};
+
+} // namespace cv
+
+#endif
@@ -0,0 +1,2222 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __INDEX_HPP__
+#define __INDEX_HPP__
+
+#include "opencv2/opencv.hpp"
+#include "helper.hpp"
+#include "distance.hpp"
+#include "model.hpp"
+#include "precision.hpp"
+
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+namespace cv {
+
+namespace impl {
+
+// The k best (squared distance, index) pairs of a nearest neighbor search.
+// Pairs are compared by distance and then by index, so ties go to the sample
+// with the lower index, no matter in which order the samples are visited.
+class KnnHeap {
+
+private:
+    int _k;
+    priority_queue<pair<double,int> > _heap;
+
+public:
+    KnnHeap(int k) : _k(k) {}
+
+    // Returns the k-th best squared distance, samples farther away can be
+    // abandoned.
+    double bound() const {
+        return (_heap.size() < _k) ? DBL_MAX : _heap.top().first;
+    }
+
+    // Offers a sample with its squared distance.
+    void push(double dist, int idx) {
+        if(_heap.size() < _k) {
+            _heap.push(make_pair(dist, idx));
+        } else if(make_pair(dist, idx) < _heap.top()) {
+            _heap.pop();
+            _heap.push(make_pair(dist, idx));
+        }
+    }
+
+    // Returns the indices and Euclidean distances sorted by distance, the
+    // heap is empty afterwards.
+    void pop(vector<int>& indices, vector<double>& distances) {
+        indices.resize(_heap.size());
+        distances.resize(_heap.size());
+        for(int i = (int) _heap.size() - 1; i >= 0; i--) {
+            distances[i] = std::sqrt(_heap.top().first);
+            indices[i] = _heap.top().second;
+            _heap.pop();
+        }
+    }
+};
+
+// Converts a query into a contiguous CV_64FC1 row with dims components.
+inline Mat query_row(const Mat& query, int dims) {
+    if(query.total() != dims)
+        CV_Error(CV_StsBadArg, "The query must have the dimension of the samples.");
+    Mat q;
+    query.reshape(1,1).convertTo(q, CV_64FC1);
+    return q;
+}
+
+// Relative tolerance of the lower bounds of the tree indices, so rounding
+// never prunes a sample at exactly the k-th best distance.
+const double INDEX_BOUND_TOLERANCE = 1e-9;
+
+// Orders rows of a CV_64FC1 matrix by one of their components.
+struct ComponentLess {
+    const Mat* data;
+    int dim;
+    bool operator()(int a, int b) const {
+        return data->at<double>(a, dim) < data->at<double>(b, dim);
+    }
+};
+
+// Splits the rows indices[begin..end) of src at the median of the component
+// with the largest spread, which is returned in dim. Returns the position of
+// the median, the rows before it have no greater value of the component.
+inline int split_rows(const Mat& src, vector<int>& indices, int begin, int end, int& dim) {
+    double maxSpread = -1.0;
+    dim = 0;
+    for(int j = 0; j < src.cols; j++) {
+        double lo = DBL_MAX, hi = -DBL_MAX;
+        for(int i = begin; i < end; i++) {
+            double v = src.at<double>(indices[i], j);
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        }
+        if(hi - lo > maxSpread) {
+            maxSpread = hi - lo;
+            dim = j;
+        }
+    }
+    int mid = (begin + end) / 2;
+    ComponentLess less = { &src, dim };
+    std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, less);
+    return mid;
+}
+
+// Returns the row of centers (CV_64FC1) nearest to a vector.
+inline int nearest_center(const Mat& centers, const double* p) {
+    int best = 0;
+    double bestDist = DBL_MAX;
+    for(int c = 0; c < centers.rows; c++) {
+        double d = sqeuclidean(centers.ptr<double>(c), p, centers.cols);
+        if(d < bestDist) {
+            bestDist = d;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// Clusters the rows of data (CV_64FC1) into (at most) K clusters with Lloyd's
+// algorithm, seeded with k-means++. Empty clusters are reseeded with the
+// sample farthest from its center. Returns the centers as rows.
+inline Mat kmeans(const Mat& data, int K, RNG& rng, int iterations = 20) {
+    K = std::min(K, data.rows);
+    Mat centers(K, data.cols, CV_64FC1);
+    // k-means++: each seed is drawn with a probability proportional to the
+    // squared distance to the nearest seed so far
+    vector<double> dists(data.rows, DBL_MAX);
+    int seed = rng.uniform(0, data.rows);
+    for(int c = 0; c < K; c++) {
+        Mat center = centers.row(c);
+        data.row(seed).copyTo(center);
+        double total = 0.0;
+        for(int i = 0; i < data.rows; i++) {
+            dists[i] = std::min(dists[i], sqeuclidean(data.ptr<double>(i), centers.ptr<double>(c), data.cols));
+            total += dists[i];
+        }
+        double r = rng.uniform(0.0, 1.0) * total;
+        for(seed = 0; seed < data.rows - 1; seed++) {
+            r -= dists[seed];
+            if(r < 0.0)
+                break;
+        }
+    }
+    vector<int> labels(data.rows, -1);
+    for(int iter = 0; iter < iterations; iter++) {
+        bool changed = false;
+        for(int i = 0; i < data.rows; i++) {
+            int label = nearest_center(centers, data.ptr<double>(i));
+            changed = changed || (label != labels[i]);
+            labels[i] = label;
+        }
+        if(!changed)
+            break;
+        Mat sums = Mat::zeros(K, data.cols, CV_64FC1);
+        vector<int> counts(K, 0);
+        for(int i = 0; i < data.rows; i++) {
+            double* s = sums.ptr<double>(labels[i]);
+            const double* p = data.ptr<double>(i);
+            for(int j = 0; j < data.cols; j++)
+                s[j] += p[j];
+            counts[labels[i]]++;
+        }
+        for(int c = 0; c < K; c++) {
+            double* center = centers.ptr<double>(c);
+            if(counts[c] > 0) {
+                const double* s = sums.ptr<double>(c);
+                for(int j = 0; j < data.cols; j++)
+                    center[j] = s[j] / counts[c];
+                continue;
+            }
+            int farthest = 0;
+            double maxDist = -1.0;
+            for(int i = 0; i < data.rows; i++) {
+                double d = sqeuclidean(data.ptr<double>(i), centers.ptr<double>(labels[i]), data.cols);
+                if(d > maxDist) {
+                    maxDist = d;
+                    farthest = i;
+                }
+            }
+            const double* p = data.ptr<double>(farthest);
+            for(int j = 0; j < data.cols; j++)
+                center[j] = p[j];
+            labels[farthest] = c;
+        }
+    }
+    return centers;
+}
+
+// Returns (at most) n randomly chosen rows of data.
+inline Mat sample_rows(const Mat& data, int n, RNG& rng) {
+    if(n >= data.rows)
+        return data;
+    vector<int> indices(data.rows);
+    for(int i = 0; i < data.rows; i++)
+        indices[i] = i;
+    Mat result(n, data.cols, data.type());
+    for(int i = 0; i < n; i++) {
+        std::swap(indices[i], indices[rng.uniform(i, data.rows)]);
+        Mat row = result.row(i);
+        data.row(indices[i]).copyTo(row);
+    }
+    return result;
+}
+
+// Returns (at most) n randomly chosen rows of a packed matrix, decoded (see
+// sample_rows).
+inline Mat sample_rows(const PackedMat& data, int n, RNG& rng) {
+    if(n >= data.rows())
+        return data.unpack();
+    vector<int> indices(data.rows());
+    for(int i = 0; i < data.rows(); i++)
+        indices[i] = i;
+    Mat result(n, data.cols(), CV_64FC1);
+    for(int i = 0; i < n; i++) {
+        std::swap(indices[i], indices[rng.uniform(i, data.rows())]);
+        Mat row = result.row(i);
+        data.unpack(indices[i], indices[i] + 1).copyTo(row);
+    }
+    return result;
+}
+
+// The samples of an index: rows copied into the index, or the gallery of a
+// model, which is referenced instead (see GalleryIndex::build).
+class IndexSamples {
+
+private:
+    PackedMat _rows;
+    const PackedMat* _gallery;
+    // number of samples in the index, a referenced gallery may hold more
+    int _size;
+
+public:
+    IndexSamples(int precision = PackedMat::FLOAT64) :
+        _rows(precision),
+        _gallery(0),
+        _size(0) {}
+
+    // Copies the rows of data.
+    void assign(const Mat& data) {
+        Mat src;
+        data.convertTo(src, CV_64FC1);
+        _gallery = 0;
+        _rows.clear();
+        _rows.push_back(src);
+        _size = _rows.rows();
+    }
+
+    // References the rows of a gallery.
+    void attach(const PackedMat& gallery) {
+        _gallery = &gallery;
+        _rows.clear();
+        _size = gallery.rows();
+    }
+
+    // Appends a sample, which a referenced gallery must hold already.
+    void push_back(const Mat& sample) {
+        if(_gallery == 0)
+            _rows.push_back(sample);
+        else if(_gallery->rows() <= _size)
+            CV_Error(CV_StsError, "A sample must be appended to the gallery before it's added to the index.");
+        _size++;
+    }
+
+    // Returns the samples.
+    const PackedMat& get() const {
+        return _gallery ? *_gallery : _rows;
+    }
+
+    // Returns the number of samples in the index.
+    int size() const { return _size; }
+
+    // Returns true if the samples are referenced.
+    bool attached() const { return _gallery != 0; }
+
+    // Returns the number of bytes allocated for copied rows.
+    size_t memory() const {
+        return _gallery ? 0 : _rows.memory();
+    }
+};
+
+} // namespace impl
+
+// A GalleryIndex finds the nearest neighbors of a query among the rows of a
+// gallery matrix (for example the projections of an Eigenfaces model) with
+// the Euclidean distance. The LINEAR, KDTREE and BALLTREE indices are exact.
+class GalleryIndex {
+public:
+    // Available indices.
+    enum {
+        LINEAR = 0,
+        KDTREE = 1,
+        BALLTREE = 2,
+        HNSW = 3,
+        IVFPQ = 4,
+        HASHING = 5
+    };
+
+    //! virtual destructor
+    virtual ~GalleryIndex() {}
+
+    // Returns the type of this index.
+    virtual int type() const = 0;
+
+    // Builds the index over the rows of data (one sample per row).
+    virtual void build(const Mat& data) = 0;
+
+    // Builds the index over the rows of the gallery of a model. Indices
+    // which compare the samples at query time reference the gallery instead
+    // of copying it: the gallery must outlive the index, and a sample must
+    // be appended to the gallery before it's passed to add.
+    virtual void build(const PackedMat& gallery) {
+        build(gallery.unpack());
+    }
+
+    // Appends a sample to the index, its index is size()-1.
+    virtual void add(const Mat& sample) = 0;
+
+    // Returns the number of samples in this index.
+    virtual int size() const = 0;
+
+    // Returns the dimension of the samples.
+    virtual int dims() const = 0;
+
+    // Returns the number of bytes allocated by this index.
+    virtual size_t memory() const = 0;
+
+    // Returns true if the index keeps the samples out of memory (see
+    // IVFPQIndex), a model then drops its gallery and reads it back with
+    // samples when it's needed.
+    virtual bool spills() const { return false; }
+
+    // Returns the samples of an index which spills them, one per row.
+    virtual Mat samples() const { return Mat(); }
+
+    // Gives an index which spills its samples storage of its own, so a copy
+    // doesn't write to the samples of the original (see copyGalleryIndex).
+    virtual void unshare() {}
+
+    // Finds the (at most) k nearest samples of a query and returns their
+    // indices and Euclidean distances, sorted by distance. Ties go to the
+    // sample with the lower index.
+    virtual void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const = 0;
+
+    // Serializes the state of the index, which can't be rebuilt from the
+    // samples, to a given cv::FileStorage.
+    virtual void save(FileStorage& fs) const {}
+
+    // Deserializes an index over the rows of data from a given cv::FileNode.
+    // The exact indices are rebuilt from data.
+    virtual void load(const FileNode& fn, const Mat& data) {
+        build(data);
+    }
+
+    // Serializes the state of the index to a binary model file.
+    virtual void save(ModelWriter& fs) const {}
+
+    // Deserializes an index over the rows of data from a binary model file.
+    virtual void load(const ModelNode& fn, const Mat& data) {
+        build(data);
+    }
+
+    // Deserializes an index over the rows of a gallery, see build.
+    virtual void load(const FileNode& fn, const PackedMat& gallery) {
+        load(fn, gallery.unpack());
+    }
+
+    // Deserializes an index over the rows of a gallery, see build.
+    virtual void load(const ModelNode& fn, const PackedMat& gallery) {
+        load(fn, gallery.unpack());
+    }
+
+    // Returns the index of the nearest sample of a query, or -1 if the index
+    // is empty.
+    int nearest(const Mat& query) const {
+        vector<int> indices;
+        vector<double> distances;
+        knn(query, 1, indices, distances);
+        return indices.empty() ? -1 : indices[0];
+    }
+};
+
+// Scans all samples. The search is exact: the squared distance is
+// accumulated in blocks of components, and a candidate is abandoned as soon
+// as its partial sum exceeds the k-th best distance found so far.
+//
+// The components are visited in blocks of BLOCK_SIZE contiguous components,
+// in the order of the variance of the blocks over the gallery, so the blocks
+// with the largest (expected) contribution are summed up first and
+// candidates are abandoned early. Each block is summed up by the SIMD
+// kernels of the precision. Only the order of the blocks is stored, the
+// samples aren't permuted, so the index scans the gallery of a model in place
+// (see GalleryIndex::build), for example the projections of a mapped model.
+//
+// The samples can be stored with a reduced precision (see PackedMat), the
+// distances are then computed on the packed samples and are exact for the
+// packed values.
+class LinearIndex : public GalleryIndex {
+
+private:
+    impl::IndexSamples _samples;
+    // block order, the i-th visited block holds the components
+    // [_order[i]*BLOCK_SIZE, (_order[i]+1)*BLOCK_SIZE)
+    vector<int> _order;
+
+    int blocks() const {
+        return (dims() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    // Orders the blocks of contiguous components by the summed variance of
+    // their components over the samples. The components of a block stay
+    // contiguous, so each block is a single call of the SIMD kernels.
+    void computeOrder() {
+        const PackedMat& samples = _samples.get();
+        _order.clear();
+        if(samples.empty())
+            return;
+        int cols = samples.cols();
+        vector<double> sum(cols, 0.0), sqsum(cols, 0.0), row(cols);
+        for(int sampleIdx = 0; sampleIdx < samples.rows(); sampleIdx++) {
+            std::fill(row.begin(), row.end(), 0.0);
+            samples.axpy(sampleIdx, 1.0, &row[0]);
+            for(int j = 0; j < cols; j++) {
+                sum[j] += row[j];
+                sqsum[j] += row[j]*row[j];
+            }
+        }
+        Mat variance = Mat::zeros(1, blocks(), CV_64FC1);
+        for(int j = 0; j < cols; j++) {
+            double mean = sum[j] / samples.rows();
+            variance.at<double>(0,j / BLOCK_SIZE) += sqsum[j] / samples.rows() - mean*mean;
+        }
+        Mat indices = argsort(variance, false);
+        for(int b = 0; b < blocks(); b++)
+            _order.push_back(indices.at<int>(b));
+    }
+
+    // Returns true if order is a permutation of the blocks of cols
+    // components.
+    static bool isOrder(const vector<int>& order, int cols) {
+        int blocks = (cols + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if(order.size() != blocks)
+            return false;
+        vector<bool> seen(blocks, false);
+        for(int i = 0; i < order.size(); i++) {
+            if((order[i] < 0) || (order[i] >= blocks) || seen[order[i]])
+                return false;
+            seen[order[i]] = true;
+        }
+        return true;
+    }
+
+public:
+    // Number of components summed up before a candidate is checked.
+    enum { BLOCK_SIZE = 8 };
+
+    // Initializes an empty index, which stores the samples with the given
+    // precision.
+    LinearIndex(int precision = PackedMat::FLOAT64) :
+        _samples(precision) {}
+
+    // Initializes an index over the rows of data.
+    LinearIndex(const Mat& data, int precision = PackedMat::FLOAT64) :
+        _samples(precision) {
+        build(data);
+    }
+
+    int type() const { return LINEAR; }
+
+    // Returns the precision of the samples.
+    int precision() const { return _samples.get().precision(); }
+
+    void build(const Mat& data) {
+        _samples.assign(data);
+        computeOrder();
+    }
+
+    // Scans a referenced gallery, see GalleryIndex::build.
+    void build(const PackedMat& gallery) {
+        _samples.attach(gallery);
+        computeOrder();
+    }
+
+    // Appends a sample, the order of the blocks is kept.
+    void add(const Mat& sample) {
+        if(_order.empty()) {
+            if(_samples.attached())
+                build(_samples.get());
+            else
+                build(sample.reshape(1,1));
+            return;
+        }
+        Mat src = impl::query_row(sample, dims());
+        _samples.push_back(src);
+    }
+
+    int size() const { return _samples.size(); }
+
+    int dims() const { return _samples.get().cols(); }
+
+    size_t memory() const {
+        return _samples.memory() + _order.size()*sizeof(int);
+    }
+
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        const PackedMat& samples = _samples.get();
+        if(_order.empty() || (k <= 0))
+            return;
+        int cols = samples.cols();
+        Mat q = impl::query_row(query, cols);
+        const double* qp = q.ptr<double>();
+        impl::KnnHeap best(k);
+        for(int sampleIdx = 0; sampleIdx < size(); sampleIdx++) {
+            double bound = best.bound();
+            double dist = 0.0;
+            for(int b = 0; b < _order.size(); b++) {
+                int begin = _order[b] * BLOCK_SIZE;
+                dist += samples.sqeuclidean(sampleIdx, qp + begin, begin, std::min((int) BLOCK_SIZE, cols - begin));
+                if(dist > bound)
+                    break;
+            }
+            best.push(dist, sampleIdx);
+        }
+        best.pop(indices, distances);
+    }
+
+    using GalleryIndex::save;
+
+    // YAML models don't store the order, it's recomputed.
+    void load(const FileNode& fn, const Mat& data) { build(data); }
+
+    void load(const FileNode& fn, const PackedMat& gallery) { build(gallery); }
+
+    // Writes the order of the blocks, the samples are kept by the model.
+    void save(ModelWriter& fs) const {
+        fs << "linear_blocks" << _order;
+    }
+
+    // Reads the order of the blocks, models without it get a newly computed
+    // one.
+    void load(const ModelNode& fn, const Mat& data) {
+        vector<int> order;
+        fn["linear_blocks"] >> order;
+        if(!isOrder(order, data.cols)) {
+            build(data);
+            return;
+        }
+        _samples.assign(data);
+        _order = order;
+    }
+
+    void load(const ModelNode& fn, const PackedMat& gallery) {
+        vector<int> order;
+        fn["linear_blocks"] >> order;
+        if(!isOrder(order, gallery.cols())) {
+            build(gallery);
+            return;
+        }
+        _samples.attach(gallery);
+        _order = order;
+    }
+};
+
+// An exact KD-tree. Each node splits its samples at the median of the
+// component with the largest spread, the leaves hold up to LEAF_SIZE samples,
+// which are stored contiguously. The search descends into the nearer child
+// first and visits the farther child only if the distance to its cell can
+// beat the k-th best distance. The distance to a cell is tracked
+// incrementally over the split components (Arya and Mount).
+class KDTreeIndex : public GalleryIndex {
+
+private:
+    struct Node {
+        int begin, end;
+        // children (-1 for a leaf), split component and value
+        int left, right;
+        int dim;
+        double split;
+    };
+
+    // samples in tree order and their original row
+    Mat _data;
+    vector<int> _indices;
+    vector<Node> _nodes;
+
+    int build(const Mat& src, int begin, int end) {
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        node.left = node.right = -1;
+        node.dim = 0;
+        node.split = 0.0;
+        int nodeIdx = (int) _nodes.size();
+        _nodes.push_back(node);
+        if(end - begin <= LEAF_SIZE)
+            return nodeIdx;
+        int mid = impl::split_rows(src, _indices, begin, end, node.dim);
+        node.split = src.at<double>(_indices[mid], node.dim);
+        node.left = build(src, begin, mid);
+        node.right = build(src, mid, end);
+        _nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+
+    void search(int nodeIdx, double rd, double* offsets, const double* q, impl::KnnHeap& best) const {
+        const Node& node = _nodes[nodeIdx];
+        if(node.left < 0) {
+            for(int i = node.begin; i < node.end; i++)
+                best.push(impl::sqeuclidean(_data.ptr<double>(i), q, _data.cols), _indices[i]);
+            return;
+        }
+        double diff = q[node.dim] - node.split;
+        int nearer = (diff < 0.0) ? node.left : node.right;
+        int farther = (diff < 0.0) ? node.right : node.left;
+        search(nearer, rd, offsets, q, best);
+        // distance to the cell of the farther child
+        double old = offsets[node.dim];
+        double farRd = rd - old*old + diff*diff;
+        if(farRd * (1.0 - impl::INDEX_BOUND_TOLERANCE) <= best.bound()) {
+            offsets[node.dim] = diff;
+            search(farther, farRd, offsets, q, best);
+            offsets[node.dim] = old;
+        }
+    }
+
+public:
+    // Maximum number of samples in a leaf.
+    enum { LEAF_SIZE = 16 };
+
+    // Initializes an empty index.
+    KDTreeIndex() {}
+
+    // Initializes an index over the rows of data.
+    KDTreeIndex(const Mat& data) {
+        build(data);
+    }
+
+    int type() const { return KDTREE; }
+
+    void build(const Mat& data) {
+        _data.release();
+        _indices.clear();
+        _nodes.clear();
+        if(data.empty())
+            return;
+        Mat src;
+        data.convertTo(src, CV_64FC1);
+        for(int i = 0; i < src.rows; i++)
+            _indices.push_back(i);
+        build(src, 0, src.rows);
+        // store the samples in tree order
+        _data.create(src.rows, src.cols, CV_64FC1);
+        for(int i = 0; i < src.rows; i++) {
+            Mat row = _data.row(i);
+            src.row(_indices[i]).copyTo(row);
+        }
+    }
+
+    // Appends a sample and rebuilds the tree.
+    void add(const Mat& sample) {
+        if(_data.empty()) {
+            build(sample.reshape(1,1));
+            return;
+        }
+        Mat src = impl::query_row(sample, _data.cols);
+        Mat data(_data.rows, _data.cols, CV_64FC1);
+        for(int i = 0; i < _data.rows; i++) {
+            Mat row = data.row(_indices[i]);
+            _data.row(i).copyTo(row);
+        }
+        data.push_back(src);
+        build(data);
+    }
+
+    int size() const { return _data.rows; }
+
+    int dims() const { return _data.cols; }
+
+    size_t memory() const {
+        return _data.total()*sizeof(double) + _indices.size()*sizeof(int) + _nodes.size()*sizeof(Node);
+    }
+
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        if(_data.empty() || (k <= 0))
+            return;
+        Mat q = impl::query_row(query, _data.cols);
+        vector<double> offsets(_data.cols, 0.0);
+        impl::KnnHeap best(k);
+        search(0, 0.0, &offsets[0], q.ptr<double>(), best);
+        best.pop(indices, distances);
+    }
+};
+
+// An exact ball tree. Each node is bounded by a ball around the centroid of
+// its samples and split at the median of the component with the largest
+// spread. No sample in a ball is closer to the query than
+//
+//      max(|q - c| - r, 0)
+//
+// so the search skips all balls whose bound doesn't beat the k-th best
+// distance. The children are visited in the order of their bound. Ball trees
+// stay effective for higher dimensions than KD-trees.
+class BallTreeIndex : public GalleryIndex {
+
+private:
+    struct Node {
+        int begin, end;
+        // children (-1 for a leaf) and radius of the ball
+        int left, right;
+        double radius;
+    };
+
+    // samples in tree order, their original row and the ball centers
+    Mat _data;
+    vector<int> _indices;
+    vector<Node> _nodes;
+    Mat _centers;
+
+    int build(const Mat& src, int begin, int end, vector<Mat>& centers) {
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        node.left = node.right = -1;
+        int nodeIdx = (int) _nodes.size();
+        _nodes.push_back(node);
+        // centroid and radius of the ball
+        Mat center = Mat::zeros(1, src.cols, CV_64FC1);
+        double* c = center.ptr<double>();
+        for(int i = begin; i < end; i++) {
+            const double* p = src.ptr<double>(_indices[i]);
+            for(int j = 0; j < src.cols; j++)
+                c[j] += p[j];
+        }
+        for(int j = 0; j < src.cols; j++)
+            c[j] /= (end - begin);
+        node.radius = 0.0;
+        for(int i = begin; i < end; i++)
+            node.radius = std::max(node.radius, impl::sqeuclidean(src.ptr<double>(_indices[i]), c, src.cols));
+        node.radius = std::sqrt(node.radius);
+        centers.push_back(center);
+        if(end - begin > LEAF_SIZE) {
+            int dim;
+            int mid = impl::split_rows(src, _indices, begin, end, dim);
+            node.left = build(src, begin, mid, centers);
+            node.right = build(src, mid, end, centers);
+        }
+        _nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+
+    // Lower bound of the squared distance between the query and the samples
+    // of a node.
+    double bound(int nodeIdx, const double* q) const {
+        double d = std::sqrt(impl::sqeuclidean(_centers.ptr<double>(nodeIdx), q, _centers.cols));
+        double b = std::max(d - _nodes[nodeIdx].radius, 0.0);
+        return b * b * (1.0 - impl::INDEX_BOUND_TOLERANCE);
+    }
+
+    void search(int nodeIdx, double lb, const double* q, impl::KnnHeap& best) const {
+        if(lb > best.bound())
+            return;
+        const Node& node = _nodes[nodeIdx];
+        if(node.left < 0) {
+            for(int i = node.begin; i < node.end; i++)
+                best.push(impl::sqeuclidean(_data.ptr<double>(i), q, _data.cols), _indices[i]);
+            return;
+        }
+        double lbLeft = bound(node.left, q);
+        double lbRight = bound(node.right, q);
+        if(lbLeft <= lbRight) {
+            search(node.left, lbLeft, q, best);
+            search(node.right, lbRight, q, best);
+        } else {
+            search(node.right, lbRight, q, best);
+            search(node.left, lbLeft, q, best);
+        }
+    }
+
+public:
+    // Maximum number of samples in a leaf.
+    enum { LEAF_SIZE = 16 };
+
+    // Initializes an empty index.
+    BallTreeIndex() {}
+
+    // Initializes an index over the rows of data.
+    BallTreeIndex(const Mat& data) {
+        build(data);
+    }
+
+    int type() const { return BALLTREE; }
+
+    void build(const Mat& data) {
+        _data.release();
+        _indices.clear();
+        _nodes.clear();
+        _centers.release();
+        if(data.empty())
+            return;
+        Mat src;
+        data.convertTo(src, CV_64FC1);
+        for(int i = 0; i < src.rows; i++)
+            _indices.push_back(i);
+        vector<Mat> centers;
+        build(src, 0, src.rows, centers);
+        _centers = asRowMatrix(centers, CV_64FC1);
+        // store the samples in tree order
+        _data.create(src.rows, src.cols, CV_64FC1);
+        for(int i = 0; i < src.rows; i++) {
+            Mat row = _data.row(i);
+            src.row(_indices[i]).copyTo(row);
+        }
+    }
+
+    // Appends a sample and rebuilds the tree.
+    void add(const Mat& sample) {
+        if(_data.empty()) {
+            build(sample.reshape(1,1));
+            return;
+        }
+        Mat src = impl::query_row(sample, _data.cols);
+        Mat data(_data.rows, _data.cols, CV_64FC1);
+        for(int i = 0; i < _data.rows; i++) {
+            Mat row = data.row(_indices[i]);
+            _data.row(i).copyTo(row);
+        }
+        data.push_back(src);
+        build(data);
+    }
+
+    int size() const { return _data.rows; }
+
+    int dims() const { return _data.cols; }
+
+    size_t memory() const {
+        return (_data.total() + _centers.total())*sizeof(double)
+                + _indices.size()*sizeof(int) + _nodes.size()*sizeof(Node);
+    }
+
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        if(_data.empty() || (k <= 0))
+            return;
+        Mat q = impl::query_row(query, _data.cols);
+        impl::KnnHeap best(k);
+        search(0, 0.0, q.ptr<double>(), best);
+        best.pop(indices, distances);
+    }
+};
+
+// An approximate index with a Hierarchical Navigable Small World graph
+// (Malkov and Yashunin). Each sample is a node on the levels 0..l, with l
+// drawn from an exponential distribution, and is linked to (at most) M
+// neighbors per level (2*M on level 0). A search descends greedily from the
+// single node on the top level and finishes with a beam search of width
+// efSearch on level 0, so it visits only a tiny part of a large gallery.
+// Larger values of efSearch (and efConstruction while building) give a
+// higher recall at the cost of speed.
+//
+// Samples are inserted one by one, so the graph grows with the enrollment.
+// Each search keeps its own visited marks, so concurrent queries on the same
+// index are fine, as long as no samples are added meanwhile.
+class HNSWIndex : public GalleryIndex {
+
+private:
+    int _M;
+    int _efConstruction;
+    int _efSearch;
+    // samples in the order of insertion
+    impl::IndexSamples _samples;
+    // top level and neighbors per level of each node
+    vector<int> _levels;
+    vector<vector<vector<int> > > _links;
+    int _entry;
+    int _maxLevel;
+    RNG _rng;
+
+    typedef pair<double,int> Candidate;
+
+    // Visited marks of a search. A new stamp unvisits all nodes, so the
+    // marks are reused for the levels of an insertion.
+    struct Visited {
+        vector<unsigned> marks;
+        unsigned stamp;
+
+        Visited() : stamp(0) {}
+
+        // Starts a new search over n nodes, all nodes are unvisited.
+        void reset(int n) {
+            if(marks.size() < n)
+                marks.resize(n, 0);
+            if(++stamp == 0) {
+                std::fill(marks.begin(), marks.end(), 0);
+                stamp = 1;
+            }
+        }
+
+        // Marks a node, returns false if it was visited already.
+        bool visit(int node) {
+            if(marks[node] == stamp)
+                return false;
+            marks[node] = stamp;
+            return true;
+        }
+    };
+
+    double distance(int node, const double* q) const {
+        return _samples.get().sqeuclidean(node, q, 0, dims());
+    }
+
+    // Maximum number of neighbors on a level.
+    int maxLinks(int level) const {
+        return (level == 0) ? 2*_M : _M;
+    }
+
+    // Moves to the nearest neighbor on a level while it gets closer.
+    int greedy(const double* q, int entry, int level) const {
+        int current = entry;
+        double best = distance(current, q);
+        bool changed = true;
+        while(changed) {
+            changed = false;
+            const vector<int>& links = _links[current][level];
+            for(int i = 0; i < links.size(); i++) {
+                double d = distance(links[i], q);
+                if(make_pair(d, links[i]) < make_pair(best, current)) {
+                    best = d;
+                    current = links[i];
+                    changed = true;
+                }
+            }
+        }
+        return current;
+    }
+
+    // Beam search of width ef on a level, the result is sorted by distance.
+    void search(const double* q, int entry, int ef, int level, Visited& visited, vector<Candidate>& result) const {
+        visited.reset(size());
+        // candidates to expand (min-heap) and best nodes found (max-heap)
+        priority_queue<Candidate, vector<Candidate>, greater<Candidate> > candidates;
+        priority_queue<Candidate> best;
+        Candidate start(distance(entry, q), entry);
+        candidates.push(start);
+        best.push(start);
+        visited.visit(entry);
+        while(!candidates.empty()) {
+            Candidate c = candidates.top();
+            if(c > best.top())
+                break;
+            candidates.pop();
+            const vector<int>& links = _links[c.second][level];
+            for(int i = 0; i < links.size(); i++) {
+                int n = links[i];
+                if(!visited.visit(n))
+                    continue;
+                Candidate next(distance(n, q), n);
+                if((best.size() < ef) || (next < best.top())) {
+                    candidates.push(next);
+                    best.push(next);
+                    if(best.size() > ef)
+                        best.pop();
+                }
+            }
+        }
+        result.resize(best.size());
+        for(int i = (int) best.size() - 1; i >= 0; i--) {
+            result[i] = best.top();
+            best.pop();
+        }
+    }
+
+    // Selects up to m neighbors from candidates sorted by distance. A
+    // candidate is skipped if it's closer to a selected neighbor than to the
+    // node, which keeps links in all directions. Skipped candidates fill up
+    // the remaining links.
+    void selectNeighbors(const vector<Candidate>& candidates, int m, vector<int>& result) const {
+        result.clear();
+        vector<int> skipped;
+        for(int i = 0; (i < candidates.size()) && (result.size() < m); i++) {
+            int idx = candidates[i].second;
+            Mat c = _samples.get().unpack(idx, idx + 1);
+            bool good = true;
+            for(int j = 0; good && (j < result.size()); j++)
+                good = distance(result[j], c.ptr<double>()) >= candidates[i].first;
+            if(good)
+                result.push_back(candidates[i].second);
+            else
+                skipped.push_back(candidates[i].second);
+        }
+        for(int i = 0; (i < skipped.size()) && (result.size() < m); i++)
+            result.push_back(skipped[i]);
+    }
+
+    // Links a node to its neighbors on a level and back, neighbors with too
+    // many links are pruned.
+    void connect(int node, int level, const vector<int>& neighbors) {
+        _links[node][level] = neighbors;
+        for(int i = 0; i < neighbors.size(); i++) {
+            vector<int>& links = _links[neighbors[i]][level];
+            links.push_back(node);
+            if(links.size() <= maxLinks(level))
+                continue;
+            Mat p = _samples.get().unpack(neighbors[i], neighbors[i] + 1);
+            vector<Candidate> candidates;
+            for(int j = 0; j < links.size(); j++)
+                candidates.push_back(Candidate(distance(links[j], p.ptr<double>()), links[j]));
+            std::sort(candidates.begin(), candidates.end());
+            vector<int> pruned;
+            selectNeighbors(candidates, maxLinks(level), pruned);
+            links = pruned;
+        }
+    }
+
+    // Clears the graph.
+    void reset() {
+        _levels.clear();
+        _links.clear();
+        _entry = -1;
+        _maxLevel = -1;
+        _rng = RNG(12345);
+    }
+
+    // Inserts the sample at row node of the samples into the graph.
+    void insert(int node) {
+        // level with P(l >= L) = M^-L
+        double u = _rng.uniform(0.0, 1.0);
+        int level = static_cast<int>(-std::log(std::max(u, 1e-12)) / std::log((double) _M));
+        _levels.push_back(level);
+        _links.push_back(vector<vector<int> >(level + 1));
+        if(_entry < 0) {
+            _entry = node;
+            _maxLevel = level;
+            return;
+        }
+        Mat sample = _samples.get().unpack(node, node + 1);
+        const double* q = sample.ptr<double>();
+        int entry = _entry;
+        for(int l = _maxLevel; l > level; l--)
+            entry = greedy(q, entry, l);
+        Visited visited;
+        vector<Candidate> candidates;
+        vector<int> neighbors;
+        for(int l = std::min(level, _maxLevel); l >= 0; l--) {
+            search(q, entry, _efConstruction, l, visited, candidates);
+            selectNeighbors(candidates, _M, neighbors);
+            connect(node, l, neighbors);
+            entry = candidates[0].second;
+        }
+        if(level > _maxLevel) {
+            _entry = node;
+            _maxLevel = level;
+        }
+    }
+
+public:
+    // Initializes an empty index with M links per node and level, and the
+    // beam widths efConstruction (insertion) and efSearch (queries).
+    HNSWIndex(int M = 16, int efConstruction = 200, int efSearch = 64) :
+        _M(M),
+        _efConstruction(efConstruction),
+        _efSearch(efSearch),
+        _entry(-1),
+        _maxLevel(-1),
+        _rng(12345) {
+        if((M < 2) || (efConstruction < 1) || (efSearch < 1))
+            CV_Error(CV_StsBadArg, "HNSW needs M >= 2 and positive beam widths.");
+    }
+
+    int type() const { return HNSW; }
+
+    void build(const Mat& data) {
+        reset();
+        _samples.assign(data);
+        for(int sampleIdx = 0; sampleIdx < data.rows; sampleIdx++)
+            insert(sampleIdx);
+    }
+
+    // Builds the graph over a referenced gallery, see GalleryIndex::build.
+    void build(const PackedMat& gallery) {
+        reset();
+        _samples.attach(gallery);
+        for(int sampleIdx = 0; sampleIdx < gallery.rows(); sampleIdx++)
+            insert(sampleIdx);
+    }
+
+    void add(const Mat& sample) {
+        Mat src = impl::query_row(sample, (size() == 0) ? (int) sample.total() : dims());
+        int node = size();
+        _samples.push_back(src);
+        insert(node);
+    }
+
+    int size() const { return static_cast<int>(_levels.size()); }
+
+    int dims() const { return _samples.get().cols(); }
+
+    size_t memory() const {
+        size_t links = 0;
+        for(int i = 0; i < _links.size(); i++)
+            for(int l = 0; l < _links[i].size(); l++)
+                links += _links[i][l].capacity();
+        return _samples.memory() + (_levels.size() + links)*sizeof(int);
+    }
+
+    // Finds the (approximate) k nearest samples, see GalleryIndex::knn.
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        if((size() == 0) || (k <= 0))
+            return;
+        Mat q = impl::query_row(query, dims());
+        const double* qp = q.ptr<double>();
+        int entry = _entry;
+        for(int l = _maxLevel; l > 0; l--)
+            entry = greedy(qp, entry, l);
+        Visited visited;
+        vector<Candidate> candidates;
+        search(qp, entry, std::max(_efSearch, k), 0, visited, candidates);
+        for(int i = 0; (i < candidates.size()) && (i < k); i++) {
+            indices.push_back(candidates[i].second);
+            distances.push_back(std::sqrt(candidates[i].first));
+        }
+    }
+
+    // Returns the beam width of the queries.
+    int efSearch() const { return _efSearch; }
+
+    // Sets the beam width of the queries.
+    void setEfSearch(int efSearch) {
+        if(efSearch < 1)
+            CV_Error(CV_StsBadArg, "The beam width must be positive.");
+        _efSearch = efSearch;
+    }
+
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    void load(const FileNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.rows))
+            build(data);
+        else
+            _samples.assign(data);
+    }
+
+    void load(const FileNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.rows()))
+            build(gallery);
+        else
+            _samples.attach(gallery);
+    }
+
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    void load(const ModelNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.rows))
+            build(data);
+        else
+            _samples.assign(data);
+    }
+
+    void load(const ModelNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.rows()))
+            build(gallery);
+        else
+            _samples.attach(gallery);
+    }
+
+private:
+    // The formats share the serialization code.
+    // Writes the parameters and the graph, the samples are kept by the model.
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        fs << "hnsw_m" << _M;
+        fs << "hnsw_ef_construction" << _efConstruction;
+        fs << "hnsw_ef_search" << _efSearch;
+        fs << "hnsw_entry" << _entry;
+        fs << "hnsw_max_level" << _maxLevel;
+        // per node and level: the number of links followed by the links
+        vector<int> links;
+        for(int i = 0; i < _links.size(); i++) {
+            for(int l = 0; l < _links[i].size(); l++) {
+                links.push_back(static_cast<int>(_links[i][l].size()));
+                links.insert(links.end(), _links[i][l].begin(), _links[i][l].end());
+            }
+        }
+        fs << "hnsw_levels" << Mat(_levels);
+        fs << "hnsw_links" << Mat(links);
+    }
+
+    // Reads the graph over rows samples. Returns false for models without a
+    // graph, or with a graph which doesn't match the samples (a truncated
+    // or corrupt file), which get a newly built one.
+    template<typename _Node>
+    bool deserialize(const _Node& fn, int rows) {
+        Mat levels, links;
+        fn["hnsw_levels"] >> levels;
+        fn["hnsw_links"] >> links;
+        if((rows == 0) || (levels.total() != rows) || (levels.type() != CV_32SC1)
+                || links.empty() || (links.type() != CV_32SC1) || !levels.isContinuous() || !links.isContinuous())
+            return false;
+        int M, efConstruction, efSearch, entry, maxLevel;
+        fn["hnsw_m"] >> M;
+        fn["hnsw_ef_construction"] >> efConstruction;
+        fn["hnsw_ef_search"] >> efSearch;
+        fn["hnsw_entry"] >> entry;
+        fn["hnsw_max_level"] >> maxLevel;
+        if((M < 2) || (efConstruction < 1) || (efSearch < 1) || (entry < 0) || (entry >= rows))
+            return false;
+        // each level holds its number of links, followed by the links
+        const int* l = levels.ptr<int>();
+        const int* p = links.ptr<int>();
+        size_t total = links.total();
+        size_t offset = 0;
+        vector<vector<vector<int> > > graph(rows);
+        for(int i = 0; i < rows; i++) {
+            if((l[i] < 0) || (l[i] >= total - offset))
+                return false;
+            graph[i].resize(l[i] + 1);
+            for(int level = 0; level <= l[i]; level++) {
+                int n = p[offset++];
+                if((n < 0) || (n > total - offset))
+                    return false;
+                for(int j = 0; j < n; j++) {
+                    if((p[offset + j] < 0) || (p[offset + j] >= rows) || (l[p[offset + j]] < level))
+                        return false;
+                }
+                graph[i][level].assign(p + offset, p + offset + n);
+                offset += n;
+            }
+        }
+        if((offset != total) || (l[entry] != maxLevel))
+            return false;
+        _M = M;
+        _efConstruction = efConstruction;
+        _efSearch = efSearch;
+        _entry = entry;
+        _maxLevel = maxLevel;
+        _levels.assign(l, l + rows);
+        _links.swap(graph);
+        // continue the levels of new samples with a different sequence
+        _rng = RNG(12345 + rows);
+        return true;
+    }
+};
+
+// Magic number at the beginning of the file of the samples of an IVFPQIndex.
+const char IVFPQ_SAMPLES_MAGIC[8] = { 'F', 'R', 'I', 'V', 'F', 'P', 'Q', '\0' };
+
+namespace impl {
+
+// Header of the file of the samples of an IVFPQIndex. The checksum of the
+// samples ties the file to the gallery it was written for.
+struct SampleFileHeader {
+    char magic[8];
+    unsigned int byteOrder;
+    int dims;
+    int rows;
+    int reserved;
+    uint64 checksum;
+};
+
+// Initial value of the FNV-1a hash.
+const uint64 FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+// Continues the FNV-1a hash h over n bytes.
+inline uint64 fnv1a(const void* data, size_t n, uint64 h = FNV_OFFSET_BASIS) {
+    const uchar* p = static_cast<const uchar*>(data);
+    for(size_t i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+} // namespace impl
+
+// An approximate index which compresses the gallery (Jegou et al., IVFADC).
+// A coarse quantizer (k-means with nlist centroids) partitions the samples
+// into inverted lists. The residual of a sample to its coarse centroid is
+// split into m subvectors, each encoded by the nearest of 256 centroids of
+// its own codebook, so a sample takes m bytes (plus its id) instead of
+// 8 bytes per component. A query visits the nprobe lists with the nearest
+// coarse centroids and computes the distances to their codes from a lookup
+// table of the distances between its subvectors and the codebooks
+// (asymmetric distance computation).
+//
+// The codes only approximate the distances. If rerank is positive, the best
+// rerank candidates are re-ranked with their exact distances to the samples,
+// which are referenced in the gallery of a model (see GalleryIndex::build).
+// If a filename is given, the samples are kept in that file instead and read
+// only for the candidates of a query, and the model drops its gallery (see
+// GalleryIndex::spills). The header of the file holds a checksum of the
+// samples, a file written for other samples is rewritten when the index is
+// loaded. Samples added after the build are encoded with the trained
+// quantizers.
+class IVFPQIndex : public GalleryIndex {
+
+private:
+    int _nlist;
+    int _m;
+    int _nprobe;
+    int _rerank;
+    string _filename;
+    int _dims;
+    // coarse centroids (nlist x dims) and the codebooks (256 x dims), the
+    // components _sub[j].._sub[j+1] of row c are centroid c of subvector j
+    Mat _coarse;
+    Mat _codebook;
+    vector<int> _sub;
+    // ids and codes (one byte per subvector) of the inverted lists
+    vector<vector<int> > _ids;
+    vector<vector<uchar> > _codes;
+    int _size;
+    // samples re-ranked in memory
+    impl::IndexSamples _samples;
+    // checksum of the samples in the file
+    uint64 _checksum;
+    RNG _rng;
+
+    int numCodes() const {
+        return static_cast<int>(_sub.size()) - 1;
+    }
+
+    // Returns true if the candidates are re-ranked with the samples in memory.
+    bool reranksInMemory() const {
+        return (_rerank > 0) && _filename.empty();
+    }
+
+    void reset() {
+        _coarse.release();
+        _codebook.release();
+        _sub.clear();
+        _ids.clear();
+        _codes.clear();
+        _dims = 0;
+        _size = 0;
+        _samples = impl::IndexSamples();
+        _checksum = impl::FNV_OFFSET_BASIS;
+        _rng = RNG(12345);
+    }
+
+    // Learns the quantizers from (a random subset of) the samples.
+    void train(const PackedMat& src) {
+        int nlist = (_nlist > 0) ? _nlist : cvRound(std::sqrt((double) src.rows()));
+        nlist = std::max(1, std::min(nlist, src.rows()));
+        _coarse = impl::kmeans(impl::sample_rows(src, TRAINING_SAMPLES * nlist, _rng), nlist, _rng);
+        // residuals to train the codebooks
+        Mat residuals = impl::sample_rows(src, TRAINING_SAMPLES * CODEBOOK_SIZE, _rng).clone();
+        for(int i = 0; i < residuals.rows; i++) {
+            double* r = residuals.ptr<double>(i);
+            const double* c = _coarse.ptr<double>(impl::nearest_center(_coarse, r));
+            for(int j = 0; j < _dims; j++)
+                r[j] -= c[j];
+        }
+        int m = std::min(_m, _dims);
+        _sub.resize(m + 1);
+        for(int j = 0; j <= m; j++)
+            _sub[j] = j * _dims / m;
+        _codebook = Mat::zeros(std::min((int) CODEBOOK_SIZE, residuals.rows), _dims, CV_64FC1);
+        for(int j = 0; j < m; j++) {
+            Mat block = residuals.colRange(_sub[j], _sub[j+1]).clone();
+            Mat dst = _codebook.colRange(_sub[j], _sub[j+1]);
+            impl::kmeans(block, _codebook.rows, _rng).copyTo(dst);
+        }
+    }
+
+    // Trains the quantizers and encodes the samples, which are written to
+    // the file if they're re-ranked from there.
+    void index(const PackedMat& src) {
+        _dims = src.cols();
+        train(src);
+        _ids.resize(_coarse.rows);
+        _codes.resize(_coarse.rows);
+        for(int sampleIdx = 0; sampleIdx < src.rows(); sampleIdx++)
+            append(src.unpack(sampleIdx, sampleIdx + 1).ptr<double>());
+        if(spills())
+            store(src, false);
+    }
+
+    // Returns the inverted list of a sample and writes the codes of its
+    // residual to code.
+    int encode(const double* p, uchar* code) const {
+        int list = impl::nearest_center(_coarse, p);
+        const double* c = _coarse.ptr<double>(list);
+        vector<double> r(_dims);
+        for(int j = 0; j < _dims; j++)
+            r[j] = p[j] - c[j];
+        for(int j = 0; j < numCodes(); j++) {
+            int len = _sub[j+1] - _sub[j];
+            double bestDist = DBL_MAX;
+            for(int centroid = 0; centroid < _codebook.rows; centroid++) {
+                double d = impl::sqeuclidean(_codebook.ptr<double>(centroid) + _sub[j], &r[_sub[j]], len);
+                if(d < bestDist) {
+                    bestDist = d;
+                    code[j] = static_cast<uchar>(centroid);
+                }
+            }
+        }
+        return list;
+    }
+
+    // Encodes a sample into its inverted list.
+    void append(const double* p) {
+        vector<uchar> code(numCodes());
+        int list = encode(p, &code[0]);
+        _ids[list].push_back(_size++);
+        _codes[list].insert(_codes[list].end(), code.begin(), code.end());
+    }
+
+    // Returns the header of the file for the samples of this index.
+    impl::SampleFileHeader header() const {
+        impl::SampleFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, IVFPQ_SAMPLES_MAGIC, sizeof(IVFPQ_SAMPLES_MAGIC));
+        header.byteOrder = impl::MODEL_BYTE_ORDER;
+        header.dims = _dims;
+        header.rows = _size;
+        header.checksum = _checksum;
+        return header;
+    }
+
+    // Returns the offset of a sample in the file.
+    std::streamoff offset(int sampleIdx) const {
+        return sizeof(impl::SampleFileHeader) + static_cast<std::streamoff>(sampleIdx) * _dims * sizeof(double);
+    }
+
+    // Writes the full-precision samples to the file, or appends the last
+    // samples of this index, and updates the header.
+    void store(const PackedMat& src, bool append) {
+        std::ios::openmode mode = std::ios::binary | std::ios::in | std::ios::out;
+        std::fstream file(_filename.c_str(), append ? mode : (mode | std::ios::trunc));
+        if(!append) {
+            _checksum = impl::FNV_OFFSET_BASIS;
+            impl::SampleFileHeader empty;
+            std::memset(&empty, 0, sizeof(empty));
+            file.write(reinterpret_cast<const char*>(&empty), sizeof(empty));
+        }
+        file.seekp(offset(_size - src.rows()));
+        for(int i = 0; i < src.rows(); i++) {
+            Mat row = src.unpack(i, i + 1);
+            file.write(row.ptr<char>(), _dims * sizeof(double));
+            _checksum = impl::fnv1a(row.ptr(), _dims * sizeof(double), _checksum);
+        }
+        impl::SampleFileHeader header = this->header();
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if(!file)
+            CV_Error(CV_StsError, "Could not write the samples to " + _filename + ".");
+    }
+
+    // Rewrites the file of the samples unless it holds the samples of src.
+    void restore(const PackedMat& src) {
+        _checksum = impl::FNV_OFFSET_BASIS;
+        for(int i = 0; i < src.rows(); i++)
+            _checksum = impl::fnv1a(src.unpack(i, i + 1).ptr(), _dims * sizeof(double), _checksum);
+        impl::SampleFileHeader expected = header();
+        impl::SampleFileHeader header;
+        std::ifstream file(_filename.c_str(), std::ios::binary | std::ios::ate);
+        std::streamoff size = file ? static_cast<std::streamoff>(file.tellg()) : -1;
+        file.seekg(0);
+        if(!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || (std::memcmp(&header, &expected, sizeof(header)) != 0)
+                || (size != offset(src.rows()))) {
+            file.close();
+            store(src, false);
+        }
+    }
+
+public:
+    // Number of centroids of each codebook.
+    enum { CODEBOOK_SIZE = 256 };
+    // Number of samples per centroid used to train the quantizers.
+    enum { TRAINING_SAMPLES = 64 };
+
+    // Initializes an empty index with nlist inverted lists (0 takes the
+    // square root of the number of samples) and m bytes per sample, which
+    // visits nprobe lists per query and re-ranks the best rerank candidates
+    // (0 doesn't re-rank). The full-precision samples for re-ranking are
+    // kept in the given file, or in the gallery if no filename is given.
+    IVFPQIndex(int nlist = 0, int m = 16, int nprobe = 8, int rerank = 0, const string& filename = string()) :
+        _nlist(nlist),
+        _m(m),
+        _nprobe(nprobe),
+        _rerank(rerank),
+        _filename(filename),
+        _dims(0),
+        _size(0),
+        _checksum(impl::FNV_OFFSET_BASIS),
+        _rng(12345) {
+        if((nlist < 0) || (m < 1) || (nprobe < 1) || (rerank < 0))
+            CV_Error(CV_StsBadArg, "IVFPQ needs m >= 1, nprobe >= 1 and no negative nlist or rerank.");
+    }
+
+    int type() const { return IVFPQ; }
+
+    void build(const Mat& data) {
+        reset();
+        if(data.empty())
+            return;
+        if(reranksInMemory()) {
+            _samples.assign(data);
+            index(_samples.get());
+        } else {
+            index(PackedMat(data, PackedMat::FLOAT64));
+        }
+    }
+
+    // Encodes the samples of a gallery, which is referenced for re-ranking
+    // in memory, see GalleryIndex::build.
+    void build(const PackedMat& gallery) {
+        reset();
+        if(reranksInMemory())
+            _samples.attach(gallery);
+        if(!gallery.empty())
+            index(gallery);
+    }
+
+    // Encodes a sample with the trained quantizers.
+    void add(const Mat& sample) {
+        if(_size == 0) {
+            if(_samples.attached())
+                build(_samples.get());
+            else
+                build(sample.reshape(1,1));
+            return;
+        }
+        Mat src = impl::query_row(sample, _dims);
+        append(src.ptr<double>());
+        if(reranksInMemory())
+            _samples.push_back(src);
+        else if(spills())
+            store(PackedMat(src, PackedMat::FLOAT64), true);
+    }
+
+    int size() const { return _size; }
+
+    int dims() const { return _dims; }
+
+    size_t memory() const {
+        size_t bytes = _samples.memory() + (_coarse.total() + _codebook.total())*sizeof(double);
+        for(int i = 0; i < _ids.size(); i++)
+            bytes += _ids[i].capacity()*sizeof(int) + _codes[i].capacity();
+        return bytes;
+    }
+
+    // The samples are re-ranked from the file.
+    bool spills() const {
+        return (_rerank > 0) && !_filename.empty();
+    }
+
+    // Moves the samples to a file of their own, named after the file of the
+    // original index.
+    void unshare() {
+        if(!spills())
+            return;
+        Mat src = samples();
+        for(int n = 1; ; n++) {
+            std::ostringstream filename;
+            filename << _filename << "." << n;
+            if(!std::ifstream(filename.str().c_str())) {
+                _filename = filename.str();
+                break;
+            }
+        }
+        store(PackedMat(src, PackedMat::FLOAT64), false);
+    }
+
+    // Reads the samples from the file.
+    Mat samples() const {
+        Mat dst(_size, _dims, CV_64FC1);
+        if(_size == 0)
+            return dst;
+        std::ifstream file(_filename.c_str(), std::ios::binary);
+        file.seekg(offset(0));
+        file.read(dst.ptr<char>(), dst.total() * sizeof(double));
+        if(!file)
+            CV_Error(CV_StsError, "Could not read the samples from " + _filename + ".");
+        return dst;
+    }
+
+    // Finds the (approximate) k nearest samples, see GalleryIndex::knn.
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        if((_size == 0) || (k <= 0))
+            return;
+        Mat q = impl::query_row(query, _dims);
+        const double* qp = q.ptr<double>();
+        // the lists with the nearest coarse centroids
+        vector<pair<double,int> > lists(_coarse.rows);
+        for(int l = 0; l < _coarse.rows; l++)
+            lists[l] = make_pair(impl::sqeuclidean(_coarse.ptr<double>(l), qp, _dims), l);
+        int nprobe = std::min(_nprobe, _coarse.rows);
+        std::partial_sort(lists.begin(), lists.begin() + nprobe, lists.end());
+        int m = numCodes();
+        int K = _codebook.rows;
+        impl::KnnHeap candidates((_rerank > 0) ? std::max(k, _rerank) : k);
+        vector<double> r(_dims);
+        vector<float> table(m * K);
+        for(int p = 0; p < nprobe; p++) {
+            int list = lists[p].second;
+            if(_ids[list].empty())
+                continue;
+            const double* c = _coarse.ptr<double>(list);
+            for(int j = 0; j < _dims; j++)
+                r[j] = qp[j] - c[j];
+            // distances between the subvectors of the residual and the codebooks
+            for(int centroid = 0; centroid < K; centroid++) {
+                const double* cb = _codebook.ptr<double>(centroid);
+                for(int j = 0; j < m; j++)
+                    table[j*K + centroid] = static_cast<float>(impl::sqeuclidean(cb + _sub[j], &r[_sub[j]], _sub[j+1] - _sub[j]));
+            }
+            const vector<int>& ids = _ids[list];
+            const uchar* code = &_codes[list][0];
+            for(int i = 0; i < ids.size(); i++, code += m) {
+                float dist = 0.0f;
+                for(int j = 0; j < m; j++)
+                    dist += table[j*K + code[j]];
+                candidates.push(dist, ids[i]);
+            }
+        }
+        if(_rerank <= 0) {
+            candidates.pop(indices, distances);
+            return;
+        }
+        vector<int> ids;
+        vector<double> approx;
+        candidates.pop(ids, approx);
+        impl::KnnHeap best(k);
+        if(reranksInMemory()) {
+            const PackedMat& samples = _samples.get();
+            for(int i = 0; i < ids.size(); i++)
+                best.push(samples.sqeuclidean(ids[i], qp, 0, _dims), ids[i]);
+        } else {
+            // read the candidates in the order of the file
+            std::sort(ids.begin(), ids.end());
+            std::ifstream file(_filename.c_str(), std::ios::binary);
+            vector<double> v(_dims);
+            for(int i = 0; i < ids.size(); i++) {
+                file.seekg(offset(ids[i]));
+                file.read(reinterpret_cast<char*>(&v[0]), _dims * sizeof(double));
+                if(!file)
+                    CV_Error(CV_StsError, "Could not read the samples from " + _filename + ".");
+                best.push(impl::sqeuclidean(&v[0], qp, _dims), ids[i]);
+            }
+        }
+        best.pop(indices, distances);
+    }
+
+    // Returns the number of inverted lists visited per query.
+    int nprobe() const { return _nprobe; }
+
+    // Sets the number of inverted lists visited per query.
+    void setNProbe(int nprobe) {
+        if(nprobe < 1)
+            CV_Error(CV_StsBadArg, "At least one list must be visited.");
+        _nprobe = nprobe;
+    }
+
+    // Returns the number of candidates re-ranked with their exact distances.
+    int rerank() const { return _rerank; }
+
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    void load(const FileNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.rows, data.cols)) {
+            build(data);
+            return;
+        }
+        if(reranksInMemory())
+            _samples.assign(data);
+        else if(spills())
+            restore(PackedMat(data, PackedMat::FLOAT64));
+    }
+
+    void load(const FileNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.rows(), gallery.cols())) {
+            build(gallery);
+            return;
+        }
+        if(reranksInMemory())
+            _samples.attach(gallery);
+        else if(spills())
+            restore(gallery);
+    }
+
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    void load(const ModelNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.rows, data.cols)) {
+            build(data);
+            return;
+        }
+        if(reranksInMemory())
+            _samples.assign(data);
+        else if(spills())
+            restore(PackedMat(data, PackedMat::FLOAT64));
+    }
+
+    void load(const ModelNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.rows(), gallery.cols())) {
+            build(gallery);
+            return;
+        }
+        if(reranksInMemory())
+            _samples.attach(gallery);
+        else if(spills())
+            restore(gallery);
+    }
+
+private:
+    // The formats share the serialization code.
+    // Writes the parameters, the quantizers and the codes. The samples are
+    // kept by the model (and in the file of the full-precision samples).
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        fs << "ivfpq_nlist" << _nlist;
+        fs << "ivfpq_m" << _m;
+        fs << "ivfpq_nprobe" << _nprobe;
+        fs << "ivfpq_rerank" << _rerank;
+        fs << "ivfpq_filename" << _filename;
+        fs << "ivfpq_coarse" << _coarse;
+        fs << "ivfpq_codebook" << _codebook;
+        fs << "ivfpq_sub" << Mat(_sub);
+        // per list: the number of samples followed by their ids
+        vector<int> ids;
+        Mat codes(0, numCodes(), CV_8UC1);
+        for(int l = 0; l < _ids.size(); l++) {
+            ids.push_back(static_cast<int>(_ids[l].size()));
+            ids.insert(ids.end(), _ids[l].begin(), _ids[l].end());
+            if(!_ids[l].empty())
+                codes.push_back(Mat(_ids[l].size(), numCodes(), CV_8UC1, (void*) &_codes[l][0]));
+        }
+        fs << "ivfpq_ids" << Mat(ids);
+        fs << "ivfpq_codes" << codes;
+    }
+
+    // Reads the quantizers and the codes of rows samples of dimension cols,
+    // the samples are attached by the caller. Returns false for models
+    // without codes, or with quantizers or codes which don't fit the
+    // samples, which get a newly built index.
+    template<typename _Node>
+    bool deserialize(const _Node& fn, int rows, int cols) {
+        if(fn["ivfpq_m"].empty())
+            return false;
+        int nlist, m, nprobe, rerank;
+        string filename;
+        fn["ivfpq_nlist"] >> nlist;
+        fn["ivfpq_m"] >> m;
+        fn["ivfpq_nprobe"] >> nprobe;
+        fn["ivfpq_rerank"] >> rerank;
+        fn["ivfpq_filename"] >> filename;
+        // corrupted parameters keep the ones of this index
+        if((nlist < 0) || (m < 1) || (nprobe < 1) || (rerank < 0))
+            return false;
+        _nlist = nlist;
+        _m = m;
+        _nprobe = nprobe;
+        _rerank = rerank;
+        _filename = filename;
+        Mat coarse, codebook, sub, ids, codes;
+        fn["ivfpq_coarse"] >> coarse;
+        fn["ivfpq_codebook"] >> codebook;
+        fn["ivfpq_sub"] >> sub;
+        fn["ivfpq_ids"] >> ids;
+        fn["ivfpq_codes"] >> codes;
+        if(coarse.empty() || (coarse.type() != CV_64FC1) || (coarse.cols != cols)
+                || codebook.empty() || (codebook.type() != CV_64FC1) || (codebook.cols != cols)
+                || (codebook.rows > CODEBOOK_SIZE) || (sub.type() != CV_32SC1)
+                || (sub.total() < 2) || (ids.type() != CV_32SC1))
+            return false;
+        // the subvectors split the components in order
+        Mat_<int> s = sub.reshape(1,1);
+        vector<int> bounds(s.begin(), s.end());
+        if((bounds.front() != 0) || (bounds.back() != cols))
+            return false;
+        for(int j = 1; j < bounds.size(); j++)
+            if(bounds[j] <= bounds[j-1])
+                return false;
+        int codeSize = static_cast<int>(bounds.size()) - 1;
+        if((codes.rows != rows) || (rows > 0 && ((codes.type() != CV_8UC1) || (codes.cols != codeSize))))
+            return false;
+        // each sample is in exactly one list, the codes name centroids
+        Mat_<int> list = ids.reshape(1,1);
+        vector<bool> listed(rows, false);
+        int pos = 0, total = 0;
+        for(int l = 0; l < coarse.rows; l++) {
+            if(pos >= list.cols)
+                return false;
+            int n = list(pos++);
+            if((n < 0) || (n > list.cols - pos))
+                return false;
+            for(int i = 0; i < n; i++, pos++) {
+                int id = list(pos);
+                if((id < 0) || (id >= rows) || listed[id])
+                    return false;
+                listed[id] = true;
+            }
+            total += n;
+        }
+        if((pos != list.cols) || (total != rows))
+            return false;
+        for(int i = 0; i < rows; i++) {
+            const uchar* code = codes.ptr<uchar>(i);
+            for(int j = 0; j < codeSize; j++)
+                if(code[j] >= codebook.rows)
+                    return false;
+        }
+        reset();
+        _dims = cols;
+        _coarse = coarse;
+        _codebook = codebook;
+        _sub = bounds;
+        _ids.assign(coarse.rows, vector<int>());
+        _codes.assign(coarse.rows, vector<uchar>());
+        const int* p = list[0];
+        const uchar* code = codes.ptr<uchar>();
+        for(int l = 0; l < coarse.rows; l++) {
+            int n = *p++;
+            _ids[l].assign(p, p + n);
+            _codes[l].assign(code, code + n * codeSize);
+            p += n;
+            code += n * codeSize;
+        }
+        _size = rows;
+        // continue with a different sequence
+        _rng = RNG(12345 + _size);
+        return true;
+    }
+};
+
+// A two-stage index. The samples are binarized into codes of a few machine
+// words by the signs of their projections on bits hyperplanes through the
+// gallery mean. A query first scans all codes with the Hamming distance
+// (XOR and POPCNT, a few instructions per sample), and the shortlist of the
+// samples with the smallest Hamming distances is re-ranked with the exact
+// Euclidean distance.
+//
+// The hyperplanes are random (RANDOM), or learned with Iterative
+// Quantization (ITQ, Gong and Lazebnik): the PCA of the samples rotated to
+// minimize the quantization error of the signs. ITQ learns at most one bit
+// per component, the remaining bits are random hyperplanes. The search is
+// approximate, a larger shortlist gives a higher recall.
+class HashingIndex : public GalleryIndex {
+
+private:
+    int _bits;
+    int _method;
+    int _shortlist;
+    // samples for the re-ranking
+    impl::IndexSamples _samples;
+    // mean (1 x dims) and hyperplanes (dims x bits) of the binarization
+    Mat _mean;
+    Mat _projection;
+    // codes of the samples, bits/64 words each
+    vector<uint64> _codes;
+    RNG _rng;
+
+    int words() const {
+        return _bits / 64;
+    }
+
+    // Learns the hyperplanes from (a random subset of) the samples.
+    void train(const PackedMat& src) {
+        Mat X = impl::sample_rows(src, TRAINING_SAMPLES, _rng).clone();
+        _mean = Mat::zeros(1, X.cols, CV_64FC1);
+        double* mean = _mean.ptr<double>();
+        for(int i = 0; i < X.rows; i++) {
+            const double* p = X.ptr<double>(i);
+            for(int j = 0; j < X.cols; j++)
+                mean[j] += p[j] / X.rows;
+        }
+        for(int i = 0; i < X.rows; i++) {
+            double* p = X.ptr<double>(i);
+            for(int j = 0; j < X.cols; j++)
+                p[j] -= mean[j];
+        }
+        _projection.create(X.cols, _bits, CV_64FC1);
+        int k = 0;
+        if(_method == ITQ) {
+            PCA pca(X, Mat(), CV_PCA_DATA_AS_ROW, std::min(_bits, std::min(X.cols, X.rows)));
+            k = pca.eigenvectors.rows;
+            Mat V;
+            gemm(X, pca.eigenvectors, 1.0, Mat(), 0.0, V, GEMM_2_T);
+            // start with a random rotation
+            Mat R(k, k, CV_64FC1), w, u, vt;
+            _rng.fill(R, RNG::NORMAL, 0.0, 1.0);
+            SVD::compute(R, w, u, vt);
+            R = u;
+            Mat VR, C;
+            Mat B(V.rows, k, CV_64FC1);
+            for(int iter = 0; iter < ITQ_ITERATIONS; iter++) {
+                // fix the rotation and binarize
+                gemm(V, R, 1.0, Mat(), 0.0, VR);
+                for(int i = 0; i < VR.rows; i++) {
+                    const double* p = VR.ptr<double>(i);
+                    double* b = B.ptr<double>(i);
+                    for(int j = 0; j < k; j++)
+                        b[j] = (p[j] >= 0.0) ? 1.0 : -1.0;
+                }
+                // fix the codes and rotate: B'V = USV' gives R = VU'
+                gemm(B, V, 1.0, Mat(), 0.0, C, GEMM_1_T);
+                SVD::compute(C, w, u, vt);
+                gemm(vt, u, 1.0, Mat(), 0.0, R, GEMM_1_T + GEMM_2_T);
+            }
+            Mat W, dst = _projection.colRange(0, k);
+            gemm(pca.eigenvectors, R, 1.0, Mat(), 0.0, W, GEMM_1_T);
+            W.copyTo(dst);
+        }
+        if(k < _bits) {
+            Mat random(X.cols, _bits - k, CV_64FC1);
+            _rng.fill(random, RNG::NORMAL, 0.0, 1.0);
+            Mat dst = _projection.colRange(k, _bits);
+            random.copyTo(dst);
+        }
+    }
+
+    // Appends the codes of the rows of src (CV_64FC1).
+    void encode(const Mat& src, vector<uint64>& codes) const {
+        Mat X = src.clone();
+        const double* mean = _mean.ptr<double>();
+        for(int i = 0; i < X.rows; i++) {
+            double* p = X.ptr<double>(i);
+            for(int j = 0; j < X.cols; j++)
+                p[j] -= mean[j];
+        }
+        Mat Y;
+        gemm(X, _projection, 1.0, Mat(), 0.0, Y);
+        for(int i = 0; i < Y.rows; i++) {
+            const double* p = Y.ptr<double>(i);
+            for(int w = 0; w < words(); w++) {
+                uint64 code = 0;
+                for(int b = 0; b < 64; b++)
+                    code |= static_cast<uint64>(p[w*64 + b] > 0.0) << b;
+                codes.push_back(code);
+            }
+        }
+    }
+
+    // Computes the codes of all samples, which are decoded block by block.
+    void encodeAll() {
+        const PackedMat& samples = _samples.get();
+        _codes.clear();
+        _codes.reserve(samples.rows() * words());
+        for(int i = 0; i < samples.rows(); i += ENCODE_BLOCK_SIZE)
+            encode(samples.unpack(i, std::min(i + (int) ENCODE_BLOCK_SIZE, samples.rows())), _codes);
+    }
+
+    // Clears the hyperplanes and the codes.
+    void reset() {
+        _mean.release();
+        _projection.release();
+        _codes.clear();
+        _rng = RNG(12345);
+    }
+
+public:
+    // Available binarizations.
+    enum {
+        RANDOM = 0,
+        ITQ = 1
+    };
+
+    // Number of samples used to learn the hyperplanes.
+    enum { TRAINING_SAMPLES = 20000 };
+    // Number of alternating steps of ITQ.
+    enum { ITQ_ITERATIONS = 50 };
+    // Number of samples encoded at once.
+    enum { ENCODE_BLOCK_SIZE = 4096 };
+
+    // Initializes an empty index with codes of bits bits (a multiple of 64)
+    // learned with the given method, which re-ranks the shortlist samples
+    // with the smallest Hamming distance.
+    HashingIndex(int bits = 128, int method = ITQ, int shortlist = 100) :
+        _bits(bits),
+        _method(method),
+        _shortlist(shortlist),
+        _rng(12345) {
+        if((bits <= 0) || (bits % 64 != 0))
+            CV_Error(CV_StsBadArg, "The number of bits must be a positive multiple of 64.");
+        if((method != RANDOM) && (method != ITQ))
+            CV_Error(CV_StsBadArg, "Unknown binarization.");
+        if(shortlist < 1)
+            CV_Error(CV_StsBadArg, "The shortlist must hold at least one sample.");
+    }
+
+    int type() const { return HASHING; }
+
+    void build(const Mat& data) {
+        reset();
+        _samples.assign(data);
+        if(data.empty())
+            return;
+        train(_samples.get());
+        encodeAll();
+    }
+
+    // Builds the codes of a referenced gallery, see GalleryIndex::build.
+    void build(const PackedMat& gallery) {
+        reset();
+        _samples.attach(gallery);
+        if(gallery.empty())
+            return;
+        train(gallery);
+        encodeAll();
+    }
+
+    // Encodes a sample with the learned hyperplanes.
+    void add(const Mat& sample) {
+        if(size() == 0) {
+            if(_samples.attached())
+                build(_samples.get());
+            else
+                build(sample.reshape(1,1));
+            return;
+        }
+        Mat src = impl::query_row(sample, dims());
+        _samples.push_back(src);
+        encode(src, _codes);
+    }
+
+    int size() const { return _samples.size(); }
+
+    int dims() const { return _samples.get().cols(); }
+
+    size_t memory() const {
+        return _samples.memory() + (_mean.total() + _projection.total())*sizeof(double)
+                + _codes.size()*sizeof(uint64);
+    }
+
+    // Finds the (approximate) k nearest samples, see GalleryIndex::knn.
+    void knn(const Mat& query, int k, vector<int>& indices, vector<double>& distances) const {
+        indices.clear();
+        distances.clear();
+        if((size() == 0) || (k <= 0))
+            return;
+        const PackedMat& samples = _samples.get();
+        Mat q = impl::query_row(query, samples.cols());
+        vector<uint64> code;
+        encode(q, code);
+        // Hamming distances and their histogram
+        int n = words();
+        vector<int> hamming(size());
+        vector<int> counts(_bits + 1, 0);
+        for(int sampleIdx = 0; sampleIdx < size(); sampleIdx++) {
+            hamming[sampleIdx] = impl::hamming(&_codes[sampleIdx * n], &code[0], n);
+            counts[hamming[sampleIdx]]++;
+        }
+        // the shortlist holds all samples closer than the threshold and the
+        // first samples at the threshold
+        int shortlist = std::min(size(), std::max(k, _shortlist));
+        int threshold = 0;
+        int total = counts[0];
+        while(total < shortlist)
+            total += counts[++threshold];
+        int remaining = shortlist - (total - counts[threshold]);
+        const double* qp = q.ptr<double>();
+        impl::KnnHeap best(k);
+        for(int sampleIdx = 0; sampleIdx < size(); sampleIdx++) {
+            int d = hamming[sampleIdx];
+            if((d > threshold) || ((d == threshold) && (remaining-- <= 0)))
+                continue;
+            best.push(samples.sqeuclidean(sampleIdx, qp, 0, samples.cols()), sampleIdx);
+        }
+        best.pop(indices, distances);
+    }
+
+    // Returns the number of samples re-ranked per query.
+    int shortlist() const { return _shortlist; }
+
+    // Sets the number of samples re-ranked per query.
+    void setShortlist(int shortlist) {
+        if(shortlist < 1)
+            CV_Error(CV_StsBadArg, "The shortlist must hold at least one sample.");
+        _shortlist = shortlist;
+    }
+
+    void save(FileStorage& fs) const { serialize(fs); }
+
+    void load(const FileNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.cols)) {
+            build(data);
+            return;
+        }
+        _samples.assign(data);
+        encodeAll();
+    }
+
+    void load(const FileNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.cols())) {
+            build(gallery);
+            return;
+        }
+        _samples.attach(gallery);
+        encodeAll();
+    }
+
+    void save(ModelWriter& fs) const { serialize(fs); }
+
+    void load(const ModelNode& fn, const Mat& data) {
+        if(!deserialize(fn, data.cols)) {
+            build(data);
+            return;
+        }
+        _samples.assign(data);
+        encodeAll();
+    }
+
+    void load(const ModelNode& fn, const PackedMat& gallery) {
+        if(!deserialize(fn, gallery.cols())) {
+            build(gallery);
+            return;
+        }
+        _samples.attach(gallery);
+        encodeAll();
+    }
+
+private:
+    // The formats share the serialization code.
+    // Writes the parameters and the hyperplanes, the codes are recomputed
+    // from the samples on loading.
+    template<typename _Storage>
+    void serialize(_Storage& fs) const {
+        fs << "hashing_bits" << _bits;
+        fs << "hashing_method" << _method;
+        fs << "hashing_shortlist" << _shortlist;
+        fs << "hashing_mean" << _mean;
+        fs << "hashing_projection" << _projection;
+    }
+
+    // Reads the hyperplanes for samples with dims components. Returns false
+    // for models without hyperplanes or with hyperplanes that don't fit the
+    // samples, which get a newly built index.
+    template<typename _Node>
+    bool deserialize(const _Node& fn, int dims) {
+        Mat mean, projection;
+        int bits = 0, method = -1, shortlist = 0;
+        fn["hashing_bits"] >> bits;
+        fn["hashing_method"] >> method;
+        fn["hashing_shortlist"] >> shortlist;
+        fn["hashing_mean"] >> mean;
+        fn["hashing_projection"] >> projection;
+        if((bits <= 0) || (bits % 64 != 0) || ((method != RANDOM) && (method != ITQ)) || (shortlist < 1))
+            return false;
+        if(projection.empty() || (projection.type() != CV_64FC1) || (projection.rows != dims) || (projection.cols != bits))
+            return false;
+        if((mean.type() != CV_64FC1) || (mean.rows != 1) || (mean.cols != dims))
+            return false;
+        _bits = bits;
+        _method = method;
+        _shortlist = shortlist;
+        _mean = mean;
+        _projection = projection;
+        return true;
+    }
+};
+
+// Creates an empty index of the given type, a linear index stores the
+// samples with the given precision (see PackedMat).
+inline Ptr<GalleryIndex> createGalleryIndex(int type, int precision = PackedMat::FLOAT64) {
+    switch(type) {
+    case GalleryIndex::LINEAR: return new LinearIndex(precision);
+    case GalleryIndex::KDTREE: return new KDTreeIndex();
+    case GalleryIndex::BALLTREE: return new BallTreeIndex();
+    case GalleryIndex::HNSW: return new HNSWIndex();
+    case GalleryIndex::IVFPQ: return new IVFPQIndex();
+    case GalleryIndex::HASHING: return new HashingIndex();
+    default:
+        CV_Error(CV_StsBadArg, "Unknown gallery index."); break;
+    }
+    return Ptr<GalleryIndex>();
+}
+
+// Copies an index over the rows of a gallery, which holds the samples of the
+// gallery of index (see GalleryIndex::build). The state of the index goes
+// through a binary model in memory, so the copy keeps the parameters and the
+// learned quantizers and references gallery instead of the original one. A
+// copy of an index which spills its samples writes them to a file of its
+// own (see GalleryIndex::unshare).
+inline Ptr<GalleryIndex> copyGalleryIndex(const GalleryIndex& index, int precision,
+        const PackedMat& gallery) {
+    std::stringstream buffer(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        ModelWriter fs(buffer, 0);
+        index.save(fs);
+    }
+    ModelReader fs(buffer);
+    Ptr<GalleryIndex> copy = createGalleryIndex(index.type(), precision);
+    copy->load(fs.root(), gallery);
+    copy->unshare();
+    return copy;
+}
+
+} // namespace cv
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __JOURNAL_HPP__
+#define __JOURNAL_HPP__
+
+#include "opencv2/opencv.hpp"
+#include "model.hpp"
+
+#include <fstream>
+#include <cstring>
+
+using namespace std;
+
+// A gallery journal is an append-only file of (label, template) records,
+// which persists the samples enrolled into a model since it was last saved:
+//
+//      header      32 bytes, see impl::JournalHeader
+//      records     int label followed by the template (type x cols)
+//
+// All templates of a journal have the same type and size, so the records
+// have a fixed size. Appending a record writes only the record, the base
+// model is rewritten by a compaction from time to time (see
+// Eigenfaces::compact), which folds the journal into the model and resets
+// the journal.
+//
+// The header stores the number of samples of the base model the journal
+// applies to. A journal is replayed on a model of this size, a model which
+// already holds the records (a compaction interrupted before resetting the
+// journal) skips them. A partial record at the end (an interrupted append)
+// is dropped when the journal is opened.
+namespace cv {
+
+// Magic number at the beginning of a gallery journal.
+const char JOURNAL_MAGIC[8] = { 'F', 'R', 'J', 'O', 'U', 'R', 'N', 'L' };
+// Current version of the journal format.
+const int JOURNAL_VERSION = 1;
+
+namespace impl {
+
+struct JournalHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;
+    // number of samples of the base model
+    int base;
+    // type and number of columns of the templates
+    int type;
+    int cols;
+    int reserved;
+};
+
+} // namespace impl
+
+// Appends the (label, template) pairs enrolled into a model to a journal.
+class GalleryJournal {
+
+private:
+    string _filename;
+    std::ofstream _file;
+    impl::JournalHeader _header;
+    int _size;
+
+    // Size of a record in bytes.
+    size_t recordSize() const {
+        return sizeof(int) + _header.cols * CV_ELEM_SIZE(_header.type);
+    }
+
+    // Writes a journal without records.
+    void create(int base) {
+        _file.close();
+        _header.base = base;
+        _size = 0;
+        _file.open(_filename.c_str(), std::ios::binary | std::ios::trunc);
+        _file.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+        _file.flush();
+        if(!_file)
+            CV_Error(CV_StsError, "Could not write the journal " + _filename + ".");
+    }
+
+public:
+    // Opens the journal in filename for templates of the given type and
+    // number of columns, or creates a journal for a base model with base
+    // samples if there is no such file.
+    GalleryJournal(const string& filename, int base, int type, int cols) :
+        _filename(filename),
+        _size(0) {
+        std::memset(&_header, 0, sizeof(_header));
+        std::memcpy(_header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        _header.version = JOURNAL_VERSION;
+        _header.byteOrder = impl::MODEL_BYTE_ORDER;
+        _header.type = type;
+        _header.cols = cols;
+        std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+        if(!file) {
+            create(base);
+            return;
+        }
+        int64 size = static_cast<int64>(file.tellg());
+        impl::JournalHeader header;
+        file.seekg(0);
+        if(!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                || (std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0))
+            CV_Error(CV_StsError, "Not a gallery journal.");
+        if(header.byteOrder != impl::MODEL_BYTE_ORDER)
+            CV_Error(CV_StsError, "The journal was written with another byte order.");
+        if((header.version < 1) || (header.version > JOURNAL_VERSION))
+            CV_Error(CV_StsError, "Unsupported version of the journal.");
+        if((header.type != type) || (header.cols != cols))
+            CV_Error(CV_StsBadArg, "The templates of the journal don't match the model.");
+        _header = header;
+        _size = static_cast<int>((size - sizeof(header)) / recordSize());
+        int64 complete = sizeof(header) + _size * static_cast<int64>(recordSize());
+        if(complete != size) {
+            // drop the partial record by rewriting the complete ones
+            vector<char> records(static_cast<size_t>(complete - sizeof(header)));
+            if(!records.empty())
+                file.read(&records[0], records.size());
+            file.close();
+            int numRecords = _size;
+            create(_header.base);
+            if(!records.empty())
+                _file.write(&records[0], records.size());
+            _file.flush();
+            _size = numRecords;
+            return;
+        }
+        _file.open(filename.c_str(), std::ios::binary | std::ios::app);
+        if(!_file)
+            CV_Error(CV_StsError, "Could not open the journal " + filename + ".");
+    }
+
+    // Returns the number of records.
+    int size() const { return _size; }
+
+    // Returns the number of samples of the base model.
+    int base() const { return _header.base; }
+
+    // Appends a record and flushes it to the file.
+    void append(int label, const Mat& templ) {
+        Mat t = templ.reshape(1,1);
+        if((t.type() != _header.type) || (t.cols != _header.cols))
+            CV_Error(CV_StsBadArg, "The template doesn't match the journal.");
+        if(!t.isContinuous())
+            t = t.clone();
+        _file.write(reinterpret_cast<const char*>(&label), sizeof(label));
+        _file.write(reinterpret_cast<const char*>(t.data), t.cols * t.elemSize());
+        _file.flush();
+        if(!_file)
+            CV_Error(CV_StsError, "Could not write the journal " + _filename + ".");
+        _size++;
+    }
+
+    // Reads the records for a model with size samples: all records if the
+    // model is the base model, none if the model already holds them.
+    void replay(int size, vector<int>& labels, Mat& templates) const {
+        labels.clear();
+        templates.release();
+        if(size == _header.base + _size)
+            return;
+        if(size != _header.base)
+            CV_Error(CV_StsBadArg, "The journal doesn't belong to the model.");
+        std::ifstream file(_filename.c_str(), std::ios::binary);
+        file.seekg(sizeof(_header));
+        templates.create(_size, _header.cols, _header.type);
+        labels.resize(_size);
+        for(int i = 0; i < _size; i++) {
+            file.read(reinterpret_cast<char*>(&labels[i]), sizeof(int));
+            file.read(templates.ptr<char>(i), templates.cols * templates.elemSize());
+        }
+        if(!file)
+            CV_Error(CV_StsError, "Could not read the journal " + _filename + ".");
+    }
+
+    // Drops all records, the journal applies to a base model with base
+    // samples.
+    void reset(int base) {
+        create(base);
+    }
+};
+
+} // namespace cv
+
+#endif
@@ -4,107 +4,668 @@
 #include "opencv2/opencv.hpp"
 #include "helper.hpp"
 
+#include <algorithm>
+
 using namespace cv;
 
 // TODO Add Uniform Patterns (or other histogram dimensionality reduction)
-// TODO Test & Quantization of Variance-based LBP.
 
 namespace cv {
 namespace impl {
 
+// Minimum number of pixels of a LBP image to compute it in parallel, smaller
+// images (like cropped faces) aren't worth the scheduling overhead.
+const int LBP_PARALLEL_MIN_PIXELS = 1 << 16;
+
+// Computes all rows of dst with body, which computes the rows of a given
+// range. Large images are split into horizontal bands, which are computed in
+// parallel with cv::parallel_for_ (cv::setNumThreads(1) disables this). A
+// band reads the source rows within the radius around it, but writes only
+// its own rows, so the result is the same as of the serial computation.
+inline void parallel_rows(const Mat& dst, const ParallelLoopBody& body) {
+    Range rows(0, dst.rows);
+    if(dst.total() >= static_cast<size_t>(LBP_PARALLEL_MIN_PIXELS))
+        parallel_for_(rows, body);
+    else
+        body(rows);
+}
+
+// Returns the narrowest type, which holds the 2^neighbors codes of elbp.
+inline int elbp_type(int neighbors) {
+    if(neighbors <= 8)
+        return CV_8UC1;
+    if(neighbors <= 16)
+        return CV_16UC1;
+    return CV_32SC1;
+}
+
+// Stores a row of codes into row i of dst (with a type of elbp_type).
+inline void store_codes(const int* codes, Mat& dst, int i) {
+    switch(dst.depth()) {
+    case CV_8U:  std::copy(codes, codes + dst.cols, dst.ptr<unsigned char>(i)); break;
+    case CV_16U: std::copy(codes, codes + dst.cols, dst.ptr<unsigned short>(i)); break;
+    default:     std::copy(codes, codes + dst.cols, dst.ptr<int>(i)); break;
+    }
+}
+
+// Computes the rows of the Original Local Binary Patterns.
+template <typename _Tp>
+class OLBPInvoker : public ParallelLoopBody {
+
+private:
+    const Mat& _src;
+    Mat& _dst;
+
+public:
+    OLBPInvoker(const Mat& src, Mat& dst) : _src(src), _dst(dst) {}
+
+    void operator()(const Range& range) const {
+        for(int i=range.start+1;i<range.end+1;i++) {
+            const _Tp* above = _src.ptr<_Tp>(i-1);
+            const _Tp* row = _src.ptr<_Tp>(i);
+            const _Tp* below = _src.ptr<_Tp>(i+1);
+            unsigned char* codes = _dst.ptr<unsigned char>(i-1);
+            for(int j=1;j<_src.cols-1;j++) {
+                _Tp center = row[j];
+                unsigned char code = 0;
+                code |= (above[j-1] >= center) << 7;
+                code |= (above[j] >= center) << 6;
+                code |= (above[j+1] >= center) << 5;
+                code |= (row[j+1] >= center) << 4;
+                code |= (below[j+1] >= center) << 3;
+                code |= (below[j] >= center) << 2;
+                code |= (below[j-1] >= center) << 1;
+                code |= (row[j-1] >= center) << 0;
+                codes[j-1] = code;
+            }
+        }
+    }
+};
+
 template <typename _Tp>
 inline void olbp(const Mat& src, Mat& dst) {
-    dst = Mat::zeros(src.rows-2, src.cols-2, CV_8UC1);
-    for(int i=1;i<src.rows-1;i++) {
-        for(int j=1;j<src.cols-1;j++) {
-            _Tp center = src.at<_Tp>(i,j);
-            unsigned char code = 0;
-            code |= (src.at<_Tp>(i-1,j-1) >= center) << 7;
-            code |= (src.at<_Tp>(i-1,j) >= center) << 6;
-            code |= (src.at<_Tp>(i-1,j+1) >= center) << 5;
-            code |= (src.at<_Tp>(i,j+1) >= center) << 4;
-            code |= (src.at<_Tp>(i+1,j+1) >= center) << 3;
-            code |= (src.at<_Tp>(i+1,j) >= center) << 2;
-            code |= (src.at<_Tp>(i+1,j-1) >= center) << 1;
-            code |= (src.at<_Tp>(i,j-1) >= center) << 0;
-            dst.at<unsigned char>(i-1,j-1) = code;
+    dst = Mat::zeros(std::max(src.rows-2, 0), std::max(src.cols-2, 0), CV_8UC1);
+    parallel_rows(dst, OLBPInvoker<_Tp>(src, dst));
+}
+
+// The sample offsets and bilinear interpolation weights of the neighbors of a
+// circular (radius, neighbors) operator. Neighbor n is interpolated from the
+// pixels (fy,fx), (fy,cx), (cy,fx) and (cy,cx) relative to the center with
+// the weights w1..w4. The neighbors of varlbp start at another angle than
+// those of elbp.
+struct LBPSampling {
+    vector<int> fx, fy, cx, cy;
+    vector<float> w1, w2, w3, w4;
+
+    LBPSampling(int radius, int neighbors, bool variance=false) :
+        fx(neighbors), fy(neighbors), cx(neighbors), cy(neighbors),
+        w1(neighbors), w2(neighbors), w3(neighbors), w4(neighbors) {
+        for(int n=0; n<neighbors; n++) {
+            // sample points
+            float x, y;
+            if(variance) {
+                x = static_cast<float>(radius) * cos(2.0*CV_PI*n/static_cast<float>(neighbors));
+                y = static_cast<float>(radius) * -sin(2.0*CV_PI*n/static_cast<float>(neighbors));
+            } else {
+                x = static_cast<float>(-radius) * sin(2.0*CV_PI*n/static_cast<float>(neighbors));
+                y = static_cast<float>(radius) * cos(2.0*CV_PI*n/static_cast<float>(neighbors));
+            }
+            // relative indices
+            fx[n] = static_cast<int>(floor(x));
+            fy[n] = static_cast<int>(floor(y));
+            cx[n] = static_cast<int>(ceil(x));
+            cy[n] = static_cast<int>(ceil(y));
+            // fractional part
+            float ty = y - fy[n];
+            float tx = x - fx[n];
+            // set interpolation weights
+            w1[n] = (1 - tx) * (1 - ty);
+            w2[n] =      tx  * (1 - ty);
+            w3[n] = (1 - tx) *      ty;
+            w4[n] =      tx  *      ty;
         }
     }
+};
+
+// The sample offsets and interpolation weights of a single neighbor, see
+// LBPSampling.
+struct LBPTap {
+    int fx, fy, cx, cy;
+    float w1, w2, w3, w4;
+};
+
+inline vector<LBPTap> lbp_taps(int radius, int neighbors, bool variance=false) {
+    LBPSampling sampling(radius, neighbors, variance);
+    vector<LBPTap> taps(neighbors);
+    for(int n=0; n<neighbors; n++) {
+        LBPTap tap = { sampling.fx[n], sampling.fy[n], sampling.cx[n], sampling.cy[n],
+                       sampling.w1[n], sampling.w2[n], sampling.w3[n], sampling.w4[n] };
+        taps[n] = tap;
+    }
+    return taps;
 }
 
+// The taps of the common (radius, neighbors) pairs as constant tables, so
+// the offsets and weights of the unrolled neighbor loops are folded into the
+// kernels. The values are exactly those computed by LBPSampling. The primary
+// template has no table, the taps are computed at runtime then.
+template <int _Radius, int _Neighbors, bool _Variance>
+struct LBPStencil {
+    static const LBPTap* taps() { return 0; }
+};
+
+template <> struct LBPStencil<1, 8, false> {
+    static const LBPTap* taps() {
+        static const LBPTap t[8] = {
+            { 0, 1, 0, 1, 1.0f, -0.0f, 0.0f, -0.0f },
+            { -1, 0, 0, 1, 0.207106784f, 0.0857864469f, 0.49999997f, 0.207106784f },
+            { -1, 0, -1, 1, 1.0f, 0.0f, 6.12323426e-17f, 0.0f },
+            { -1, -1, 0, 0, 0.49999997f, 0.207106784f, 0.207106784f, 0.0857864469f },
+            { -1, -1, 0, -1, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, -1, 1, 0, 0.207106784f, 0.49999997f, 0.0857864469f, 0.207106784f },
+            { 1, -1, 1, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { 0, 0, 1, 1, 0.0857864469f, 0.207106784f, 0.207106784f, 0.49999997f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<2, 8, false> {
+    static const LBPTap* taps() {
+        static const LBPTap t[8] = {
+            { 0, 2, 0, 2, 1.0f, -0.0f, 0.0f, -0.0f },
+            { -2, 1, -1, 2, 0.242640689f, 0.343145788f, 0.171572849f, 0.242640689f },
+            { -2, 0, -2, 1, 1.0f, 0.0f, 1.22464685e-16f, 0.0f },
+            { -2, -2, -1, -1, 0.171572849f, 0.242640689f, 0.242640689f, 0.343145788f },
+            { -1, -2, 0, -2, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 1, -2, 2, -1, 0.242640689f, 0.171572849f, 0.343145788f, 0.242640689f },
+            { 2, -1, 2, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { 1, 1, 2, 2, 0.343145788f, 0.242640689f, 0.242640689f, 0.171572849f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<2, 16, false> {
+    static const LBPTap* taps() {
+        static const LBPTap t[16] = {
+            { 0, 2, 0, 2, 1.0f, -0.0f, 0.0f, -0.0f },
+            { -1, 1, 0, 2, 0.116520211f, 0.0357207842f, 0.648846626f, 0.198912367f },
+            { -2, 1, -1, 2, 0.242640689f, 0.343145788f, 0.171572849f, 0.242640689f },
+            { -2, 0, -1, 1, 0.198912367f, 0.0357207842f, 0.648846626f, 0.116520211f },
+            { -2, 0, -2, 1, 1.0f, 0.0f, 1.22464685e-16f, 0.0f },
+            { -2, -1, -1, 0, 0.648846626f, 0.116520211f, 0.198912367f, 0.0357207842f },
+            { -2, -2, -1, -1, 0.171572849f, 0.242640689f, 0.242640689f, 0.343145788f },
+            { -1, -2, 0, -1, 0.648846626f, 0.198912367f, 0.116520211f, 0.0357207842f },
+            { -1, -2, 0, -2, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, -2, 1, -1, 0.198912367f, 0.648846626f, 0.0357207842f, 0.116520211f },
+            { 1, -2, 2, -1, 0.242640689f, 0.171572849f, 0.343145788f, 0.242640689f },
+            { 1, -1, 2, 0, 0.116520211f, 0.648846626f, 0.0357207842f, 0.198912367f },
+            { 2, -1, 2, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { 1, 0, 2, 1, 0.0357207842f, 0.198912367f, 0.116520211f, 0.648846626f },
+            { 1, 1, 2, 2, 0.343145788f, 0.242640689f, 0.242640689f, 0.171572849f },
+            { 0, 1, 1, 2, 0.0357207842f, 0.116520211f, 0.198912367f, 0.648846626f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<3, 24, false> {
+    static const LBPTap* taps() {
+        static const LBPTap t[24] = {
+            { 0, 3, 0, 3, 1.0f, -0.0f, 0.0f, -0.0f },
+            { -1, 2, 0, 3, 0.079371348f, 0.0228510983f, 0.697085798f, 0.200691774f },
+            { -2, 2, -1, 3, 0.200961947f, 0.200961947f, 0.299038053f, 0.299038053f },
+            { -3, 2, -2, 3, 0.106601648f, 0.772078097f, 0.0147186024f, 0.106601648f },
+            { -3, 1, -2, 2, 0.299038053f, 0.200961947f, 0.299038053f, 0.200961947f },
+            { -3, 0, -2, 1, 0.200691774f, 0.0228510983f, 0.697085798f, 0.079371348f },
+            { -3, 0, -3, 1, 1.0f, 0.0f, 1.83697015e-16f, 0.0f },
+            { -3, -1, -2, 0, 0.697085798f, 0.079371348f, 0.200691774f, 0.0228510983f },
+            { -3, -2, -2, -1, 0.299038053f, 0.200961947f, 0.299038053f, 0.200961947f },
+            { -3, -3, -2, -2, 0.0147186024f, 0.106601648f, 0.106601648f, 0.772078097f },
+            { -2, -3, -1, -2, 0.299038053f, 0.299038053f, 0.200961947f, 0.200961947f },
+            { -1, -3, 0, -2, 0.697085798f, 0.200691774f, 0.079371348f, 0.0228510983f },
+            { -1, -3, 0, -3, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, -3, 1, -2, 0.200691774f, 0.697085798f, 0.0228510983f, 0.079371348f },
+            { 1, -3, 2, -2, 0.299038053f, 0.299038053f, 0.200961947f, 0.200961947f },
+            { 2, -3, 3, -2, 0.106601648f, 0.0147186024f, 0.772078097f, 0.106601648f },
+            { 2, -2, 3, -1, 0.200961947f, 0.299038053f, 0.200961947f, 0.299038053f },
+            { 2, -1, 3, 0, 0.079371348f, 0.697085798f, 0.0228510983f, 0.200691774f },
+            { 3, -1, 3, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { 2, 0, 3, 1, 0.0228510983f, 0.200691774f, 0.079371348f, 0.697085798f },
+            { 2, 1, 3, 2, 0.200961947f, 0.299038053f, 0.200961947f, 0.299038053f },
+            { 2, 2, 3, 3, 0.772078097f, 0.106601648f, 0.106601648f, 0.0147186024f },
+            { 1, 2, 2, 3, 0.200961947f, 0.200961947f, 0.299038053f, 0.299038053f },
+            { 0, 2, 1, 3, 0.0228510983f, 0.079371348f, 0.200691774f, 0.697085798f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<1, 8, true> {
+    static const LBPTap* taps() {
+        static const LBPTap t[8] = {
+            { 1, 0, 1, 0, 1.0f, 0.0f, -0.0f, -0.0f },
+            { 0, -1, 1, 0, 0.207106784f, 0.49999997f, 0.0857864469f, 0.207106784f },
+            { 0, -1, 1, -1, 1.0f, 6.12323426e-17f, 0.0f, 0.0f },
+            { -1, -1, 0, 0, 0.49999997f, 0.207106784f, 0.207106784f, 0.0857864469f },
+            { -1, -1, -1, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { -1, 0, 0, 1, 0.207106784f, 0.0857864469f, 0.49999997f, 0.207106784f },
+            { -1, 1, 0, 1, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, 0, 1, 1, 0.0857864469f, 0.207106784f, 0.207106784f, 0.49999997f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<2, 8, true> {
+    static const LBPTap* taps() {
+        static const LBPTap t[8] = {
+            { 2, 0, 2, 0, 1.0f, 0.0f, -0.0f, -0.0f },
+            { 1, -2, 2, -1, 0.242640689f, 0.171572849f, 0.343145788f, 0.242640689f },
+            { 0, -2, 1, -2, 1.0f, 1.22464685e-16f, 0.0f, 0.0f },
+            { -2, -2, -1, -1, 0.171572849f, 0.242640689f, 0.242640689f, 0.343145788f },
+            { -2, -1, -2, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { -2, 1, -1, 2, 0.242640689f, 0.343145788f, 0.171572849f, 0.242640689f },
+            { -1, 2, 0, 2, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 1, 1, 2, 2, 0.343145788f, 0.242640689f, 0.242640689f, 0.171572849f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<2, 16, true> {
+    static const LBPTap* taps() {
+        static const LBPTap t[16] = {
+            { 2, 0, 2, 0, 1.0f, 0.0f, -0.0f, -0.0f },
+            { 1, -1, 2, 0, 0.116520211f, 0.648846626f, 0.0357207842f, 0.198912367f },
+            { 1, -2, 2, -1, 0.242640689f, 0.171572849f, 0.343145788f, 0.242640689f },
+            { 0, -2, 1, -1, 0.198912367f, 0.648846626f, 0.0357207842f, 0.116520211f },
+            { 0, -2, 1, -2, 1.0f, 1.22464685e-16f, 0.0f, 0.0f },
+            { -1, -2, 0, -1, 0.648846626f, 0.198912367f, 0.116520211f, 0.0357207842f },
+            { -2, -2, -1, -1, 0.171572849f, 0.242640689f, 0.242640689f, 0.343145788f },
+            { -2, -1, -1, 0, 0.648846626f, 0.116520211f, 0.198912367f, 0.0357207842f },
+            { -2, -1, -2, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { -2, 0, -1, 1, 0.198912367f, 0.0357207842f, 0.648846626f, 0.116520211f },
+            { -2, 1, -1, 2, 0.242640689f, 0.343145788f, 0.171572849f, 0.242640689f },
+            { -1, 1, 0, 2, 0.116520211f, 0.0357207842f, 0.648846626f, 0.198912367f },
+            { -1, 2, 0, 2, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, 1, 1, 2, 0.0357207842f, 0.116520211f, 0.198912367f, 0.648846626f },
+            { 1, 1, 2, 2, 0.343145788f, 0.242640689f, 0.242640689f, 0.171572849f },
+            { 1, 0, 2, 1, 0.0357207842f, 0.198912367f, 0.116520211f, 0.648846626f }
+        };
+        return t;
+    }
+};
+
+template <> struct LBPStencil<3, 24, true> {
+    static const LBPTap* taps() {
+        static const LBPTap t[24] = {
+            { 3, 0, 3, 0, 1.0f, 0.0f, -0.0f, -0.0f },
+            { 2, -1, 3, 0, 0.079371348f, 0.697085798f, 0.0228510983f, 0.200691774f },
+            { 2, -2, 3, -1, 0.200961947f, 0.299038053f, 0.200961947f, 0.299038053f },
+            { 2, -3, 3, -2, 0.106601648f, 0.0147186024f, 0.772078097f, 0.106601648f },
+            { 1, -3, 2, -2, 0.299038053f, 0.299038053f, 0.200961947f, 0.200961947f },
+            { 0, -3, 1, -2, 0.200691774f, 0.697085798f, 0.0228510983f, 0.079371348f },
+            { 0, -3, 1, -3, 1.0f, 1.83697015e-16f, 0.0f, 0.0f },
+            { -1, -3, 0, -2, 0.697085798f, 0.200691774f, 0.079371348f, 0.0228510983f },
+            { -2, -3, -1, -2, 0.299038053f, 0.299038053f, 0.200961947f, 0.200961947f },
+            { -3, -3, -2, -2, 0.0147186024f, 0.106601648f, 0.106601648f, 0.772078097f },
+            { -3, -2, -2, -1, 0.299038053f, 0.200961947f, 0.299038053f, 0.200961947f },
+            { -3, -1, -2, 0, 0.697085798f, 0.079371348f, 0.200691774f, 0.0228510983f },
+            { -3, -1, -3, 0, 0.0f, 0.0f, 1.0f, 0.0f },
+            { -3, 0, -2, 1, 0.200691774f, 0.0228510983f, 0.697085798f, 0.079371348f },
+            { -3, 1, -2, 2, 0.299038053f, 0.200961947f, 0.299038053f, 0.200961947f },
+            { -3, 2, -2, 3, 0.106601648f, 0.772078097f, 0.0147186024f, 0.106601648f },
+            { -2, 2, -1, 3, 0.200961947f, 0.200961947f, 0.299038053f, 0.299038053f },
+            { -1, 2, 0, 3, 0.079371348f, 0.0228510983f, 0.697085798f, 0.200691774f },
+            { -1, 3, 0, 3, 0.0f, 1.0f, 0.0f, 0.0f },
+            { 0, 2, 1, 3, 0.0228510983f, 0.079371348f, 0.200691774f, 0.697085798f },
+            { 1, 2, 2, 3, 0.200961947f, 0.200961947f, 0.299038053f, 0.299038053f },
+            { 2, 2, 3, 3, 0.772078097f, 0.106601648f, 0.106601648f, 0.0147186024f },
+            { 2, 1, 3, 2, 0.200961947f, 0.299038053f, 0.200961947f, 0.299038053f },
+            { 2, 0, 3, 1, 0.0228510983f, 0.200691774f, 0.079371348f, 0.697085798f }
+        };
+        return t;
+    }
+};
+
+// Computes the rows of the Extended Local Binary Patterns. All neighbors of
+// a pixel are sampled at once and the code is built in a register, then
+// stored as _Ot (see elbp_type). _Neighbors > 0 fixes the number of neighbors
+// at compile time, so the neighbor loop can be unrolled. _Radius > 0 also
+// takes the taps from the constant LBPStencil table.
+template <typename _Tp, typename _Ot, int _Radius, int _Neighbors>
+class ELBPInvoker : public ParallelLoopBody {
+
+private:
+    const Mat& _src;
+    Mat& _dst;
+    int _radius;
+    int _neighbors;
+    vector<LBPTap> _taps;
+
+public:
+    ELBPInvoker(const Mat& src, Mat& dst, int radius, int neighbors) :
+        _src(src),
+        _dst(dst),
+        _radius((_Radius > 0) ? _Radius : radius),
+        _neighbors((_Neighbors > 0) ? _Neighbors : neighbors),
+        _taps((_Radius > 0) ? vector<LBPTap>() : lbp_taps(radius, _neighbors)) {}
+
+    void operator()(const Range& range) const {
+        const int radius = (_Radius > 0) ? _Radius : _radius;
+        const int count = (_Neighbors > 0) ? _Neighbors : _neighbors;
+        const LBPTap* taps = (_Radius > 0) ? LBPStencil<_Radius, _Neighbors, false>::taps() : &_taps[0];
+        // rows sampled by each neighbor
+        vector<const _Tp*> top(count), bottom(count);
+        for(int i=range.start+radius; i < range.end+radius; i++) {
+            for(int n=0; n<count; n++) {
+                top[n] = _src.ptr<_Tp>(i+taps[n].fy);
+                bottom[n] = _src.ptr<_Tp>(i+taps[n].cy);
+            }
+            const _Tp* center = _src.ptr<_Tp>(i);
+            _Ot* codes = _dst.ptr<_Ot>(i-radius);
+            for(int j=radius; j < _src.cols-radius; j++) {
+                int code = 0;
+                for(int n=0; n<count; n++) {
+                    const LBPTap& s = taps[n];
+                    // calculate interpolated value
+                    float t = s.w1*top[n][j+s.fx] + s.w2*top[n][j+s.cx] + s.w3*bottom[n][j+s.fx] + s.w4*bottom[n][j+s.cx];
+                    // floating point precision, so check some machine-dependent epsilon
+                    code += ((t > center[j]) || (std::abs(t-center[j]) < std::numeric_limits<float>::epsilon())) << n;
+                }
+                codes[j-radius] = static_cast<_Ot>(code);
+            }
+        }
+    }
+};
+
+template <typename _Tp, int _Radius, int _Neighbors>
+inline void elbp_sweep(const Mat& src, Mat& dst, int radius, int neighbors) {
+    int type = elbp_type(neighbors);
+    dst = Mat::zeros(std::max(src.rows-2*radius, 0), std::max(src.cols-2*radius, 0), type);
+    if(type == CV_8UC1)
+        parallel_rows(dst, ELBPInvoker<_Tp, unsigned char, _Radius, _Neighbors>(src, dst, radius, neighbors));
+    else if(type == CV_16UC1)
+        parallel_rows(dst, ELBPInvoker<_Tp, unsigned short, _Radius, _Neighbors>(src, dst, radius, neighbors));
+    else
+        parallel_rows(dst, ELBPInvoker<_Tp, int, _Radius, _Neighbors>(src, dst, radius, neighbors));
+}
+
+// Calculates the Extended Local Binary Patterns with a kernel specialized
+// for the common (radius, neighbors) pairs (1,8), (2,8), (2,16) and (3,24),
+// whose offsets and weights are compile-time constants. Other radii with 8,
+// 16 or 24 neighbors only have the neighbor loop unrolled, all others use the
+// generic kernel.
 template <typename _Tp>
 inline void elbp(const Mat& src, Mat& dst, int radius, int neighbors) {
-    dst = Mat::zeros(src.rows-2*radius, src.cols-2*radius, CV_32SC1);
-    for(int n=0; n<neighbors; n++) {
-        // sample points
-        float x = static_cast<float>(-radius) * sin(2.0*CV_PI*n/static_cast<float>(neighbors));
-        float y = static_cast<float>(radius) * cos(2.0*CV_PI*n/static_cast<float>(neighbors));
-        // relative indices
-        int fx = static_cast<int>(floor(x));
-        int fy = static_cast<int>(floor(y));
-        int cx = static_cast<int>(ceil(x));
-        int cy = static_cast<int>(ceil(y));
-        // fractional part
-        float ty = y - fy;
-        float tx = x - fx;
-        // set interpolation weights
-        float w1 = (1 - tx) * (1 - ty);
-        float w2 =      tx  * (1 - ty);
-        float w3 = (1 - tx) *      ty;
-        float w4 =      tx  *      ty;
-        // iterate through your data
-        for(int i=radius; i < src.rows-radius;i++) {
-            for(int j=radius;j < src.cols-radius;j++) {
-                // calculate interpolated value
-                float t = w1*src.at<_Tp>(i+fy,j+fx) + w2*src.at<_Tp>(i+fy,j+cx) + w3*src.at<_Tp>(i+cy,j+fx) + w4*src.at<_Tp>(i+cy,j+cx);
-                // floating point precision, so check some machine-dependent epsilon
-                dst.at<int>(i-radius,j-radius) += ((t > src.at<_Tp>(i,j)) || (std::abs(t-src.at<_Tp>(i,j)) < std::numeric_limits<float>::epsilon())) << n;
+    if(radius == 1 && neighbors == 8)
+        elbp_sweep<_Tp, 1, 8>(src, dst, 1, 8);
+    else if(radius == 2 && neighbors == 8)
+        elbp_sweep<_Tp, 2, 8>(src, dst, 2, 8);
+    else if(radius == 2 && neighbors == 16)
+        elbp_sweep<_Tp, 2, 16>(src, dst, 2, 16);
+    else if(radius == 3 && neighbors == 24)
+        elbp_sweep<_Tp, 3, 24>(src, dst, 3, 24);
+    else switch(neighbors) {
+    case 8:  elbp_sweep<_Tp, 0, 8>(src, dst, radius, 8); break;
+    case 16: elbp_sweep<_Tp, 0, 16>(src, dst, radius, 16); break;
+    case 24: elbp_sweep<_Tp, 0, 24>(src, dst, radius, 24); break;
+    default: elbp_sweep<_Tp, 0, 0>(src, dst, radius, neighbors); break;
+    }
+}
+
+
+// Calculates the Extended Local Binary Patterns of several (radius, neighbors)
+// scales in a single sweep over src. Each row is sampled by the neighbors of
+// all scales before moving on, so the source rows around it are loaded once
+// for all scales. The samples are interpolated exactly like in elbp.
+template <typename _Tp>
+inline void multiscale_elbp(const Mat& src, vector<Mat>& dst, const vector<int>& radii, const vector<int>& neighbors) {
+    int border = *std::max_element(radii.begin(), radii.end());
+    int rows = std::max(src.rows-2*border, 0);
+    int cols = std::max(src.cols-2*border, 0);
+    // sample offsets and interpolation weights of all neighbors of all scales
+    vector<int> scale, bit, fx, fy, cx, cy;
+    vector<float> w1, w2, w3, w4;
+    dst.resize(radii.size());
+    for(int s = 0; s < radii.size(); s++) {
+        dst[s] = Mat::zeros(rows, cols, elbp_type(neighbors[s]));
+        LBPSampling sampling(radii[s], neighbors[s]);
+        scale.insert(scale.end(), neighbors[s], s);
+        for(int n = 0; n < neighbors[s]; n++)
+            bit.push_back(n);
+        fx.insert(fx.end(), sampling.fx.begin(), sampling.fx.end());
+        fy.insert(fy.end(), sampling.fy.begin(), sampling.fy.end());
+        cx.insert(cx.end(), sampling.cx.begin(), sampling.cx.end());
+        cy.insert(cy.end(), sampling.cy.begin(), sampling.cy.end());
+        w1.insert(w1.end(), sampling.w1.begin(), sampling.w1.end());
+        w2.insert(w2.end(), sampling.w2.begin(), sampling.w2.end());
+        w3.insert(w3.end(), sampling.w3.begin(), sampling.w3.end());
+        w4.insert(w4.end(), sampling.w4.begin(), sampling.w4.end());
+    }
+    // codes of the current row for all scales
+    vector<int> row(radii.size()*cols);
+    for(int i = border; i < src.rows-border; i++) {
+        const _Tp* center = src.ptr<_Tp>(i);
+        std::fill(row.begin(), row.end(), 0);
+        for(int k = 0; k < scale.size(); k++) {
+            const _Tp* top = src.ptr<_Tp>(i+fy[k]);
+            const _Tp* bottom = src.ptr<_Tp>(i+cy[k]);
+            int* codes = &row[scale[k]*cols];
+            for(int j = border; j < src.cols-border; j++) {
+                float t = w1[k]*top[j+fx[k]] + w2[k]*top[j+cx[k]] + w3[k]*bottom[j+fx[k]] + w4[k]*bottom[j+cx[k]];
+                codes[j-border] += ((t > center[j]) || (std::abs(t-center[j]) < std::numeric_limits<float>::epsilon())) << bit[k];
             }
         }
+        for(int s = 0; s < radii.size(); s++)
+            store_codes(&row[s*cols], dst[s], i-border);
     }
 }
 
 
+// Computes the rows of the variance of the neighbors of each pixel with
+// Welford's online algorithm. The running mean and M2 of a pixel are kept in
+// registers while all neighbors are visited, so a single pass without scratch
+// images is needed. _Radius and _Neighbors fix the taps at compile time, see
+// ELBPInvoker.
+template <typename _Tp, int _Radius, int _Neighbors>
+class VarLBPInvoker : public ParallelLoopBody {
+
+private:
+    const Mat& _src;
+    Mat& _dst;
+    int _radius;
+    int _neighbors;
+    vector<LBPTap> _taps;
+
+public:
+    VarLBPInvoker(const Mat& src, Mat& dst, int radius, int neighbors) :
+        _src(src),
+        _dst(dst),
+        _radius((_Radius > 0) ? _Radius : radius),
+        _neighbors((_Neighbors > 0) ? _Neighbors : neighbors),
+        _taps((_Radius > 0) ? vector<LBPTap>() : lbp_taps(radius, _neighbors, true)) {}
+
+    void operator()(const Range& range) const {
+        const int radius = (_Radius > 0) ? _Radius : _radius;
+        const int count = (_Neighbors > 0) ? _Neighbors : _neighbors;
+        const LBPTap* taps = (_Radius > 0) ? LBPStencil<_Radius, _Neighbors, true>::taps() : &_taps[0];
+        // rows sampled by each neighbor
+        vector<const _Tp*> top(count), bottom(count);
+        for(int i=range.start+radius; i < range.end+radius; i++) {
+            for(int n=0; n<count; n++) {
+                top[n] = _src.ptr<_Tp>(i+taps[n].fy);
+                bottom[n] = _src.ptr<_Tp>(i+taps[n].cy);
+            }
+            float* result = _dst.ptr<float>(i-radius);
+            for(int j=radius;j < _src.cols-radius;j++) {
+                float mean = 0.0f;
+                float m2 = 0.0f;
+                for(int n=0; n<count; n++) {
+                    const LBPTap& s = taps[n];
+                    float t = s.w1*top[n][j+s.fx] + s.w2*top[n][j+s.cx] + s.w3*bottom[n][j+s.fx] + s.w4*bottom[n][j+s.cx];
+                    float delta = t - mean;
+                    mean = mean + delta / (1.0*(n+1));
+                    m2 = m2 + delta * (t - mean);
+                }
+                result[j-radius] = m2 / (1.0*(count-1));
+            }
+        }
+    }
+};
+
+template <typename _Tp, int _Radius, int _Neighbors>
+inline void varlbp_sweep(const Mat& src, Mat& dst, int radius, int neighbors) {
+    dst = Mat::zeros(std::max(src.rows-2*radius, 0), std::max(src.cols-2*radius, 0), CV_32FC1); //! result
+    parallel_rows(dst, VarLBPInvoker<_Tp, _Radius, _Neighbors>(src, dst, radius, neighbors));
+}
+
+// Calculates the variance-based LBP with a kernel specialized for the common
+// (radius, neighbors) pairs, see elbp.
 template <typename _Tp>
 inline void varlbp(const Mat& src, Mat& dst, int radius, int neighbors) {
-    dst = Mat::zeros(src.rows-2*radius, src.cols-2*radius, CV_32FC1); //! result
-    // allocate some memory for temporary on-line variance calculations
-    Mat _mean = Mat::zeros(src.rows, src.cols, CV_32FC1);
-    Mat _delta = Mat::zeros(src.rows, src.cols, CV_32FC1);
-    Mat _m2 = Mat::zeros(src.rows, src.cols, CV_32FC1);
-    for(int n=0; n<neighbors; n++) {
-        // sample points
-        float x = static_cast<float>(radius) * cos(2.0*M_PI*n/static_cast<float>(neighbors));
-        float y = static_cast<float>(radius) * -sin(2.0*M_PI*n/static_cast<float>(neighbors));
-        // relative indices
-        int fx = static_cast<int>(floor(x));
-        int fy = static_cast<int>(floor(y));
-        int cx = static_cast<int>(ceil(x));
-        int cy = static_cast<int>(ceil(y));
-        // fractional part
-        float ty = y - fy;
-        float tx = x - fx;
-        // set interpolation weights
-        float w1 = (1 - tx) * (1 - ty);
-        float w2 =      tx  * (1 - ty);
-        float w3 = (1 - tx) *      ty;
-        float w4 =      tx  *      ty;
-        // iterate through your data
-        for(int i=radius; i < src.rows-radius;i++) {
-            for(int j=radius;j < src.cols-radius;j++) {
-                float t = w1*src.at<_Tp>(i+fy,j+fx) + w2*src.at<_Tp>(i+fy,j+cx) + w3*src.at<_Tp>(i+cy,j+fx) + w4*src.at<_Tp>(i+cy,j+cx);
-                _delta.at<float>(i,j) = t - _mean.at<float>(i,j);
-                _mean.at<float>(i,j) = (_mean.at<float>(i,j) + (_delta.at<float>(i,j) / (1.0*(n+1)))); // i am a bit paranoid
-                _m2.at<float>(i,j) = _m2.at<float>(i,j) + _delta.at<float>(i,j) * (t - _mean.at<float>(i,j));
+    if(radius == 1 && neighbors == 8)
+        varlbp_sweep<_Tp, 1, 8>(src, dst, 1, 8);
+    else if(radius == 2 && neighbors == 8)
+        varlbp_sweep<_Tp, 2, 8>(src, dst, 2, 8);
+    else if(radius == 2 && neighbors == 16)
+        varlbp_sweep<_Tp, 2, 16>(src, dst, 2, 16);
+    else if(radius == 3 && neighbors == 24)
+        varlbp_sweep<_Tp, 3, 24>(src, dst, 3, 24);
+    else switch(neighbors) {
+    case 8:  varlbp_sweep<_Tp, 0, 8>(src, dst, radius, 8); break;
+    case 16: varlbp_sweep<_Tp, 0, 16>(src, dst, radius, 16); break;
+    case 24: varlbp_sweep<_Tp, 0, 24>(src, dst, radius, 24); break;
+    default: varlbp_sweep<_Tp, 0, 0>(src, dst, radius, neighbors); break;
+    }
+}
+
+// Maps each value of src to the index of its bin, bins are separated by the
+// ascending cut values: bin k holds the values in [cuts[k-1], cuts[k]).
+inline void varlbp_quantize(const Mat& src, Mat& dst, const vector<float>& cuts) {
+    dst.create(src.rows, src.cols, CV_32SC1);
+    for(int i = 0; i < src.rows; i++) {
+        const float* values = src.ptr<float>(i);
+        int* bins = dst.ptr<int>(i);
+        for(int j = 0; j < src.cols; j++)
+            bins[j] = static_cast<int>(std::upper_bound(cuts.begin(), cuts.end(), values[j]) - cuts.begin());
+    }
+}
+
+// Counts the codes of each grid_x x grid_y cell in src into the rows of a
+// (grid_x*grid_y) x numPatterns integer matrix. The bins are filled with a
+// single pass over the rows of src, codes outside [0, numPatterns) are
+// skipped.
+template <typename _Tp>
+inline void spatial_histogram(const Mat& src, Mat& counts, int numPatterns, int grid_x, int grid_y) {
+    int width = src.cols/grid_x;
+    int height = src.rows/grid_y;
+    counts = Mat::zeros(grid_x * grid_y, numPatterns, CV_32SC1);
+    if((width <= 0) || (height <= 0))
+        return;
+    for(int i = 0; i < grid_y*height; i++) {
+        const _Tp* src_row = src.ptr<_Tp>(i);
+        // first cell of the current grid row
+        int cellIdx = (i/height)*grid_x;
+        for(int j = 0; j < grid_x; j++) {
+            int* hist = counts.ptr<int>(cellIdx+j);
+            const _Tp* cell = src_row + j*width;
+            for(int k = 0; k < width; k++) {
+                int code = static_cast<int>(cell[k]);
+                if(static_cast<unsigned>(code) < static_cast<unsigned>(numPatterns))
+                    hist[code]++;
             }
         }
     }
-    // calculate result
-    for(int i = radius; i < src.rows-radius; i++) {
-        for(int j = radius; j < src.cols-radius; j++) {
-            dst.at<float>(i-radius, j-radius) = _m2.at<float>(i,j) / (1.0*(neighbors-1));
+}
+
+// Builds the integral histogram of src at the sorted coordinates xs and ys:
+// integral(yi, xi*numSlots + slots[code]) counts the codes of the rectangle
+// [0,xs[xi]) x [0,ys[yi]). Only the codes with a slot (slots[code] >= 0) are
+// counted, codes outside [0, numPatterns) are skipped.
+template <typename _Tp>
+inline void integral_histogram(const Mat& src, Mat& integral, int numPatterns,
+        const vector<int>& xs, const vector<int>& ys, const vector<int>& slots, int numSlots) {
+    int nx = static_cast<int>(xs.size());
+    int ny = static_cast<int>(ys.size());
+    integral = Mat::zeros(ny, nx*numSlots, CV_32SC1);
+    if((nx < 2) || (ny < 2) || (numSlots == 0))
+        return;
+    // the pixels of column j lie right of xs[colIdx[j]-1], -1 outside
+    vector<int> colIdx(src.cols, -1);
+    for(int xi = 1; xi < nx; xi++)
+        for(int j = xs[xi-1]; j < xs[xi]; j++)
+            colIdx[j] = xi;
+    // count the codes of each block between the coordinates
+    for(int yi = 1; yi < ny; yi++) {
+        int* counts = integral.ptr<int>(yi);
+        for(int i = ys[yi-1]; i < ys[yi]; i++) {
+            const _Tp* src_row = src.ptr<_Tp>(i);
+            for(int j = xs[0]; j < xs[nx-1]; j++) {
+                int code = static_cast<int>(src_row[j]);
+                if(static_cast<unsigned>(code) < static_cast<unsigned>(numPatterns) && (slots[code] >= 0))
+                    counts[colIdx[j]*numSlots + slots[code]]++;
+            }
         }
     }
+    // sum up the blocks along the rows and the columns
+    for(int yi = 1; yi < ny; yi++) {
+        int* current = integral.ptr<int>(yi);
+        const int* above = integral.ptr<int>(yi-1);
+        for(int xi = 1; xi < nx; xi++) {
+            int* c = current + xi*numSlots;
+            const int* left = c - numSlots;
+            for(int b = 0; b < numSlots; b++)
+                c[b] += left[b];
+        }
+        for(int k = numSlots; k < nx*numSlots; k++)
+            current[k] += above[k];
+    }
+}
+
+// Marks the codes of src in the region [xs.front(),xs.back()) x
+// [ys.front(),ys.back()): used[code] is set for the codes in [0, numPatterns).
+template <typename _Tp>
+inline void used_codes(const Mat& src, int numPatterns, const vector<int>& xs,
+        const vector<int>& ys, vector<bool>& used) {
+    used.assign(numPatterns, false);
+    if(xs.empty() || ys.empty())
+        return;
+    for(int i = ys.front(); i < ys.back(); i++) {
+        const _Tp* src_row = src.ptr<_Tp>(i);
+        for(int j = xs.front(); j < xs.back(); j++) {
+            int code = static_cast<int>(src_row[j]);
+            if(static_cast<unsigned>(code) < static_cast<unsigned>(numPatterns))
+                used[code] = true;
+        }
+    }
+}
+
+// Returns the grid_x x grid_y cells (row by row) of an image with the given
+// size. Neighbouring cells overlap by the fraction overlap of the cell size,
+// pixels left over at the right and bottom are not covered. Without overlap
+// the cells are the same as in spatial_histogram.
+inline vector<Rect> grid_cells(int cols, int rows, int grid_x, int grid_y, double overlap) {
+    if((grid_x <= 0) || (grid_y <= 0))
+        CV_Error(CV_StsBadArg, "The grid must have at least one cell.");
+    if((overlap < 0.0) || (overlap >= 1.0))
+        CV_Error(CV_StsBadArg, "The overlap must be in [0,1).");
+    int width = static_cast<int>(cols / (1.0 + (grid_x-1)*(1.0-overlap)));
+    int height = static_cast<int>(rows / (1.0 + (grid_y-1)*(1.0-overlap)));
+    int step_x = std::max(1, cvRound(width*(1.0-overlap)));
+    int step_y = std::max(1, cvRound(height*(1.0-overlap)));
+    // a rounded up step mustn't move the last cell past the image
+    if(grid_x > 1)
+        step_x = std::min(step_x, (cols - width) / (grid_x - 1));
+    if(grid_y > 1)
+        step_y = std::min(step_y, (rows - height) / (grid_y - 1));
+    vector<Rect> cells;
+    for(int i = 0; i < grid_y; i++)
+        for(int j = 0; j < grid_x; j++)
+            cells.push_back(Rect(j*step_x, i*step_y, width, height));
+    return cells;
 }
 
 } // namespace impl
@@ -128,7 +689,9 @@ inline void olbp(const Mat& src, Mat& dst) {
     }
 }
 
-// Calculates the Extended Local Binary Patterns.
+// Calculates the Extended Local Binary Patterns. The codes are stored with
+// the narrowest type holding 2^neighbors codes: CV_8UC1 for up to 8
+// neighbors, CV_16UC1 for up to 16 neighbors and CV_32SC1 otherwise.
 //
 //  Ahonen T, Hadid A. and Pietikäinen M. "Face description with local binary
 //  patterns: Application to face recognition." IEEE Transactions on Pattern
@@ -147,6 +710,29 @@ inline void elbp(const Mat& src, Mat& dst, int radius=1, int neighbors=8) {
     }
 }
 
+// Calculates the Extended Local Binary Patterns for several (radius,
+// neighbors) scales with a single sweep over src, which is faster than calling
+// elbp for each scale. To keep the cells of all scales aligned, every code
+// image covers the pixels at least max(radii) away from the border (elbp with
+// a smaller radius gives a larger image). The types are the same as of elbp.
+inline void multiscale_elbp(const Mat& src, vector<Mat>& dst, const vector<int>& radii, const vector<int>& neighbors) {
+    if(radii.empty() || (radii.size() != neighbors.size()))
+        CV_Error(CV_StsBadArg, "Expected a number of neighbors for each radius.");
+    for(int s = 0; s < radii.size(); s++)
+        if((radii[s] <= 0) || (neighbors[s] <= 0) || (neighbors[s] > 31))
+            CV_Error(CV_StsBadArg, "Radius must be positive and neighbors in [1,31].");
+    switch (src.type()) {
+    case CV_8SC1:   impl::multiscale_elbp<char>(src, dst, radii, neighbors); break;
+    case CV_8UC1:   impl::multiscale_elbp<unsigned char>(src, dst, radii, neighbors); break;
+    case CV_16SC1:  impl::multiscale_elbp<short>(src, dst, radii, neighbors); break;
+    case CV_16UC1:  impl::multiscale_elbp<unsigned short>(src, dst, radii, neighbors); break;
+    case CV_32SC1:  impl::multiscale_elbp<int>(src, dst, radii, neighbors); break;
+    case CV_32FC1:  impl::multiscale_elbp<float>(src, dst, radii, neighbors); break;
+    case CV_64FC1:  impl::multiscale_elbp<double>(src, dst, radii, neighbors); break;
+    default: break;
+    }
+}
+
 // Calculates the Variance-based Local Binary Patterns (without Quantization).
 //
 //  Pietikäinen, M., Hadid, A., Zhao, G. and Ahonen, T. (2011), "Computer
@@ -165,10 +751,72 @@ inline void varlbp(const Mat& src, Mat& dst, int radius=1, int neighbors=8) {
     }
 }
 
+// Calculates the cut values, which quantize the VAR values of the given
+// images (see varlbp) into bins of (approximately) equal frequency. Returns
+// bins-1 ascending cut values, the VAR distribution of training images is
+// usually a good choice.
+//
+//  Ojala T., Pietikäinen M. and Mäenpää T. "Multiresolution Gray-Scale and
+//  Rotation Invariant Texture Classification with Local Binary Patterns."
+//  IEEE Transactions on Pattern Analysis and Machine Intelligence,
+//  24(7):971-987.
+//
+inline vector<float> varlbp_cuts(const vector<Mat>& src, int bins) {
+    if(bins <= 0)
+        CV_Error(CV_StsBadArg, "The number of bins must be positive.");
+    vector<float> values;
+    for(int i = 0; i < src.size(); i++) {
+        if(src[i].type() != CV_32FC1)
+            CV_Error(CV_StsUnmatchedFormats, "Expected CV_32FC1 VAR images.");
+        for(int r = 0; r < src[i].rows; r++)
+            values.insert(values.end(), src[i].ptr<float>(r), src[i].ptr<float>(r) + src[i].cols);
+    }
+    if(values.empty())
+        return vector<float>(bins-1, 0.0f);
+    vector<float> cuts;
+    for(int k = 1; k < bins; k++) {
+        vector<float>::iterator nth = values.begin() + (values.size()*k)/bins;
+        std::nth_element(values.begin(), nth, values.end());
+        cuts.push_back(*nth);
+    }
+    std::sort(cuts.begin(), cuts.end());
+    return cuts;
+}
+
+// Combines a LBP image and a VAR image (quantized into cuts.size()+1 bins
+// with varlbp_cuts) of the same size into joint LBP/VAR codes:
+//
+//      code = lbp * (cuts.size()+1) + bin(var)
+//
+// A spatial histogram of these codes has numPatterns*(cuts.size()+1) bins
+// per cell.
+inline Mat lbpvar(const Mat& lbp, const Mat& var, const vector<float>& cuts) {
+    if((lbp.rows != var.rows) || (lbp.cols != var.cols))
+        CV_Error(CV_StsBadArg, "LBP and VAR images must have the same size.");
+    if(var.type() != CV_32FC1)
+        CV_Error(CV_StsUnmatchedFormats, "Expected a CV_32FC1 VAR image.");
+    Mat codes;
+    impl::varlbp_quantize(var, codes, cuts);
+    Mat patterns;
+    lbp.convertTo(patterns, CV_32SC1);
+    int bins = static_cast<int>(cuts.size()) + 1;
+    for(int i = 0; i < codes.rows; i++) {
+        const int* p = patterns.ptr<int>(i);
+        int* c = codes.ptr<int>(i);
+        for(int j = 0; j < codes.cols; j++)
+            c[j] += p[j]*bins;
+    }
+    return codes;
+}
+
 // Calculates the Spatial Histogram for a given LBP image.
 //
+// The codes are counted straight into integer bins (one row of numPatterns
+// bins per cell) and the whole feature vector is scaled once at the end. All
+// cells share the same size, so this equals normalizing each cell on its own.
+// Codes outside [0, numPatterns) are ignored.
+//
 // TODO Test, Test, Test!
-// TODO Optimize, Optimize, Optimize!
 //
 //  Ahonen T, Hadid A. and Pietikäinen M. "Face description with local binary
 //  patterns: Application to face recognition." IEEE Transactions on Pattern
@@ -183,38 +831,224 @@ inline Mat spatial_histogram(const Mat& src, int numPatterns, int grid_x=8, int
     // return matrix with zeros if no data was given
     if(src.empty())
         return result.reshape(1,1);
-    // initial result_row
-    int resultRowIdx = 0;
-    // iterate through grid
-    for(int i = 0; i < grid_y; i++) {
-        for(int j = 0; j < grid_x; j++) {
-            Mat src_cell = Mat(src, Range(i*height,(i+1)*height), Range(j*width,(j+1)*width));
-            Mat cell_hist = histc(src_cell, 0, (numPatterns-1), true);
-            // copy to the result matrix
-            Mat result_row = result.row(resultRowIdx);
-            cell_hist.reshape(1,1).convertTo(result_row, CV_32FC1);
-            // increase row count in result matrix
-            resultRowIdx++;
-        }
+    // count the codes of all cells
+    Mat counts;
+    switch (src.type()) {
+    case CV_8SC1:   impl::spatial_histogram<char>(src, counts, numPatterns, grid_x, grid_y); break;
+    case CV_8UC1:   impl::spatial_histogram<unsigned char>(src, counts, numPatterns, grid_x, grid_y); break;
+    case CV_16SC1:  impl::spatial_histogram<short>(src, counts, numPatterns, grid_x, grid_y); break;
+    case CV_16UC1:  impl::spatial_histogram<unsigned short>(src, counts, numPatterns, grid_x, grid_y); break;
+    case CV_32SC1:  impl::spatial_histogram<int>(src, counts, numPatterns, grid_x, grid_y); break;
+    case CV_32FC1:  impl::spatial_histogram<float>(src, counts, numPatterns, grid_x, grid_y); break;
+    default:
+        CV_Error(CV_StsUnmatchedFormats, "This type is not implemented yet."); break;
     }
+    // normalize all cells at once, they hold the same number of pixels
+    double scale = (normed && (width*height > 0)) ? 1.0/(width*height) : 1.0;
+    counts.convertTo(result, CV_32FC1, scale);
     // return result as reshaped feature vector
     return result.reshape(1,1);
 }
 
+// An integral histogram of a LBP image, which yields the histogram of any
+// rectangular cell with four lookups per bin, regardless of the cell size:
+//
+//      IntegralHistogram ih(lbp_image, 256);
+//      Mat cell = ih.histogram(Rect(10, 10, 16, 16));
+//
+// The integral is only kept at the given x and y coordinates (all of them by
+// default) and only for the codes, which occur in the image. A grid of
+// cells needs the coordinates of the cell corners only, so building the
+// integral costs a single pass over the image, and overlapping cells and
+// several grids on the same image are cheap (see spatial_histogram). Codes
+// outside [0, numPatterns) are ignored.
+//
+//  Porikli F. "Integral Histogram: A Fast Way to Extract Histograms in
+//  Cartesian Spaces." CVPR 2005.
+//
+class IntegralHistogram {
+
+private:
+    int _rows;
+    int _cols;
+    int _numPatterns;
+    // coordinates of the integral and their positions (-1 for others)
+    vector<int> _xs;
+    vector<int> _ys;
+    vector<int> _xIdx;
+    vector<int> _yIdx;
+    // slot of each code (-1 if it doesn't occur) and the codes of the slots
+    vector<int> _slots;
+    vector<int> _codes;
+    Mat _integral;
+
+    // Sorts the coordinates, which must lie in [0,size], and indexes them.
+    static void indexCoordinates(vector<int>& coords, int size, vector<int>& idx) {
+        if(coords.empty()) {
+            for(int i = 0; i <= size; i++)
+                coords.push_back(i);
+        }
+        std::sort(coords.begin(), coords.end());
+        coords.erase(std::unique(coords.begin(), coords.end()), coords.end());
+        if((coords.front() < 0) || (coords.back() > size))
+            CV_Error(CV_StsBadArg, "The coordinates must lie inside the image.");
+        idx.assign(size+1, -1);
+        for(int i = 0; i < coords.size(); i++)
+            idx[coords[i]] = i;
+    }
+
+    template <typename _Tp>
+    void build(const Mat& src) {
+        vector<bool> used;
+        impl::used_codes<_Tp>(src, _numPatterns, _xs, _ys, used);
+        _slots.assign(_numPatterns, -1);
+        for(int code = 0; code < _numPatterns; code++) {
+            if(used[code]) {
+                _slots[code] = static_cast<int>(_codes.size());
+                _codes.push_back(code);
+            }
+        }
+        impl::integral_histogram<_Tp>(src, _integral, _numPatterns, _xs, _ys, _slots,
+                static_cast<int>(_codes.size()));
+    }
+
+public:
+    // Builds the integral histogram of an integer code image at the given
+    // x and y coordinates, empty coordinates take all of them.
+    IntegralHistogram(const Mat& src, int numPatterns,
+            const vector<int>& xs = vector<int>(), const vector<int>& ys = vector<int>()) :
+        _rows(src.rows),
+        _cols(src.cols),
+        _numPatterns(numPatterns),
+        _xs(xs),
+        _ys(ys) {
+        if(numPatterns <= 0)
+            CV_Error(CV_StsBadArg, "The number of patterns must be positive.");
+        indexCoordinates(_xs, _cols, _xIdx);
+        indexCoordinates(_ys, _rows, _yIdx);
+        switch (src.type()) {
+        case CV_8SC1:   build<char>(src); break;
+        case CV_8UC1:   build<unsigned char>(src); break;
+        case CV_16SC1:  build<short>(src); break;
+        case CV_16UC1:  build<unsigned short>(src); break;
+        case CV_32SC1:  build<int>(src); break;
+        case CV_32FC1:  build<float>(src); break;
+        default:
+            CV_Error(CV_StsUnmatchedFormats, "This type is not implemented yet."); break;
+        }
+    }
+
+    // Writes the counts of the cell r (which must lie inside the image, with
+    // its corners at coordinates of the integral) into hist, an array of
+    // numPatterns integers.
+    void histogram(const Rect& r, int* hist) const {
+        if((r.x < 0) || (r.y < 0) || (r.width < 0) || (r.height < 0) ||
+                (r.x + r.width > _cols) || (r.y + r.height > _rows))
+            CV_Error(CV_StsBadArg, "The cell must lie inside the image.");
+        int x0 = _xIdx[r.x], x1 = _xIdx[r.x + r.width];
+        int y0 = _yIdx[r.y], y1 = _yIdx[r.y + r.height];
+        if((x0 < 0) || (x1 < 0) || (y0 < 0) || (y1 < 0))
+            CV_Error(CV_StsBadArg, "The corners of the cell must be coordinates of the integral histogram.");
+        std::fill(hist, hist + _numPatterns, 0);
+        int numSlots = static_cast<int>(_codes.size());
+        const int* tl = _integral.ptr<int>(y0) + x0*numSlots;
+        const int* tr = _integral.ptr<int>(y0) + x1*numSlots;
+        const int* bl = _integral.ptr<int>(y1) + x0*numSlots;
+        const int* br = _integral.ptr<int>(y1) + x1*numSlots;
+        for(int b = 0; b < numSlots; b++)
+            hist[_codes[b]] = br[b] - bl[b] - tr[b] + tl[b];
+    }
+
+    // Returns the counts of the cell r as 1 x numPatterns CV_32SC1 matrix.
+    Mat histogram(const Rect& r) const {
+        Mat hist(1, _numPatterns, CV_32SC1);
+        histogram(r, hist.ptr<int>());
+        return hist;
+    }
+
+    // Returns the number of bytes allocated for the integral.
+    size_t memory() const {
+        return _integral.total()*sizeof(int);
+    }
+
+    // Getter functions.
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+    int numPatterns() const { return _numPatterns; }
+};
+
+// Calculates the spatial histogram of grid_x x grid_y cells from an integral
+// histogram. Neighbouring cells overlap by the fraction overlap of the cell
+// size, without overlap this equals spatial_histogram on the LBP image.
+inline Mat spatial_histogram(const IntegralHistogram& src, int grid_x=8, int grid_y=8,
+        double overlap=0.0, bool normed=true) {
+    vector<Rect> cells = impl::grid_cells(src.cols(), src.rows(), grid_x, grid_y, overlap);
+    Mat counts(static_cast<int>(cells.size()), src.numPatterns(), CV_32SC1);
+    for(int i = 0; i < cells.size(); i++)
+        src.histogram(cells[i], counts.ptr<int>(i));
+    // all cells hold the same number of pixels
+    int area = cells[0].area();
+    double scale = (normed && (area > 0)) ? 1.0/area : 1.0;
+    Mat result;
+    counts.convertTo(result, CV_32FC1, scale);
+    return result.reshape(1,1);
+}
+
+// Calculates the spatial histograms of several grids (given as grid_x x
+// grid_y sizes) from one integral histogram and concatenates them:
+//
+//      vector<Size> grids;
+//      grids.push_back(Size(4,4));
+//      grids.push_back(Size(8,8));
+//      Mat hist = spatial_histogram(IntegralHistogram(lbp_image, 256), grids);
+//
+inline Mat spatial_histogram(const IntegralHistogram& src, const vector<Size>& grids,
+        double overlap=0.0, bool normed=true) {
+    int numCells = 0;
+    for(int i = 0; i < grids.size(); i++)
+        numCells += grids[i].area();
+    Mat result(1, numCells*src.numPatterns(), CV_32FC1);
+    int offset = 0;
+    for(int i = 0; i < grids.size(); i++) {
+        Mat hist = spatial_histogram(src, grids[i].width, grids[i].height, overlap, normed);
+        Mat dst = result.colRange(offset, offset + hist.cols);
+        hist.copyTo(dst);
+        offset += hist.cols;
+    }
+    return result;
+}
+
+// Calculates the spatial histograms of several grids (see above) of a LBP
+// image. The integral histogram is only built at the corners of the cells.
+inline Mat spatial_histogram(const Mat& src, int numPatterns, const vector<Size>& grids,
+        double overlap=0.0, bool normed=true) {
+    vector<int> xs, ys;
+    for(int i = 0; i < grids.size(); i++) {
+        vector<Rect> cells = impl::grid_cells(src.cols, src.rows, grids[i].width, grids[i].height, overlap);
+        for(int k = 0; k < cells.size(); k++) {
+            xs.push_back(cells[k].x);
+            xs.push_back(cells[k].x + cells[k].width);
+            ys.push_back(cells[k].y);
+            ys.push_back(cells[k].y + cells[k].height);
+        }
+    }
+    return spatial_histogram(IntegralHistogram(src, numPatterns, xs, ys), grids, overlap, normed);
+}
+
 // Wrapper functions for convenience.
-Mat olbp(const Mat& src) {
+inline Mat olbp(const Mat& src) {
     Mat dst;
     olbp(src, dst);
     return dst;
 }
 
-Mat elbp(const Mat& src, int radius=1, int neighbors=8) {
+inline Mat elbp(const Mat& src, int radius=1, int neighbors=8) {
     Mat dst;
     elbp(src, dst, radius, neighbors);
     return dst;
 }
 
-Mat varlbp(const Mat& src, int radius=1, int neighbors=8) {
+inline Mat varlbp(const Mat& src, int radius=1, int neighbors=8) {
     Mat dst;
     varlbp(src, dst, radius, neighbors);
     return dst;
@@ -0,0 +1,1175 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __MODEL_HPP__
+#define __MODEL_HPP__
+
+#include "opencv2/opencv.hpp"
+#include "compression.hpp"
+
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <cstring>
+#include <cerrno>
+#include <limits>
+#include <map>
+#include <deque>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// A binary model file is a versioned container of named sections, each
+// holding a raw matrix:
+//
+//      header      64 bytes, see impl::ModelHeader
+//      sections    one impl::SectionEntry followed by the raw matrix data,
+//                  each aligned to MODEL_ALIGNMENT bytes
+//      end         an impl::SectionEntry with an empty name
+//      table       a copy of all section entries
+//
+// A compressed section (see ModelWriter::compress) holds the number of
+// blocks and the size of the blocks (two ints), the compressed size of each
+// block (an int per block) and the blocks, each MODEL_BLOCK_SIZE bytes of
+// the matrix (the last one may be shorter) compressed with impl::lz_compress
+// and preceded by its compressed size (an int). Blocks which don't get
+// smaller are stored as they are. Writers which can't seek leave the sizes
+// in front of the blocks and the size of the section at 0 and -1, readers
+// walk the blocks then.
+//
+// Scalars are stored as 1x1 matrices, strings as CV_8UC1 rows. Numbers are
+// stored in the byte order of the writer, readers with another byte order
+// reject the file. Nested names are separated by '/'.
+//
+// The entries in front of the sections let a model be written and read in
+// a single pass, for example through a pipe or a socket. Files (and other
+// seekable streams) also get the table, whose offset is patched into the
+// header, so a reader can jump straight to the sections it needs.
+//
+// ModelWriter and ModelReader mimic the operators of cv::FileStorage, so
+// the serialization code of a model can be shared by both formats:
+//
+//      ModelWriter fs("model.bin");
+//      fs << "num_components" << 10;
+//      fs << "mean" << mean;
+//      fs.release();
+//
+//      ModelReader fs("model.bin");
+//      fs["num_components"] >> num_components;
+//      fs["mean"] >> mean;
+//
+// A ModelReader opened with ModelReader::MAP maps the file into memory and
+// reads the matrices as headers over the mapped pages, without a copy.
+namespace cv {
+
+// Magic number at the beginning of a binary model file.
+const char MODEL_MAGIC[8] = { 'F', 'R', 'M', 'O', 'D', 'E', 'L', '\0' };
+// Current version of the format, readers reject newer files. Version 1
+// files have no entries in front of the sections, version 2 files have no
+// compressed sections, the blocks of version 3 files have no sizes in front
+// of them.
+const int MODEL_VERSION = 4;
+// Alignment of the sections in bytes (a cache line).
+const int MODEL_ALIGNMENT = 64;
+// Maximum length of a section name (including the terminating zero).
+const int MODEL_NAME_SIZE = 32;
+// Size of the blocks of a compressed section in bytes (before compression).
+const int MODEL_BLOCK_SIZE = 65536;
+
+namespace impl {
+
+// Marks the byte order of the writer.
+const unsigned int MODEL_BYTE_ORDER = 0x01020304;
+// Flags of the sections.
+const int SECTION_COMPRESSED = 1;
+
+struct ModelHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byteOrder;
+    int numSections;
+    int reserved0;
+    int64 tableOffset;
+    char reserved[32];
+};
+
+struct SectionEntry {
+    char name[MODEL_NAME_SIZE];
+    // matrix type (CV_8UC1, ...) and size
+    int type;
+    int rows;
+    int cols;
+    // SECTION_COMPRESSED for compressed sections
+    int flags;
+    // position and size of the (compressed) data in bytes, the size is -1
+    // for compressed sections written to a stream which can't seek
+    int64 offset;
+    int64 size;
+};
+
+// A read-only view of a whole file. On POSIX systems the file is mapped
+// with MAP_PRIVATE: processes mapping the same file share its pages through
+// the page cache, and writes to the pages (a model modified after loading)
+// go to private copies and never reach the file. Elsewhere the file is read
+// into memory.
+class MappedFile {
+
+private:
+    uchar* _data;
+    size_t _size;
+
+    // not copyable, the mapping is shared with a Ptr
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    // Maps a file, see isOpened.
+    MappedFile(const string& filename) :
+        _data(0),
+        _size(0) {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+            return;
+        struct stat st;
+        if((::fstat(fd, &st) == 0) && (st.st_size > 0)) {
+            void* p = ::mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if(p != MAP_FAILED) {
+                _data = static_cast<uchar*>(p);
+                _size = st.st_size;
+            }
+        }
+        // the mapping stays valid after closing the file
+        ::close(fd);
+#else
+        std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+        if(!file)
+            return;
+        size_t size = static_cast<size_t>(file.tellg());
+        if(size == 0)
+            return;
+        _data = new uchar[size];
+        file.seekg(0);
+        if(!file.read(reinterpret_cast<char*>(_data), size)) {
+            delete[] _data;
+            _data = 0;
+            return;
+        }
+        _size = size;
+#endif
+    }
+
+    ~MappedFile() {
+        if(_data == 0)
+            return;
+#if defined(__unix__) || defined(__APPLE__)
+        ::munmap(_data, _size);
+#else
+        delete[] _data;
+#endif
+    }
+
+    // Returns true if the file is mapped.
+    bool isOpened() const { return _data != 0; }
+
+    // Returns the first byte of the file.
+    uchar* data() const { return _data; }
+
+    // Returns the size of the file in bytes.
+    size_t size() const { return _size; }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// A stream buffer over a file descriptor (a file, a pipe or a socket), for
+// either reading or writing. Blocks larger than the buffer bypass it.
+class FdStreamBuf : public std::streambuf {
+
+private:
+    int _fd;
+    vector<char> _buffer;
+
+    // not copyable
+    FdStreamBuf(const FdStreamBuf&);
+    FdStreamBuf& operator=(const FdStreamBuf&);
+
+    // Writes n bytes, returns false on errors.
+    bool put(const char* data, std::streamsize n) {
+        while(n > 0) {
+            ssize_t written = ::write(_fd, data, static_cast<size_t>(n));
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            n -= written;
+        }
+        return true;
+    }
+
+    // Writes the buffered bytes.
+    bool flush() {
+        bool ok = put(pbase(), pptr() - pbase());
+        setp(&_buffer[0], &_buffer[0] + _buffer.size());
+        return ok;
+    }
+
+    // Reads at most n bytes, returns the number of bytes read.
+    std::streamsize get(char* data, std::streamsize n) {
+        ssize_t result;
+        do {
+            result = ::read(_fd, data, static_cast<size_t>(n));
+        } while((result < 0) && (errno == EINTR));
+        return (result < 0) ? 0 : result;
+    }
+
+protected:
+    int overflow(int c) {
+        if(!flush())
+            return traits_type::eof();
+        if(!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() {
+        return flush() ? 0 : -1;
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize n) {
+        if(n < epptr() - pptr())
+            return std::streambuf::xsputn(data, n);
+        if(!flush() || !put(data, n))
+            return 0;
+        return n;
+    }
+
+    int underflow() {
+        if(gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        std::streamsize n = get(&_buffer[0], _buffer.size());
+        if(n <= 0)
+            return traits_type::eof();
+        setg(&_buffer[0], &_buffer[0], &_buffer[0] + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+    std::streamsize xsgetn(char* data, std::streamsize n) {
+        // the buffered bytes first
+        std::streamsize result = std::min(n, static_cast<std::streamsize>(egptr() - gptr()));
+        std::memcpy(data, gptr(), static_cast<size_t>(result));
+        gbump(static_cast<int>(result));
+        // large blocks are read directly
+        while(n - result >= static_cast<std::streamsize>(_buffer.size())) {
+            std::streamsize read = get(data + result, n - result);
+            if(read <= 0)
+                return result;
+            result += read;
+        }
+        if(result < n)
+            result += std::streambuf::xsgetn(data + result, n - result);
+        return result;
+    }
+
+public:
+    // Size of the buffer in bytes.
+    enum { BUFFER_SIZE = 65536 };
+
+    // Uses the file descriptor fd, which stays open.
+    FdStreamBuf(int fd) :
+        _fd(fd),
+        _buffer(BUFFER_SIZE) {
+        setp(&_buffer[0], &_buffer[0] + _buffer.size());
+        setg(&_buffer[0], &_buffer[0], &_buffer[0]);
+    }
+
+    ~FdStreamBuf() {
+        sync();
+    }
+};
+#endif
+
+} // namespace impl
+
+// Returns true if a model should be written in the binary format, which is
+// the case for filenames ending in ".bin".
+inline bool isModelFilename(const string& filename) {
+    return (filename.size() >= 4) && (filename.compare(filename.size() - 4, 4, ".bin") == 0);
+}
+
+// Returns true if the file starts with the magic number of a binary model.
+inline bool isModelFile(const string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    char magic[sizeof(MODEL_MAGIC)];
+    if(!file.read(magic, sizeof(magic)))
+        return false;
+    return std::memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0;
+}
+
+// Writes a binary model file (or stream). The sections are written as they
+// are added, directly from the matrix data, the table and the header are
+// completed by release.
+class ModelWriter {
+
+private:
+    std::ofstream _file;
+    // stream of a file descriptor
+    Ptr<std::streambuf> _buffer;
+    Ptr<std::ostream> _fdstream;
+    std::ostream* _stream;
+    // position of the header in the stream (-1 if the stream can't seek)
+    // and number of bytes written
+    std::streamoff _start;
+    int64 _pos;
+    bool _open;
+    int _flags;
+    vector<impl::SectionEntry> _sections;
+    // pending key of the << operators and prefixes of the nested names
+    string _key;
+    vector<string> _prefixes;
+
+    // Writes size bytes to the stream.
+    void put(const void* data, int64 size) {
+        _stream->write(static_cast<const char*>(data), size);
+        _pos += size;
+    }
+
+    // Pads the stream to the next multiple of MODEL_ALIGNMENT.
+    void align() {
+        static const char zeros[MODEL_ALIGNMENT] = { 0 };
+        put(zeros, (MODEL_ALIGNMENT - _pos % MODEL_ALIGNMENT) % MODEL_ALIGNMENT);
+    }
+
+    // Returns the header of the model, the table is unknown while writing.
+    impl::ModelHeader header(int64 tableOffset) const {
+        impl::ModelHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+        header.version = MODEL_VERSION;
+        header.byteOrder = impl::MODEL_BYTE_ORDER;
+        header.numSections = static_cast<int>(_sections.size());
+        header.tableOffset = tableOffset;
+        return header;
+    }
+
+    // Writes the header.
+    void open() {
+        _pos = 0;
+        _start = _stream->tellp();
+        if(!*_stream || (_start < 0)) {
+            _stream->clear();
+            _start = -1;
+        }
+        impl::ModelHeader h = header(0);
+        put(&h, sizeof(h));
+    }
+
+    // Returns the full name of a key.
+    string name(const string& key) const {
+        return _prefixes.empty() ? key : _prefixes.back() + key;
+    }
+
+    // Writes the entry of a section holding m, followed by size bytes.
+    void begin(const string& key, const Mat& m, int flags, int64 size) {
+        string n = name(key);
+        if(n.size() >= MODEL_NAME_SIZE)
+            CV_Error(CV_StsBadArg, "The section name " + n + " is too long.");
+        impl::SectionEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        std::strcpy(entry.name, n.c_str());
+        entry.type = m.type();
+        entry.rows = m.rows;
+        entry.cols = m.cols;
+        entry.flags = flags;
+        align();
+        entry.offset = _pos + sizeof(entry);
+        entry.size = size;
+        put(&entry, sizeof(entry));
+        _sections.push_back(entry);
+    }
+
+    // Handles a value of the << operators.
+    template<typename _Tp>
+    void put(const _Tp& value) {
+        if(_key.empty())
+            CV_Error(CV_StsError, "No name given for the value.");
+        string key = _key;
+        _key.clear();
+        write(key, value);
+    }
+
+public:
+    // Options of the writer.
+    enum {
+        // compress the sections passed to compress
+        COMPRESS = 1
+    };
+
+    // Opens a file for writing.
+    ModelWriter(const string& filename, int flags = 0) :
+        _file(filename.c_str(), std::ios::binary | std::ios::trunc),
+        _stream(&_file),
+        _open(_file.is_open()),
+        _flags(flags) {
+        if(_open)
+            open();
+    }
+
+    // Writes to a stream, which must be opened in binary mode.
+    explicit ModelWriter(std::ostream& stream, int flags = 0) :
+        _stream(&stream),
+        _open(true),
+        _flags(flags) {
+        open();
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Writes to a file descriptor (a file, a pipe or a socket), which stays
+    // open. The table isn't referenced by the header, readers read such
+    // files in one pass.
+    explicit ModelWriter(int fd, int flags = 0) :
+        _buffer(new impl::FdStreamBuf(fd)),
+        _open(true),
+        _flags(flags) {
+        _fdstream = new std::ostream(_buffer);
+        _stream = _fdstream;
+        open();
+    }
+#endif
+
+    ~ModelWriter() {
+        try {
+            release();
+        } catch(...) {}
+    }
+
+    // Returns true if the file is open.
+    bool isOpened() const { return _open; }
+
+    // Writes a matrix as a section of the given name.
+    void write(const string& key, const Mat& m) {
+        begin(key, m, 0, static_cast<int64>(m.total() * m.elemSize()));
+        if(m.isContinuous()) {
+            put(m.data, m.total() * m.elemSize());
+        } else {
+            for(int i = 0; i < m.rows; i++)
+                put(m.ptr(i), m.cols * m.elemSize());
+        }
+    }
+
+    // Writes a matrix as a compressed section, if the writer was opened
+    // with COMPRESS. The blocks are compressed and written one at a time, so
+    // a single block is held in memory. The sizes in front of the blocks and
+    // the size of the section are patched in afterwards, if the stream can
+    // seek.
+    void compress(const string& key, const Mat& m) {
+        if(!(_flags & COMPRESS) || m.empty()) {
+            write(key, m);
+            return;
+        }
+        size_t rawSize = m.total() * m.elemSize();
+        size_t rowSize = m.cols * m.elemSize();
+        int numBlocks = static_cast<int>((rawSize + MODEL_BLOCK_SIZE - 1) / MODEL_BLOCK_SIZE);
+        begin(key, m, impl::SECTION_COMPRESSED, -1);
+        int64 entryPos = _pos - static_cast<int64>(sizeof(impl::SectionEntry));
+        int header[2] = { numBlocks, MODEL_BLOCK_SIZE };
+        put(header, sizeof(header));
+        int64 sizesPos = _pos;
+        vector<int> sizes(numBlocks, 0);
+        put(&sizes[0], sizes.size() * sizeof(int));
+        vector<uchar> raw, block(MODEL_BLOCK_SIZE);
+        for(int i = 0; i < numBlocks; i++) {
+            size_t offset = static_cast<size_t>(i) * MODEL_BLOCK_SIZE;
+            size_t n = std::min<size_t>(MODEL_BLOCK_SIZE, rawSize - offset);
+            const uchar* src = m.data + offset;
+            if(!m.isContinuous()) {
+                // gather the bytes of the block from the rows
+                raw.resize(n);
+                for(size_t copied = 0; copied < n; ) {
+                    size_t col = (offset + copied) % rowSize;
+                    size_t len = std::min(rowSize - col, n - copied);
+                    std::memcpy(&raw[copied], m.ptr(static_cast<int>((offset + copied) / rowSize)) + col, len);
+                    copied += len;
+                }
+                src = &raw[0];
+            }
+            // blocks which don't get smaller are stored as they are
+            size_t compressed = impl::lz_compress(src, n, &block[0], n - 1);
+            if(compressed == 0) {
+                sizes[i] = static_cast<int>(n);
+                put(&sizes[i], sizeof(int));
+                put(src, n);
+            } else {
+                sizes[i] = static_cast<int>(compressed);
+                put(&sizes[i], sizeof(int));
+                put(&block[0], compressed);
+            }
+        }
+        impl::SectionEntry& entry = _sections.back();
+        entry.size = _pos - entry.offset;
+        if(_start >= 0) {
+            _stream->seekp(_start + sizesPos);
+            _stream->write(reinterpret_cast<const char*>(&sizes[0]), sizes.size() * sizeof(int));
+            _stream->seekp(_start + entryPos);
+            _stream->write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            _stream->seekp(_start + _pos);
+        }
+    }
+
+    void write(const string& key, int value) {
+        write(key, Mat(1, 1, CV_32SC1, &value));
+    }
+
+    void write(const string& key, double value) {
+        write(key, Mat(1, 1, CV_64FC1, &value));
+    }
+
+    void write(const string& key, const string& value) {
+        write(key, value.empty() ? Mat() : Mat(1, (int) value.size(), CV_8UC1, (void*) value.data()));
+    }
+
+    template<typename _Tp>
+    void write(const string& key, const vector<_Tp>& value) {
+        write(key, value.empty() ? Mat() : Mat(value).reshape(1,1));
+    }
+
+    // Sets the name of the next value, or writes a string value if a name
+    // is pending. "{" and "}" open and close a nested structure, like in
+    // cv::FileStorage.
+    ModelWriter& operator<<(const string& str) {
+        if(str == "{") {
+            _prefixes.push_back(name(_key) + "/");
+            _key.clear();
+        } else if(str == "}") {
+            if(!_prefixes.empty())
+                _prefixes.pop_back();
+        } else if(_key.empty()) {
+            _key = str;
+        } else {
+            put(str);
+        }
+        return *this;
+    }
+
+    ModelWriter& operator<<(const char* str) {
+        return *this << string(str);
+    }
+
+    // Writes a value with the pending name.
+    template<typename _Tp>
+    ModelWriter& operator<<(const _Tp& value) {
+        put(value);
+        return *this;
+    }
+
+    // Writes the end of the sections and the table, patches the header of
+    // a seekable stream and closes the file.
+    void release() {
+        if(!_open)
+            return;
+        _open = false;
+        align();
+        impl::SectionEntry end;
+        std::memset(&end, 0, sizeof(end));
+        put(&end, sizeof(end));
+        int64 tableOffset = _pos;
+        if(!_sections.empty())
+            put(&_sections[0], _sections.size() * sizeof(impl::SectionEntry));
+        if(_start >= 0) {
+            impl::ModelHeader h = header(tableOffset);
+            _stream->seekp(_start);
+            _stream->write(reinterpret_cast<const char*>(&h), sizeof(h));
+            _stream->seekp(_start + _pos);
+        }
+        _stream->flush();
+        bool failed = !*_stream;
+        if(_file.is_open())
+            _file.close();
+        if(failed)
+            CV_Error(CV_StsError, "Could not write the model file.");
+    }
+};
+
+class ModelReader;
+
+// A named section (or a nested structure) of a ModelReader, the counterpart
+// of cv::FileNode.
+class ModelNode {
+
+private:
+    const ModelReader* _reader;
+    string _name;
+
+public:
+    ModelNode(const ModelReader* reader, const string& name) :
+        _reader(reader),
+        _name(name) {}
+
+    // Returns the section or nested structure key of this structure.
+    ModelNode operator[](const string& key) const {
+        return ModelNode(_reader, _name.empty() ? key : _name + "/" + key);
+    }
+
+    // Returns true if there is neither a section nor a nested structure of
+    // this name.
+    bool empty() const;
+
+    // Reads the section into m, empty sections give an empty matrix.
+    void read(Mat& m) const;
+};
+
+// Reads a binary model file. The header and the table are read on opening,
+// each section is read with a single read when it's requested. Files opened
+// with MAP are mapped into memory instead, and the sections are read as
+// matrix headers over the mapping (see mapping).
+//
+// Models read from a stream (or a file descriptor) are read in one pass:
+// a requested section is read from the stream, the sections in front of it
+// are kept until they are requested. Each section of a stream can be read
+// only once.
+class ModelReader {
+
+private:
+    mutable std::ifstream _file;
+    // stream of a file descriptor
+    Ptr<std::streambuf> _buffer;
+    Ptr<std::istream> _fdstream;
+    // stream of a model read in one pass
+    std::istream* _stream;
+    Ptr<impl::MappedFile> _mapping;
+    int _version;
+    // position in the stream and whether the end of the sections is reached
+    mutable int64 _pos;
+    mutable bool _end;
+    // the deque keeps the entries in place while sections are added
+    mutable std::deque<impl::SectionEntry> _sections;
+    mutable map<string,int> _names;
+    // sections read from the stream, but not requested yet
+    mutable map<string,Mat> _pending;
+
+    // Adds an entry to the table.
+    void add(impl::SectionEntry entry) const {
+        entry.name[MODEL_NAME_SIZE - 1] = '\0';
+        _names[entry.name] = static_cast<int>(_sections.size());
+        _sections.push_back(entry);
+    }
+
+    // Reads size bytes at offset of the file (or the mapping).
+    void fetch(int64 offset, void* data, size_t size) const {
+        if(!_mapping.empty()) {
+            if((offset < 0) || (offset + size > _mapping->size()))
+                CV_Error(CV_StsError, "The model file is truncated.");
+            std::memcpy(data, _mapping->data() + offset, size);
+            return;
+        }
+        _file.clear();
+        _file.seekg(offset);
+        if(!_file.read(static_cast<char*>(data), size))
+            CV_Error(CV_StsError, "The model file is truncated.");
+    }
+
+    // Reads the entries in front of the sections, for files written without
+    // a table (see ModelWriter(int)).
+    void scan() {
+        int64 pos = sizeof(impl::ModelHeader);
+        for(;;) {
+            pos += (MODEL_ALIGNMENT - pos % MODEL_ALIGNMENT) % MODEL_ALIGNMENT;
+            impl::SectionEntry entry;
+            fetch(pos, &entry, sizeof(entry));
+            if(entry.name[0] == '\0')
+                break;
+            pos += sizeof(entry);
+            if((entry.size < 0) && (entry.flags & impl::SECTION_COMPRESSED))
+                entry.size = walk(pos);
+            if((entry.offset != pos) || (entry.size < 0))
+                CV_Error(CV_StsError, "The model file is corrupted.");
+            add(entry);
+            pos += entry.size;
+        }
+    }
+
+    // Returns the size of a compressed section at offset, whose size wasn't
+    // patched by the writer, by walking the sizes in front of its blocks.
+    int64 walk(int64 offset) const {
+        int header[2];
+        fetch(offset, header, sizeof(header));
+        if((_version < 4) || (header[0] < 0))
+            CV_Error(CV_StsError, "The model file is corrupted.");
+        int64 pos = offset + sizeof(header) + static_cast<int64>(header[0]) * sizeof(int);
+        for(int i = 0; i < header[0]; i++) {
+            int size;
+            fetch(pos, &size, sizeof(size));
+            if(size <= 0)
+                CV_Error(CV_StsError, "The model file is corrupted.");
+            pos += sizeof(size) + size;
+        }
+        return pos - offset;
+    }
+
+    // Reads size bytes from the stream.
+    void get(void* data, int64 size) const {
+        if(!_stream->read(static_cast<char*>(data), size))
+            CV_Error(CV_StsError, "The model stream is truncated.");
+        _pos += size;
+    }
+
+    // Reads n bytes from the mapping (at data, which is advanced), or from
+    // the file or the stream if data is 0.
+    void input(const uchar*& data, void* dst, size_t n) const {
+        if(data != 0) {
+            std::memcpy(dst, data, n);
+            data += n;
+        } else if(_stream != 0) {
+            get(dst, n);
+        } else if(!_file.read(static_cast<char*>(dst), n)) {
+            CV_Error(CV_StsError, "The model file is truncated.");
+        }
+    }
+
+    // Reads a compressed section from the mapping (at data), or from the
+    // file or the stream (at the section) if data is 0. Each block is
+    // decoded straight into m. Returns the size of the section, which isn't
+    // known up front for sections written to a stream which can't seek.
+    int64 decompress(const impl::SectionEntry& entry, const uchar* data, Mat& m) const {
+        string name = entry.name;
+        // the size of the section bounds the reads, if it's known
+        int64 limit = (entry.size < 0) ? std::numeric_limits<int64>::max() : entry.size;
+        m.create(entry.rows, entry.cols, entry.type);
+        size_t rawSize = m.total() * m.elemSize();
+        int header[2];
+        input(data, header, sizeof(header));
+        int numBlocks = header[0];
+        size_t blockSize = header[1];
+        int64 size = sizeof(header) + static_cast<int64>(numBlocks) * sizeof(int);
+        if((header[1] <= 0) || (numBlocks < 0)
+                || (static_cast<size_t>(numBlocks) != (rawSize + blockSize - 1) / blockSize) || (size > limit))
+            CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+        vector<int> sizes(numBlocks);
+        if(numBlocks > 0)
+            input(data, &sizes[0], sizes.size() * sizeof(int));
+        vector<uchar> buffer;
+        for(int i = 0; i < numBlocks; i++) {
+            uchar* dst = m.data + i * blockSize;
+            size_t n = std::min(blockSize, rawSize - i * blockSize);
+            int compressed = sizes[i];
+            if(_version >= 4) {
+                // the size in front of the block, the table holds 0 if the
+                // writer couldn't seek
+                size += sizeof(compressed);
+                if(size > limit)
+                    CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+                input(data, &compressed, sizeof(compressed));
+                if((sizes[i] != 0) && (sizes[i] != compressed))
+                    CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+            }
+            size += compressed;
+            if((compressed <= 0) || (size > limit))
+                CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+            size_t blockBytes = static_cast<size_t>(compressed);
+            if(blockBytes > n)
+                CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+            // blocks which didn't get smaller are stored as they are
+            if(blockBytes == n) {
+                input(data, dst, n);
+                continue;
+            }
+            const uchar* block = data;
+            if(data != 0) {
+                data += blockBytes;
+            } else {
+                buffer.resize(blockBytes);
+                input(data, &buffer[0], buffer.size());
+                block = &buffer[0];
+            }
+            if(!impl::lz_decompress(block, blockBytes, dst, n))
+                CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+        }
+        if((entry.size >= 0) && (size != entry.size))
+            CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+        return size;
+    }
+
+    // Reads the next section of the stream, returns false at the end of the
+    // sections.
+    bool next() const {
+        if(_end)
+            return false;
+        char padding[MODEL_ALIGNMENT];
+        get(padding, (MODEL_ALIGNMENT - _pos % MODEL_ALIGNMENT) % MODEL_ALIGNMENT);
+        impl::SectionEntry entry;
+        get(&entry, sizeof(entry));
+        if(entry.name[0] == '\0') {
+            // skip the table, the stream may hold more data
+            for(int i = 0; i < _sections.size(); i++)
+                get(&entry, sizeof(entry));
+            _end = true;
+            return false;
+        }
+        add(entry);
+        Mat m;
+        if(entry.flags & impl::SECTION_COMPRESSED) {
+            _sections.back().size = decompress(entry, 0, m);
+        } else if(entry.size > 0) {
+            m.create(entry.rows, entry.cols, entry.type);
+            if(m.total() * m.elemSize() != entry.size)
+                CV_Error(CV_StsError, "The model stream is corrupted.");
+            get(m.data, entry.size);
+        }
+        _pending[_sections.back().name] = m;
+        return true;
+    }
+
+    // Checks the header and reads the table.
+    void open(const impl::ModelHeader& header) {
+        if(std::memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0)
+            CV_Error(CV_StsError, "Not a binary model file.");
+        if(header.byteOrder != impl::MODEL_BYTE_ORDER)
+            CV_Error(CV_StsError, "The model file was written with another byte order.");
+        if((header.version < 1) || (header.version > MODEL_VERSION))
+            CV_Error(CV_StsError, "Unsupported version of the model file.");
+        _version = header.version;
+        if(_stream != 0) {
+            if(_version < 2)
+                CV_Error(CV_StsError, "Version 1 model files can't be read from a stream.");
+            _pos = sizeof(header);
+            return;
+        }
+        if((_version >= 2) && (header.tableOffset == 0)) {
+            scan();
+            return;
+        }
+        vector<impl::SectionEntry> sections(header.numSections);
+        if(!sections.empty())
+            fetch(header.tableOffset, &sections[0], sections.size() * sizeof(impl::SectionEntry));
+        for(int i = 0; i < sections.size(); i++)
+            add(sections[i]);
+    }
+
+    // Reads the header of a stream.
+    void open(std::istream& stream) {
+        impl::ModelHeader header;
+        if(!stream.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            _end = true;
+            return;
+        }
+        _stream = &stream;
+        open(header);
+    }
+
+public:
+    // Modes of opening a file.
+    enum {
+        READ = 0,
+        MAP = 1
+    };
+
+    // Opens a file for reading, see isOpened.
+    ModelReader(const string& filename, int flags = READ) :
+        _stream(0),
+        _version(0),
+        _pos(0),
+        _end(true) {
+        impl::ModelHeader header;
+        if(flags == MAP) {
+            _mapping = new impl::MappedFile(filename);
+            if(!_mapping->isOpened() || (_mapping->size() < sizeof(header))) {
+                _mapping.release();
+                return;
+            }
+            std::memcpy(&header, _mapping->data(), sizeof(header));
+        } else {
+            _file.open(filename.c_str(), std::ios::binary);
+            if(!_file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+                _file.close();
+                return;
+            }
+        }
+        open(header);
+    }
+
+    // Reads a model from a stream, which must be opened in binary mode. The
+    // stream is read up to the end of the model.
+    explicit ModelReader(std::istream& stream) :
+        _stream(0),
+        _version(0),
+        _pos(0),
+        _end(false) {
+        open(stream);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Reads a model from a file descriptor (a file, a pipe or a socket),
+    // which stays open. Bytes behind the model may be consumed by the
+    // buffer of the reader.
+    explicit ModelReader(int fd) :
+        _buffer(new impl::FdStreamBuf(fd)),
+        _stream(0),
+        _version(0),
+        _pos(0),
+        _end(false) {
+        _fdstream = new std::istream(_buffer);
+        open(*_fdstream);
+    }
+#endif
+
+    // Returns true if the file is open.
+    bool isOpened() const { return _file.is_open() || !_mapping.empty() || (_stream != 0); }
+
+    // Returns the mapping of a file opened with MAP, which must be kept as
+    // long as the matrices read from it are used.
+    Ptr<impl::MappedFile> mapping() const { return _mapping; }
+
+    // Returns the version of the file.
+    int version() const { return _version; }
+
+    // Returns the top-level structure.
+    ModelNode root() const { return ModelNode(this, ""); }
+
+    // Returns the section or nested structure of the given name.
+    ModelNode operator[](const string& name) const { return ModelNode(this, name); }
+
+    // Returns the table entry of a section or 0 if there is no such section.
+    // Streams are read up to the section.
+    const impl::SectionEntry* section(const string& name) const {
+        map<string,int>::const_iterator it = _names.find(name);
+        while((it == _names.end()) && next())
+            it = _names.find(name);
+        return (it == _names.end()) ? 0 : &_sections[it->second];
+    }
+
+    // Returns the names of all sections, streams are read up to the end.
+    vector<string> names() const {
+        while(next()) {}
+        vector<string> result;
+        for(int i = 0; i < _sections.size(); i++)
+            result.push_back(_sections[i].name);
+        return result;
+    }
+
+    // Returns true if there is a section or a nested structure of this name.
+    bool contains(const string& name) const {
+        string prefix = name + "/";
+        for(;;) {
+            if(_names.find(name) != _names.end())
+                return true;
+            map<string,int>::const_iterator it = _names.lower_bound(prefix);
+            if((it != _names.end()) && (it->first.compare(0, prefix.size(), prefix) == 0))
+                return true;
+            if(!next())
+                return false;
+        }
+    }
+
+    // Reads a section into m, missing sections give an empty matrix. The
+    // sections of a mapped file are not copied, m points into the mapping
+    // (unless the section is compressed).
+    void read(const string& name, Mat& m) const {
+        const impl::SectionEntry* entry = section(name);
+        if(entry == 0) {
+            m.release();
+            return;
+        }
+        if(_stream != 0) {
+            map<string,Mat>::iterator it = _pending.find(name);
+            if(it == _pending.end())
+                CV_Error(CV_StsError, "The section " + name + " of the stream was already read.");
+            m = it->second;
+            _pending.erase(it);
+            return;
+        }
+        if(entry->flags & impl::SECTION_COMPRESSED) {
+            if(!_mapping.empty()) {
+                if((entry->offset < 0) || (entry->offset + entry->size > _mapping->size()))
+                    CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+                decompress(*entry, _mapping->data() + entry->offset, m);
+            } else {
+                _file.clear();
+                _file.seekg(entry->offset);
+                decompress(*entry, 0, m);
+            }
+            return;
+        }
+        if(entry->size == 0) {
+            m.release();
+            return;
+        }
+        if(!_mapping.empty()) {
+            if((entry->offset < 0) || (entry->offset + entry->size > _mapping->size()))
+                CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+            Mat section(entry->rows, entry->cols, entry->type, _mapping->data() + entry->offset);
+            if(section.total() * section.elemSize() != entry->size)
+                CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+            m = section;
+            return;
+        }
+        m.create(entry->rows, entry->cols, entry->type);
+        if(m.total() * m.elemSize() != entry->size)
+            CV_Error(CV_StsError, "The section " + name + " is corrupted.");
+        _file.clear();
+        _file.seekg(entry->offset);
+        _file.read(reinterpret_cast<char*>(m.data), entry->size);
+        if(!_file)
+            CV_Error(CV_StsError, "Could not read the section " + name + ".");
+    }
+};
+
+inline bool ModelNode::empty() const {
+    return !_reader->contains(_name);
+}
+
+inline void ModelNode::read(Mat& m) const {
+    _reader->read(_name, m);
+}
+
+// Reads sections like cv::FileNode, missing sections give the default value.
+inline void operator>>(const ModelNode& node, Mat& value) {
+    node.read(value);
+}
+
+inline void operator>>(const ModelNode& node, int& value) {
+    Mat m;
+    node.read(m);
+    value = m.empty() ? 0 : m.reshape(1,1).at<int>(0);
+}
+
+inline void operator>>(const ModelNode& node, double& value) {
+    Mat m;
+    node.read(m);
+    value = m.empty() ? 0.0 : m.reshape(1,1).at<double>(0);
+}
+
+inline void operator>>(const ModelNode& node, string& value) {
+    Mat m;
+    node.read(m);
+    value = m.empty() ? string() : string(m.ptr<char>(), m.total());
+}
+
+template<typename _Tp>
+inline void operator>>(const ModelNode& node, vector<_Tp>& value) {
+    Mat m;
+    node.read(m);
+    value.clear();
+    if(!m.empty()) {
+        Mat_<_Tp> v = m.reshape(1,1);
+        value.assign(v.begin(), v.end());
+    }
+}
+
+// Appends a sequence to result, see readFileNodeList.
+template<typename _Tp>
+inline void readFileNodeList(const ModelNode& fn, vector<_Tp>& result) {
+    vector<_Tp> items;
+    fn >> items;
+    result.insert(result.end(), items.begin(), items.end());
+}
+
+// Writes a sequence as a single section, see writeFileNodeList.
+template<typename _Tp>
+inline void writeFileNodeList(ModelWriter& fs, const string& name, const vector<_Tp>& items) {
+    fs.write(name, items);
+}
+
+// Writes a matrix which is worth compressing, see ModelWriter::compress.
+// cv::FileStorage writes it as it is.
+inline void writeCompressed(FileStorage& fs, const string& name, const Mat& m) {
+    fs << name << m;
+}
+
+inline void writeCompressed(ModelWriter& fs, const string& name, const Mat& m) {
+    fs.compress(name, m);
+}
+
+// A binary model file opened for inspection. Only the header and the table
+// are read on opening, each section is read on its first access and kept,
+// so tools which only need a part of a model (the eigenvectors, the labels,
+// the number of samples) don't pay for the rest of it:
+//
+//      ModelFile model("fisherfaces.bin");
+//      Mat W = model.mat("eigenvectors");
+//      int numSamples = model.size("projections").height;
+class ModelFile {
+
+private:
+    ModelReader _reader;
+    mutable map<string,Mat> _cache;
+
+public:
+    // Opens a file, see ModelReader for the flags.
+    ModelFile(const string& filename, int flags = ModelReader::READ) :
+        _reader(filename, flags) {}
+
+    // Returns true if the file is open.
+    bool isOpened() const { return _reader.isOpened(); }
+
+    // Returns the reader of the file.
+    const ModelReader& reader() const { return _reader; }
+
+    // Returns the names of all sections.
+    vector<string> names() const { return _reader.names(); }
+
+    // Returns true if there is a section or a nested structure of this name.
+    bool contains(const string& name) const { return _reader.contains(name); }
+
+    // Returns the size of a section without reading it, missing sections
+    // have an empty size.
+    Size size(const string& name) const {
+        const impl::SectionEntry* entry = _reader.section(name);
+        return entry ? Size(entry->cols, entry->rows) : Size();
+    }
+
+    // Returns the type of a section without reading it, or -1 if there is
+    // no such section.
+    int type(const string& name) const {
+        const impl::SectionEntry* entry = _reader.section(name);
+        return entry ? entry->type : -1;
+    }
+
+    // Returns a section, which is read on the first access. Missing sections
+    // give an empty matrix.
+    Mat mat(const string& name) const {
+        map<string,Mat>::iterator it = _cache.find(name);
+        if(it != _cache.end())
+            return it->second;
+        Mat m;
+        _reader.read(name, m);
+        _cache[name] = m;
+        return m;
+    }
+
+    // Reads a scalar, string or vector section, like a ModelNode.
+    template<typename _Tp>
+    void read(const string& name, _Tp& value) const {
+        _reader[name] >> value;
+    }
+
+    // Drops the sections read so far.
+    void release() { _cache.clear(); }
+};
+
+} // namespace cv
+
+#endif
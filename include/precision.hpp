@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2011. Philipp Wagner <bytefish[at]gmx[dot]de>.
+ * Released to public domain under terms of the BSD Simplified license.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the organization nor the names of its contributors
+ *     may be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ *   See <http://www.opensource.org/licenses/bsd-license>
+ */
+
+#ifndef __PRECISION_HPP__
+#define __PRECISION_HPP__
+
+#include "opencv2/opencv.hpp"
+#include "distance.hpp"
+#include "subspace.hpp"
+
+#include <cmath>
+
+using namespace std;
+
+namespace cv {
+
+// A matrix of doubles stored with a reduced precision:
+//
+//      FLOAT64     CV_64FC1, unchanged
+//      FLOAT16     half floats (impl::float16) as CV_16UC1
+//      INT8        CV_8SC1 with a scale per row, the values are scale*code
+//
+// The rows are decoded on the fly by the kernels of impl (sqeuclidean,
+// axpy), so the distance to a packed row or the projection on a packed
+// basis never expands the matrix back to doubles. Halves keep about three
+// decimal digits, the int8 codes 1/254 of the largest value of their row.
+class PackedMat {
+
+private:
+    int _precision;
+    Mat _data;
+    // scales of the rows (CV_64FC1, a column), INT8 only
+    Mat _scales;
+
+    // Packs the rows of src (CV_64FC1) into data and scales.
+    void pack(const Mat& src, Mat& data, Mat& scales) const {
+        switch(_precision) {
+        case FLOAT16:
+            data.create(src.rows, src.cols, CV_16UC1);
+            for(int i = 0; i < src.rows; i++) {
+                const double* p = src.ptr<double>(i);
+                impl::float16* h = data.ptr<impl::float16>(i);
+                for(int j = 0; j < src.cols; j++)
+                    h[j] = impl::to_float16(static_cast<float>(p[j]));
+            }
+            break;
+        case INT8:
+            data.create(src.rows, src.cols, CV_8SC1);
+            scales.create(src.rows, 1, CV_64FC1);
+            for(int i = 0; i < src.rows; i++) {
+                const double* p = src.ptr<double>(i);
+                double maxVal = 0.0;
+                for(int j = 0; j < src.cols; j++)
+                    maxVal = std::max(maxVal, std::abs(p[j]));
+                double scale = maxVal / 127.0;
+                scales.at<double>(i) = scale;
+                schar* c = data.ptr<schar>(i);
+                for(int j = 0; j < src.cols; j++)
+                    c[j] = (scale > 0.0) ? static_cast<schar>(cvRound(p[j] / scale)) : 0;
+            }
+            break;
+        default:
+            data = src;
+        }
+    }
+
+public:
+    // Available precisions.
+    enum {
+        FLOAT64 = 0,
+        FLOAT16 = 1,
+        INT8 = 2
+    };
+
+    // Initializes an empty matrix of the given precision.
+    PackedMat(int precision = FLOAT64) :
+        _precision(precision) {
+        if((precision != FLOAT64) && (precision != FLOAT16) && (precision != INT8))
+            CV_Error(CV_StsBadArg, "Unknown precision.");
+    }
+
+    // Packs the rows of src with the given precision. Continuous CV_64FC1
+    // matrices are shared with FLOAT64.
+    PackedMat(const Mat& src, int precision) :
+        _precision(precision) {
+        if((precision != FLOAT64) && (precision != FLOAT16) && (precision != INT8))
+            CV_Error(CV_StsBadArg, "Unknown precision.");
+        push_back(src);
+    }
+
+    int precision() const { return _precision; }
+
+    int rows() const { return _data.rows; }
+
+    int cols() const { return _data.cols; }
+
+    bool empty() const { return _data.empty(); }
+
+    // Returns the number of bytes allocated by this matrix.
+    size_t memory() const {
+        return _data.total()*_data.elemSize() + _scales.total()*sizeof(double);
+    }
+
+    // Returns the packed data.
+    const Mat& data() const { return _data; }
+
+    // Returns the scale of row i, which is 1 unless the precision is INT8.
+    double scale(int i) const {
+        return _scales.empty() ? 1.0 : _scales.at<double>(i);
+    }
+
+    // Appends the rows of src.
+    void push_back(const Mat& src) {
+        if(src.empty())
+            return;
+        Mat X, data, scales;
+        if((src.type() == CV_64FC1) && src.isContinuous())
+            X = src;
+        else
+            src.convertTo(X, CV_64FC1);
+        pack(X, data, scales);
+        if(_data.empty()) {
+            _data = data;
+            _scales = scales;
+        } else {
+            _data.push_back(data);
+            if(!scales.empty())
+                _scales.push_back(scales);
+        }
+    }
+
+    void clear() {
+        _data.release();
+        _scales.release();
+    }
+
+    // Returns the decoded matrix (CV_64FC1), which shares the data with
+    // FLOAT64.
+    Mat unpack() const {
+        if(_precision == FLOAT64)
+            return _data;
+        return unpack(0, _data.rows);
+    }
+
+    // Returns the decoded rows begin..end-1, see unpack.
+    Mat unpack(int begin, int end) const {
+        if(_precision == FLOAT64)
+            return _data.rowRange(begin, end);
+        Mat dst = Mat::zeros(end - begin, _data.cols, CV_64FC1);
+        for(int i = begin; i < end; i++)
+            axpy(i, 1.0, dst.ptr<double>(i - begin));
+        return dst;
+    }
+
+    // Squared Euclidean distance of the n elements of row i starting at
+    // column begin to a query q (which starts at the same column).
+    double sqeuclidean(int i, const double* q, int begin, int n) const {
+        switch(_precision) {
+        case FLOAT16: return impl::sqeuclidean(_data.ptr<impl::float16>(i) + begin, q, n);
+        case INT8: return impl::sqeuclidean(_data.ptr<schar>(i) + begin, scale(i), q, n);
+        default: return impl::sqeuclidean(_data.ptr<double>(i) + begin, q, n);
+        }
+    }
+
+    // Adds a times row i to y.
+    void axpy(int i, double a, double* y) const {
+        switch(_precision) {
+        case FLOAT16: impl::axpy(_data.ptr<impl::float16>(i), a, y, _data.cols); break;
+        case INT8: impl::axpy(_data.ptr<schar>(i), a * scale(i), y, _data.cols); break;
+        default: {
+            const double* p = _data.ptr<double>(i);
+            for(int j = 0; j < _data.cols; j++)
+                y[j] += a * p[j];
+        }
+        }
+    }
+
+    // Serializes the packed data as name (and the scales as name_scales) to
+    // a given cv::FileStorage (or ModelWriter).
+    template<typename _Storage>
+    void save(_Storage& fs, const string& name) const {
+        fs << name << _data;
+        if(_precision == INT8)
+            fs << name + "_scales" << _scales;
+    }
+
+    // Deserializes name from a given cv::FileNode (or ModelNode), the
+    // precision is given by the type of the data.
+    template<typename _Node>
+    void load(const _Node& fn, const string& name) {
+        Mat data;
+        fn[name] >> data;
+        _scales.release();
+        if(data.type() == CV_16UC1) {
+            _precision = FLOAT16;
+            _data = data;
+        } else if(data.type() == CV_8SC1) {
+            _precision = INT8;
+            _data = data;
+            fn[name + "_scales"] >> _scales;
+            if(_scales.total() != _data.rows)
+                CV_Error(CV_StsError, "The scales of " + name + " are missing.");
+            _scales = _scales.reshape(1, _data.rows);
+        } else {
+            _precision = FLOAT64;
+            _data.release();
+            push_back(data);
+        }
+    }
+};
+
+// Projects the rows of src on the columns of W, see subspace::project. The
+// packed basis is decoded row by row while accumulating the projection.
+inline Mat project(const PackedMat& W, const Mat& mean, const Mat& src) {
+    if(W.precision() == PackedMat::FLOAT64)
+        return subspace::project(W.data(), mean, src);
+    Mat X, M;
+    src.convertTo(X, CV_64FC1);
+    mean.reshape(1,1).convertTo(M, CV_64FC1);
+    Mat Y = Mat::zeros(X.rows, W.cols(), CV_64FC1);
+    const double* m = (M.total() == X.cols) ? M.ptr<double>() : 0;
+    for(int sampleIdx = 0; sampleIdx < X.rows; sampleIdx++) {
+        const double* x = X.ptr<double>(sampleIdx);
+        double* y = Y.ptr<double>(sampleIdx);
+        for(int i = 0; i < X.cols; i++)
+            W.axpy(i, m ? x[i] - m[i] : x[i], y);
+    }
+    return Y;
+}
+
+} // namespace cv
+
+#endif
@@ -0,0 +1,178 @@
+#include "test_precomp.hpp"
+#include "opencv2/opencv.hpp"
+#include "opencv2/ts/ts.hpp"
+
+// some helper methods for testing
+#include "test_funs.hpp"
+
+// includes objects under test
+#include "distance.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The fixture for testing the histogram distances.
+class DistanceTest : public ::testing::Test {
+ protected:
+
+  // Once setup for all tests.
+  DistanceTest() {
+      // Two sparse histograms with an odd number of bins, so both the
+      // vectorized and the remaining scalar part are used.
+      t_ = Mat::zeros(1, 131, CV_32FC1);
+      q_ = Mat::zeros(1, 131, CV_32FC1);
+      for(int i = 0; i < 131; i++) {
+          if(i % 3 == 0)
+              t_.at<float>(0,i) = 0.01f * (i % 7 + 1);
+          if(i % 5 == 0)
+              q_.at<float>(0,i) = 0.02f * (i % 4 + 1);
+      }
+  }
+
+  virtual ~DistanceTest() {}
+
+  virtual void SetUp() {}
+
+  virtual void TearDown() {}
+
+  // Objects declared here can be used by all tests in the test case.
+  Mat t_;
+  Mat q_;
+};
+
+TEST_F(DistanceTest, checkChiSquareEqualsCompareHist) {
+    double expected = compareHist(t_, q_, CV_COMP_CHISQR);
+    double actual = chisquare(t_, q_);
+    ASSERT_NEAR(expected, actual, 1e-5);
+}
+
+TEST_F(DistanceTest, checkChiSquareIdentical) {
+    ASSERT_NEAR(0.0, chisquare(t_, t_), 1e-10);
+}
+
+TEST_F(DistanceTest, checkChiSquareEarlyTermination) {
+    double full = chisquare(t_, q_);
+    // a bound larger than the distance gives the full distance
+    ASSERT_NEAR(full, chisquare(t_, q_, full + 1.0), 1e-10);
+    // a smaller bound gives a partial distance that still exceeds the bound
+    double partial = chisquare(t_, q_, 1e-3);
+    ASSERT_GT(partial, 1e-3);
+    ASSERT_LE(partial, full + 1e-10);
+}
+
+TEST_F(DistanceTest, checkChiSquareThrow) {
+    Mat mDouble = Mat::zeros(1, 131, CV_64FC1);
+    Mat mShort = Mat::zeros(1, 130, CV_32FC1);
+    ASSERT_ANY_THROW(chisquare(mDouble, q_));
+    ASSERT_ANY_THROW(chisquare(t_, mShort));
+}
+
+TEST_F(DistanceTest, checkChiSquareCounts) {
+    // integer counts with zero bins in both histograms
+    Mat t = Mat::zeros(1, 131, CV_16UC1);
+    Mat q = Mat::zeros(1, 131, CV_16UC1);
+    double expected = 0.0;
+    for(int i = 0; i < 131; i++) {
+        int a = (i % 3 == 0) ? (i * 7) % 200 : 0;
+        int b = (i % 5 == 0) ? (i * 11) % 250 : 0;
+        t.at<unsigned short>(0,i) = a;
+        q.at<unsigned short>(0,i) = b;
+        if(a != 0)
+            expected += (a - b) * (a - b) / static_cast<double>(a);
+    }
+    Mat t8, q8;
+    t.convertTo(t8, CV_8UC1);
+    q.convertTo(q8, CV_8UC1);
+    double actual16 = cv::impl::chisquare(t.ptr<unsigned short>(), q.ptr<unsigned short>(), 131);
+    double actual8 = cv::impl::chisquare(t8.ptr<unsigned char>(), q8.ptr<unsigned char>(), 131);
+    // the terms are summed up in double precision
+    ASSERT_NEAR(expected, actual16, 1e-12 * expected);
+    ASSERT_NEAR(expected, actual8, 1e-12 * expected);
+}
+
+TEST_F(DistanceTest, checkMetricKernels) {
+    const float* t = t_.ptr<float>();
+    const float* q = q_.ptr<float>();
+    // the vectorized kernels equal the sum of their terms
+    ASSERT_NEAR(cv::impl::sum_terms<cv::impl::ChiSquareTerm>(t, q, 131), cv::impl::ChiSquareTerm::cell(t, q, 131), 1e-5);
+    ASSERT_NEAR(cv::impl::sum_terms<cv::impl::IntersectionTerm>(t, q, 131), cv::impl::intersection(t, q, 131), 1e-6);
+    ASSERT_NEAR(cv::impl::sum_terms<cv::impl::L1Term>(t, q, 131), cv::impl::l1(t, q, 131), 1e-6);
+    ASSERT_NEAR(norm(t_, q_, NORM_L1), cv::impl::l1(t, q, 131), 1e-5);
+    ASSERT_NEAR(0.0, cv::impl::intersection(t, t, 131), 1e-10);
+    ASSERT_NEAR(0.0, cv::impl::l1(t, t, 131), 1e-10);
+}
+
+TEST_F(DistanceTest, checkIntegerMetricKernels) {
+    // counts over the whole range, including the saturation of the 8-bit terms
+    Mat t = Mat::zeros(1, 131, CV_16UC1);
+    Mat q = Mat::zeros(1, 131, CV_16UC1);
+    for(int i = 0; i < 131; i++) {
+        t.at<unsigned short>(0,i) = (i * 37) % 256;
+        q.at<unsigned short>(0,i) = (i * 101 + 13) % 256;
+    }
+    Mat t8, q8;
+    t.convertTo(t8, CV_8UC1);
+    q.convertTo(q8, CV_8UC1);
+    const unsigned short* t16 = t.ptr<unsigned short>();
+    const unsigned short* q16 = q.ptr<unsigned short>();
+    ASSERT_EQ(cv::impl::sum_terms<cv::impl::IntersectionTerm>(t16, q16, 131), cv::impl::intersection(t16, q16, 131));
+    ASSERT_EQ(cv::impl::sum_terms<cv::impl::L1Term>(t16, q16, 131), cv::impl::l1(t16, q16, 131));
+    ASSERT_EQ(cv::impl::intersection(t16, q16, 131), cv::impl::intersection(t8.ptr<unsigned char>(), q8.ptr<unsigned char>(), 131));
+    ASSERT_EQ(cv::impl::l1(t16, q16, 131), cv::impl::l1(t8.ptr<unsigned char>(), q8.ptr<unsigned char>(), 131));
+    // large 16-bit counts
+    t.setTo(Scalar(65535));
+    ASSERT_EQ(cv::impl::sum_terms<cv::impl::IntersectionTerm>(t16, q16, 131), cv::impl::intersection(t16, q16, 131));
+    ASSERT_EQ(cv::impl::sum_terms<cv::impl::L1Term>(q16, t16, 131), cv::impl::l1(q16, t16, 131));
+}
+
+TEST_F(DistanceTest, checkSquaredEuclidean) {
+    const float* t = t_.ptr<float>();
+    const float* q = q_.ptr<float>();
+    double expected = norm(t_, q_, NORM_L2);
+    double full = cv::impl::sqeuclidean(t, q, 131);
+    ASSERT_NEAR(expected * expected, full, 1e-6);
+    ASSERT_NEAR(full, cv::impl::sqeuclidean(t, q, 131, full + 1.0), 1e-10);
+    ASSERT_GT(cv::impl::sqeuclidean(t, q, 131, 1e-4), 1e-4);
+}
+
+TEST_F(DistanceTest, checkFloat16) {
+    // representable values are exact
+    float exact[] = { 0.0f, 1.0f, -2.5f, 65504.0f, 6.103515625e-05f, 5.9604644775390625e-08f };
+    for(int i = 0; i < 6; i++)
+        ASSERT_EQ(exact[i], cv::impl::to_float(cv::impl::to_float16(exact[i])));
+    // ties go to even
+    ASSERT_EQ(1.0f, cv::impl::to_float(cv::impl::to_float16(1.0f + 1.0f/2048)));
+    ASSERT_EQ(1.0f + 2.0f/1024, cv::impl::to_float(cv::impl::to_float16(1.0f + 3.0f/2048)));
+    // overflows give infinity, tiny values zero
+    ASSERT_EQ(0x7c00, cv::impl::to_float16(70000.0f).bits);
+    ASSERT_EQ(0x8000, cv::impl::to_float16(-1e-10f).bits);
+    // the relative error of normal values is at most 2^-11
+    for(int i = 1; i < 1000; i++) {
+        float v = 0.37f * i;
+        ASSERT_NEAR(v, cv::impl::to_float(cv::impl::to_float16(v)), v / 2048);
+    }
+}
+
+TEST_F(DistanceTest, checkPackedKernels) {
+    const float* t = t_.ptr<float>();
+    vector<double> q(131);
+    vector<cv::impl::float16> h(131);
+    vector<schar> c(131);
+    vector<double> decodedHalf(131), decodedInt(131);
+    double scale = 0.01;
+    for(int i = 0; i < 131; i++) {
+        q[i] = q_.at<float>(0,i);
+        h[i] = cv::impl::to_float16(t[i]);
+        c[i] = static_cast<schar>(cvRound(t[i] / scale));
+        decodedHalf[i] = cv::impl::to_float(h[i]);
+        decodedInt[i] = scale * c[i];
+    }
+    ASSERT_NEAR(cv::impl::sqeuclidean(&decodedHalf[0], &q[0], 131),
+            cv::impl::sqeuclidean(&h[0], &q[0], 131), 1e-10);
+    ASSERT_NEAR(cv::impl::sqeuclidean(&decodedInt[0], &q[0], 131),
+            cv::impl::sqeuclidean(&c[0], scale, &q[0], 131), 1e-10);
+    vector<double> y(131, 1.0);
+    cv::impl::axpy(&h[0], 2.0, &y[0], 131);
+    for(int i = 0; i < 131; i++)
+        ASSERT_NEAR(1.0 + 2.0 * decodedHalf[i], y[i], 1e-10);
+}
@@ -0,0 +1,359 @@
+#include "test_precomp.hpp"
+#include "opencv2/opencv.hpp"
+#include "opencv2/ts/ts.hpp"
+
+// some helper methods for testing
+#include "test_funs.hpp"
+
+// includes objects under test
+#include "gallery.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The fixture for testing the template galleries.
+class GalleryTest : public ::testing::Test {
+ protected:
+
+  // Once setup for all tests.
+  GalleryTest() {
+      // 3 templates and a query (raw counts), each with 4 cells of 8 bins
+      for(int i = 0; i < 4; i++) {
+          Mat h = Mat::zeros(1, 32, CV_32FC1);
+          for(int c = 0; c < 4; c++) {
+              h.at<float>(0, c*8 + (i+c) % 8) = 2;
+              h.at<float>(0, c*8 + (i*3+c) % 8) += 1;
+              h.at<float>(0, c*8 + 7) += 1;
+          }
+          if(i < 3)
+              templates_.push_back(h);
+          else
+              query_ = h;
+      }
+  }
+
+  virtual ~GalleryTest() {}
+
+  virtual void SetUp() {}
+
+  virtual void TearDown() {}
+
+  // Objects declared here can be used by all tests in the test case.
+  vector<Mat> templates_;
+  Mat query_;
+};
+
+TEST_F(GalleryTest, checkSparseEqualsDense) {
+    Ptr<HistogramGallery> dense = createHistogramGallery(HistogramGallery::DENSE, 8);
+    Ptr<HistogramGallery> sparse = createHistogramGallery(HistogramGallery::SPARSE, 8);
+    for(int i = 0; i < templates_.size(); i++) {
+        dense->add(templates_[i]);
+        sparse->add(templates_[i]);
+    }
+    ASSERT_EQ(3, dense->size());
+    ASSERT_EQ(3, sparse->size());
+    HistogramQuery query = dense->query(query_);
+    for(int i = 0; i < templates_.size(); i++) {
+        ASSERT_TRUE(isEqual(dense->histogram(i), sparse->histogram(i)));
+        double expected = dense->distance(i, query, DBL_MAX);
+        ASSERT_NEAR(expected, sparse->distance(i, sparse->query(query_), DBL_MAX), 1e-6);
+    }
+}
+
+TEST_F(GalleryTest, checkQuantizedEqualsDense) {
+    Ptr<HistogramGallery> dense = createHistogramGallery(HistogramGallery::DENSE, 8);
+    Ptr<HistogramGallery> q8 = createHistogramGallery(HistogramGallery::QUANTIZED_8U, 8);
+    Ptr<HistogramGallery> q16 = createHistogramGallery(HistogramGallery::QUANTIZED_16U, 8);
+    for(int i = 0; i < templates_.size(); i++) {
+        dense->add(templates_[i]);
+        q8->add(templates_[i]);
+        q16->add(templates_[i]);
+    }
+    for(int i = 0; i < templates_.size(); i++) {
+        double expected = dense->distance(i, dense->query(query_), DBL_MAX);
+        ASSERT_NEAR(expected, q8->distance(i, q8->query(query_), DBL_MAX), 1e-5);
+        ASSERT_NEAR(expected, q16->distance(i, q16->query(query_), DBL_MAX), 1e-5);
+        ASSERT_TRUE(isEqual(dense->histogram(i), q8->histogram(i), 1e-6));
+    }
+    // normalized histograms can't be stored as counts
+    Mat normed;
+    templates_[0].convertTo(normed, CV_32FC1, 0.25);
+    ASSERT_ANY_THROW(q8->add(normed));
+}
+
+TEST_F(GalleryTest, checkMetricsEqualAcrossFormats) {
+    int metrics[] = { HistogramMetric::CHISQUARE, HistogramMetric::INTERSECTION,
+            HistogramMetric::L1, HistogramMetric::LOG_LIKELIHOOD };
+    for(int m = 0; m < 4; m++) {
+        HistogramMetric metric(metrics[m]);
+        Ptr<HistogramGallery> dense = createHistogramGallery(HistogramGallery::DENSE, 8, metric);
+        Ptr<HistogramGallery> sparse = createHistogramGallery(HistogramGallery::SPARSE, 8, metric);
+        Ptr<HistogramGallery> q8 = createHistogramGallery(HistogramGallery::QUANTIZED_8U, 8, metric);
+        for(int i = 0; i < templates_.size(); i++) {
+            dense->add(templates_[i]);
+            sparse->add(templates_[i]);
+            q8->add(templates_[i]);
+        }
+        for(int i = 0; i < templates_.size(); i++) {
+            double expected = dense->distance(i, dense->query(query_), DBL_MAX);
+            ASSERT_GT(expected, 0.0);
+            // the log-likelihood of a template itself is its entropy
+            if(metrics[m] != HistogramMetric::LOG_LIKELIHOOD)
+                ASSERT_NEAR(0.0, dense->distance(i, dense->query(templates_[i]), DBL_MAX), 1e-6);
+            ASSERT_NEAR(expected, sparse->distance(i, sparse->query(query_), DBL_MAX), 1e-5);
+            ASSERT_NEAR(expected, q8->distance(i, q8->query(query_), DBL_MAX), 1e-5);
+        }
+    }
+}
+
+TEST_F(GalleryTest, checkWeightedChiSquare) {
+    Mat weights = Mat::zeros(1, 4, CV_32FC1);
+    weights.at<float>(0,1) = 2.0f;
+    Ptr<HistogramGallery> plain = createHistogramGallery(HistogramGallery::DENSE, 8);
+    Ptr<HistogramGallery> weighted = createHistogramGallery(HistogramGallery::SPARSE, 8,
+            HistogramMetric(HistogramMetric::WEIGHTED_CHISQUARE, weights));
+    // only the second cell is weighted
+    Mat cell = Mat::zeros(1, 32, CV_32FC1);
+    Mat query = Mat::zeros(1, 32, CV_32FC1);
+    Mat cellDst = cell.colRange(8, 16);
+    Mat queryDst = query.colRange(8, 16);
+    templates_[0].colRange(8, 16).copyTo(cellDst);
+    query_.colRange(8, 16).copyTo(queryDst);
+    plain->add(cell);
+    weighted->add(templates_[0]);
+    double expected = 2.0 * plain->distance(0, plain->query(query), DBL_MAX);
+    ASSERT_NEAR(expected, weighted->distance(0, weighted->query(query_), DBL_MAX), 1e-5);
+    // weights are required and must match the cells
+    ASSERT_ANY_THROW(HistogramMetric(HistogramMetric::WEIGHTED_CHISQUARE));
+    ASSERT_ANY_THROW(HistogramMetric(7));
+    Ptr<HistogramGallery> wrong = createHistogramGallery(HistogramGallery::DENSE, 8,
+            HistogramMetric(HistogramMetric::WEIGHTED_CHISQUARE, Mat::ones(1, 3, CV_32FC1)));
+    ASSERT_ANY_THROW(wrong->add(templates_[0]));
+}
+
+TEST_F(GalleryTest, checkSparseClear) {
+    SparseHistogramGallery gallery(8);
+    gallery.add(templates_[0]);
+    gallery.clear();
+    ASSERT_EQ(0, gallery.size());
+    ASSERT_ANY_THROW(gallery.add(Mat::zeros(1, 30, CV_32FC1)));
+}
+
+TEST_F(GalleryTest, checkHistogramProjection) {
+    HistogramProjection projection(8, HistogramMetric(), 0);
+    projection.compute(templates_);
+    ASSERT_EQ(3, projection.num_components());
+    Mat projected = projection.project(asRowMatrix(templates_, CV_32FC1));
+    ASSERT_EQ(3, projected.rows);
+    ASSERT_EQ(CV_32FC1, projected.type());
+    // all components keep the Hellinger distance of the templates
+    Ptr<HistogramGallery> dense = createHistogramGallery(HistogramGallery::DENSE, 8);
+    for(int i = 0; i < templates_.size(); i++)
+        dense->add(templates_[i]);
+    for(int i = 0; i < templates_.size(); i++) {
+        for(int j = 0; j < templates_.size(); j++) {
+            Mat t = dense->histogram(i), q = dense->histogram(j);
+            double expected = 0.0;
+            for(int b = 0; b < t.cols; b++) {
+                double d = std::sqrt(t.at<float>(0,b)) - std::sqrt(q.at<float>(0,b));
+                expected += d*d;
+            }
+            double actual = cv::impl::sqeuclidean(projected.ptr<float>(i), projected.ptr<float>(j), projected.cols);
+            ASSERT_NEAR(expected, actual, 1e-4);
+        }
+    }
+}
+
+TEST_F(GalleryTest, checkCascadeQuantized) {
+    // cells of 4 bins, the counts of the query saturate CV_8U
+    Mat templ = Mat::zeros(1, 16, CV_32FC1);
+    Mat hist = Mat::zeros(1, 16, CV_32FC1);
+    for(int b = 0; b < 16; b++) {
+        templ.at<float>(0, b) = (float) (b % 5 + 1);
+        hist.at<float>(0, b) = (b % 3 == 0) ? 600.0f : (float) (b % 4);
+    }
+    int metrics[] = { HistogramMetric::CHISQUARE, HistogramMetric::INTERSECTION,
+            HistogramMetric::L1, HistogramMetric::LOG_LIKELIHOOD };
+    int formats[] = { HistogramGallery::QUANTIZED_8U, HistogramGallery::QUANTIZED_16U };
+    for(int f = 0; f < 2; f++) {
+        for(int m = 0; m < 4; m++) {
+            HistogramMetric metric(metrics[m]);
+            Ptr<HistogramGallery> gallery = createHistogramGallery(formats[f], 4, metric);
+            gallery->add(templ);
+            gallery->add(hist);
+            HistogramCascade cascade(4, metric, 2);
+            cascade.compute(*gallery);
+            ASSERT_FALSE(cascade.empty());
+            HistogramQuery query = gallery->query(hist);
+            HistogramQuery coarse = cascade.query(query);
+            for(int i = 0; i < gallery->size(); i++)
+                ASSERT_LE(cascade.bound(i, coarse), gallery->distance(i, query, DBL_MAX));
+        }
+    }
+}
+
+TEST_F(GalleryTest, checkCascadeWideCells) {
+    // cells of 59 and 256 bins use the vectorized kernels, the templates come
+    // in pairs, which differ in a single count, so their distances are close
+    int patterns[] = { 59, 256 };
+    int formats[] = { HistogramGallery::DENSE, HistogramGallery::SPARSE,
+            HistogramGallery::QUANTIZED_8U, HistogramGallery::QUANTIZED_16U };
+    int metrics[] = { HistogramMetric::CHISQUARE, HistogramMetric::INTERSECTION,
+            HistogramMetric::L1, HistogramMetric::LOG_LIKELIHOOD };
+    RNG rng(13);
+    for(int p = 0; p < 2; p++) {
+        int n = patterns[p];
+        vector<Mat> hists;
+        for(int i = 0; i < 20; i++) {
+            Mat h(1, 16*n, CV_32FC1);
+            for(int b = 0; b < h.cols; b++)
+                h.at<float>(0, b) = (float) rng.uniform(0, 300);
+            hists.push_back(h);
+            Mat twin = h.clone();
+            twin.at<float>(0, i) += 1.0f;
+            hists.push_back(twin);
+        }
+        for(int f = 0; f < 4; f++) {
+            for(int m = 0; m < 4; m++) {
+                HistogramMetric metric(metrics[m]);
+                Ptr<HistogramGallery> gallery = createHistogramGallery(formats[f], n, metric);
+                for(int i = 0; i < hists.size(); i++)
+                    gallery->add(hists[i]);
+                HistogramCascade cascade(n, metric);
+                cascade.compute(*gallery);
+                ASSERT_FALSE(cascade.empty());
+                for(int i = 0; i < hists.size(); i++) {
+                    HistogramQuery query = gallery->query(hists[i]);
+                    HistogramQuery coarse = cascade.query(query);
+                    // exhaustive search
+                    double minDist = DBL_MAX;
+                    int expected = -1;
+                    vector<pair<double,int> > candidates;
+                    for(int j = 0; j < gallery->size(); j++) {
+                        double dist = gallery->distance(j, query, DBL_MAX);
+                        double bound = cascade.bound(j, coarse);
+                        ASSERT_LE(bound, dist);
+                        candidates.push_back(make_pair(bound, j));
+                        if(dist < minDist) {
+                            minDist = dist;
+                            expected = j;
+                        }
+                    }
+                    // search in the order of the bounds, see LBPH::predict
+                    std::sort(candidates.begin(), candidates.end());
+                    minDist = DBL_MAX;
+                    int actual = -1;
+                    for(int k = 0; (k < candidates.size()) && (candidates[k].first <= minDist); k++) {
+                        int j = candidates[k].second;
+                        double dist = gallery->distance(j, query, minDist);
+                        if((dist < minDist) || ((dist == minDist) && (j < actual))) {
+                            minDist = dist;
+                            actual = j;
+                        }
+                    }
+                    ASSERT_EQ(expected, actual);
+                }
+            }
+        }
+    }
+}
+
+TEST_F(GalleryTest, checkCascadeSaturated) {
+    // counts beyond 65535 saturate both quantized formats, the bounds of the
+    // cascade stay below the distances and the search stays exact
+    int formats[] = { HistogramGallery::DENSE, HistogramGallery::SPARSE,
+            HistogramGallery::QUANTIZED_8U, HistogramGallery::QUANTIZED_16U };
+    int metrics[] = { HistogramMetric::CHISQUARE, HistogramMetric::WEIGHTED_CHISQUARE,
+            HistogramMetric::INTERSECTION, HistogramMetric::L1, HistogramMetric::LOG_LIKELIHOOD };
+    RNG rng(17);
+    vector<Mat> hists;
+    for(int i = 0; i < 30; i++) {
+        Mat h(1, 16*59, CV_32FC1);
+        for(int b = 0; b < h.cols; b++) {
+            int r = rng.uniform(0, 10);
+            h.at<float>(0, b) = (float) ((r == 0) ? rng.uniform(60000, 100000) : (r < 3) ? rng.uniform(200, 400) : r);
+        }
+        hists.push_back(h);
+    }
+    Mat weights(1, 16, CV_32FC1);
+    for(int c = 0; c < 16; c++)
+        weights.at<float>(0, c) = (float) (c % 4 + 1);
+    for(int f = 0; f < 4; f++) {
+        for(int m = 0; m < 5; m++) {
+            HistogramMetric metric(metrics[m], weights);
+            Ptr<HistogramGallery> gallery = createHistogramGallery(formats[f], 59, metric);
+            for(int i = 0; i < 20; i++)
+                gallery->add(hists[i]);
+            HistogramCascade cascade(59, metric);
+            cascade.compute(*gallery);
+            ASSERT_FALSE(cascade.empty());
+            for(int i = 0; i < hists.size(); i++) {
+                HistogramQuery query = gallery->query(hists[i]);
+                HistogramQuery coarse = cascade.query(query);
+                double minDist = DBL_MAX;
+                int expected = -1;
+                vector<pair<double,int> > candidates;
+                for(int j = 0; j < gallery->size(); j++) {
+                    double dist = gallery->distance(j, query, DBL_MAX);
+                    double bound = cascade.bound(j, coarse);
+                    ASSERT_LE(bound, dist);
+                    candidates.push_back(make_pair(bound, j));
+                    if(dist < minDist) {
+                        minDist = dist;
+                        expected = j;
+                    }
+                }
+                std::sort(candidates.begin(), candidates.end());
+                minDist = DBL_MAX;
+                int actual = -1;
+                for(int k = 0; (k < candidates.size()) && (candidates[k].first <= minDist); k++) {
+                    int j = candidates[k].second;
+                    double dist = gallery->distance(j, query, minDist);
+                    if((dist < minDist) || ((dist == minDist) && (j < actual))) {
+                        minDist = dist;
+                        actual = j;
+                    }
+                }
+                ASSERT_EQ(expected, actual);
+            }
+            // a cascade loaded with the selected cells gives the same bounds
+            HistogramCascade loaded(59, metric);
+            {
+                ModelWriter fs("cascade_test.bin");
+                cascade.save(fs);
+            }
+            ModelReader fs("cascade_test.bin");
+            loaded.load(fs.root(), *gallery);
+            ASSERT_TRUE(cascade.cells() == loaded.cells());
+            HistogramQuery query = gallery->query(hists[25]);
+            for(int j = 0; j < gallery->size(); j++)
+                ASSERT_EQ(cascade.bound(j, cascade.query(query)), loaded.bound(j, loaded.query(query)));
+        }
+    }
+    std::remove("cascade_test.bin");
+}
+
+TEST_F(GalleryTest, checkCascadeLowerBound) {
+    int metrics[] = { HistogramMetric::CHISQUARE, HistogramMetric::INTERSECTION,
+            HistogramMetric::L1, HistogramMetric::LOG_LIKELIHOOD };
+    for(int m = 0; m < 4; m++) {
+        HistogramMetric metric(metrics[m]);
+        Ptr<HistogramGallery> sparse = createHistogramGallery(HistogramGallery::SPARSE, 8, metric);
+        for(int i = 0; i < templates_.size(); i++)
+            sparse->add(templates_[i]);
+        // no bounds if all cells are needed
+        HistogramCascade all(8, metric, 4);
+        all.compute(*sparse);
+        ASSERT_TRUE(all.empty());
+        HistogramCascade cascade(8, metric, 2);
+        cascade.compute(*sparse);
+        ASSERT_FALSE(cascade.empty());
+        HistogramQuery query = sparse->query(query_);
+        HistogramQuery coarse = cascade.query(query);
+        for(int i = 0; i < templates_.size(); i++) {
+            double bound = cascade.bound(i, coarse);
+            ASSERT_GT(bound, 0.0);
+            ASSERT_LE(bound, sparse->distance(i, query, DBL_MAX));
+        }
+    }
+}
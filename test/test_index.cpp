@@ -0,0 +1,619 @@
+#include "test_precomp.hpp"
+#include "opencv2/opencv.hpp"
+#include "opencv2/ts/ts.hpp"
+
+// some helper methods for testing
+#include "test_funs.hpp"
+
+// includes objects under test
+#include "index.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The fixture for testing the nearest neighbor indices.
+class IndexTest : public ::testing::Test {
+ protected:
+
+  // Once setup for all tests.
+  IndexTest() {
+      // 50 samples with 21 components of decreasing scale, so the blocks
+      // and the remaining components are both used
+      data_.create(50, 21, CV_64FC1);
+      query_.create(1, 21, CV_64FC1);
+      for(int j = 0; j < 21; j++) {
+          double scale = 1.0 / (1 + (j * 7) % 21);
+          for(int i = 0; i < 50; i++)
+              data_.at<double>(i,j) = scale * (((i * 31 + j * 17) % 23) - 11);
+          query_.at<double>(0,j) = scale * ((j * 5) % 9 - 4);
+      }
+  }
+
+  virtual ~IndexTest() {}
+
+  virtual void SetUp() {}
+
+  virtual void TearDown() {}
+
+  // Returns the distances of all samples to the query.
+  vector<double> distances() const {
+      vector<double> result;
+      for(int i = 0; i < data_.rows; i++)
+          result.push_back(norm(data_.row(i), query_, NORM_L2));
+      return result;
+  }
+
+  // Objects declared here can be used by all tests in the test case.
+  Mat data_;
+  Mat query_;
+};
+
+TEST_F(IndexTest, checkLinearIndexEqualsExhaustive) {
+    LinearIndex index(data_);
+    ASSERT_EQ(50, index.size());
+    ASSERT_EQ(21, index.dims());
+    vector<double> expected = distances();
+    vector<double> sorted = expected;
+    std::sort(sorted.begin(), sorted.end());
+    vector<int> indices;
+    vector<double> dists;
+    index.knn(query_, 5, indices, dists);
+    ASSERT_EQ(5, indices.size());
+    for(int k = 0; k < 5; k++) {
+        ASSERT_NEAR(sorted[k], dists[k], 1e-10);
+        ASSERT_NEAR(expected[indices[k]], dists[k], 1e-10);
+    }
+    ASSERT_EQ(indices[0], index.nearest(query_));
+}
+
+TEST_F(IndexTest, checkLinearIndexTies) {
+    // duplicates of the nearest sample resolve to the first one
+    Mat data = Mat::zeros(3, 4, CV_64FC1);
+    data.at<double>(0,0) = 2.0;
+    Mat query = Mat::zeros(1, 4, CV_64FC1);
+    LinearIndex index(data);
+    ASSERT_EQ(1, index.nearest(query));
+    vector<int> indices;
+    vector<double> dists;
+    index.knn(query, 10, indices, dists);
+    ASSERT_EQ(3, indices.size());
+    ASSERT_EQ(1, indices[0]);
+    ASSERT_EQ(2, indices[1]);
+    ASSERT_EQ(0, indices[2]);
+    ASSERT_EQ(-1, LinearIndex().nearest(query));
+}
+
+TEST_F(IndexTest, checkTreesEqualLinear) {
+    // a low-dimensional gallery with duplicates, large enough for a few levels
+    RNG rng(42);
+    Mat data(400, 6, CV_64FC1);
+    rng.fill(data, RNG::UNIFORM, -1.0, 1.0);
+    for(int i = 0; i < 20; i++) {
+        Mat row = data.row(200 + i);
+        data.row(i).copyTo(row);
+    }
+    int types[] = { GalleryIndex::KDTREE, GalleryIndex::BALLTREE };
+    LinearIndex linear(data);
+    for(int t = 0; t < 2; t++) {
+        Ptr<GalleryIndex> index = createGalleryIndex(types[t]);
+        index->build(data);
+        ASSERT_EQ(types[t], index->type());
+        ASSERT_EQ(400, index->size());
+        ASSERT_EQ(6, index->dims());
+        for(int n = 0; n < 30; n++) {
+            // queries in the gallery (with duplicates) and random ones
+            Mat query(1, 6, CV_64FC1);
+            if(n < 10)
+                data.row(n * 3).copyTo(query);
+            else
+                rng.fill(query, RNG::UNIFORM, -1.2, 1.2);
+            vector<int> expected, actual;
+            vector<double> expectedDists, actualDists;
+            linear.knn(query, 5, expected, expectedDists);
+            index->knn(query, 5, actual, actualDists);
+            ASSERT_EQ(expected.size(), actual.size());
+            for(int k = 0; k < expected.size(); k++) {
+                ASSERT_EQ(expected[k], actual[k]);
+                ASSERT_NEAR(expectedDists[k], actualDists[k], 1e-10);
+            }
+            ASSERT_EQ(linear.nearest(query), index->nearest(query));
+        }
+    }
+}
+
+TEST_F(IndexTest, checkIncrementalAdd) {
+    int types[] = { GalleryIndex::LINEAR, GalleryIndex::KDTREE, GalleryIndex::BALLTREE };
+    LinearIndex linear(data_);
+    for(int t = 0; t < 3; t++) {
+        Ptr<GalleryIndex> index = createGalleryIndex(types[t]);
+        index->build(data_.rowRange(0, 30));
+        for(int i = 30; i < data_.rows; i++)
+            index->add(data_.row(i));
+        ASSERT_EQ(data_.rows, index->size());
+        vector<int> expected, actual;
+        vector<double> expectedDists, actualDists;
+        linear.knn(query_, 7, expected, expectedDists);
+        index->knn(query_, 7, actual, actualDists);
+        ASSERT_EQ(expected, actual);
+    }
+}
+
+TEST_F(IndexTest, checkGalleryAdd) {
+    // samples appended to a gallery, which the index was built over
+    int types[] = { GalleryIndex::LINEAR, GalleryIndex::KDTREE, GalleryIndex::BALLTREE,
+            GalleryIndex::HNSW, GalleryIndex::HASHING };
+    LinearIndex linear(data_);
+    for(int t = 0; t < 5; t++) {
+        PackedMat gallery(data_.rowRange(0, 30).clone(), PackedMat::FLOAT64);
+        Ptr<GalleryIndex> index = createGalleryIndex(types[t]);
+        index->build(gallery);
+        for(int i = 30; i < data_.rows; i++) {
+            gallery.push_back(data_.row(i));
+            index->add(data_.row(i));
+            ASSERT_EQ(i + 1, index->size());
+        }
+        vector<int> expected, actual;
+        vector<double> expectedDists, actualDists;
+        linear.knn(query_, 7, expected, expectedDists);
+        index->knn(query_, 7, actual, actualDists);
+        ASSERT_EQ(expected, actual);
+    }
+}
+
+TEST_F(IndexTest, checkHNSWRecall) {
+    RNG rng(7);
+    Mat data(2000, 16, CV_64FC1);
+    rng.fill(data, RNG::NORMAL, 0.0, 1.0);
+    LinearIndex linear(data);
+    HNSWIndex hnsw(8, 100, 64);
+    hnsw.build(data);
+    ASSERT_EQ(2000, hnsw.size());
+    ASSERT_EQ(GalleryIndex::HNSW, hnsw.type());
+    int found = 0;
+    for(int n = 0; n < 100; n++) {
+        Mat query(1, 16, CV_64FC1);
+        rng.fill(query, RNG::NORMAL, 0.0, 1.0);
+        vector<int> expected, actual;
+        vector<double> expectedDists, actualDists;
+        linear.knn(query, 10, expected, expectedDists);
+        hnsw.knn(query, 10, actual, actualDists);
+        ASSERT_EQ(10, actual.size());
+        for(int k = 0; k < 10; k++)
+            found += std::count(expected.begin(), expected.end(), actual[k]);
+        // the distances are exact
+        ASSERT_NEAR(norm(data.row(actual[0]), query, NORM_L2), actualDists[0], 1e-10);
+    }
+    // recall@10
+    ASSERT_GE(found, 950);
+    // samples in the gallery are found
+    for(int i = 0; i < 50; i++)
+        ASSERT_EQ(i, hnsw.nearest(data.row(i)));
+}
+
+// Runs the queries of a range of rows on a shared index.
+class KnnInvoker : public ParallelLoopBody {
+    const GalleryIndex& _index;
+    const Mat& _queries;
+    vector<vector<int> >& _result;
+
+public:
+    KnnInvoker(const GalleryIndex& index, const Mat& queries, vector<vector<int> >& result) :
+        _index(index), _queries(queries), _result(result) {}
+
+    void operator()(const Range& range) const {
+        vector<double> distances;
+        for(int i = range.start; i < range.end; i++)
+            _index.knn(_queries.row(i), 10, _result[i], distances);
+    }
+};
+
+TEST_F(IndexTest, checkHNSWConcurrentQueries) {
+    RNG rng(11);
+    Mat data(1000, 16, CV_64FC1);
+    Mat queries(200, 16, CV_64FC1);
+    rng.fill(data, RNG::NORMAL, 0.0, 1.0);
+    rng.fill(queries, RNG::NORMAL, 0.0, 1.0);
+    HNSWIndex hnsw(8, 100, 64);
+    hnsw.build(data);
+    // the searches don't share any state, so concurrent queries give the
+    // results of the serial ones
+    vector<vector<int> > expected(queries.rows), actual(queries.rows);
+    KnnInvoker(hnsw, queries, expected)(Range(0, queries.rows));
+    parallel_for_(Range(0, queries.rows), KnnInvoker(hnsw, queries, actual));
+    for(int i = 0; i < queries.rows; i++)
+        ASSERT_TRUE(expected[i] == actual[i]);
+}
+
+TEST_F(IndexTest, checkLinearIndexGallery) {
+    // the samples of a gallery are scanned in place
+    PackedMat gallery(data_.clone(), PackedMat::INT8);
+    LinearIndex copied(gallery.unpack(), PackedMat::INT8);
+    LinearIndex referenced;
+    referenced.build(gallery);
+    ASSERT_EQ(50, referenced.size());
+    ASSERT_EQ(PackedMat::INT8, referenced.precision());
+    ASSERT_EQ(3*sizeof(int), referenced.memory());
+    vector<int> expected, actual;
+    vector<double> expectedDists, actualDists;
+    copied.knn(query_, 5, expected, expectedDists);
+    referenced.knn(query_, 5, actual, actualDists);
+    ASSERT_TRUE(expected == actual);
+    // samples are appended to the gallery before they're added
+    ASSERT_ANY_THROW(referenced.add(query_));
+    gallery.push_back(query_);
+    referenced.add(query_);
+    ASSERT_EQ(51, referenced.size());
+    ASSERT_EQ(50, referenced.nearest(query_));
+    // only the order of the blocks is stored
+    {
+        ModelWriter fs("linear_test.bin");
+        referenced.save(fs);
+    }
+    ModelReader fs("linear_test.bin");
+    vector<int> order;
+    fs["linear_blocks"] >> order;
+    ASSERT_EQ(3, order.size());
+    ASSERT_TRUE(fs.section("linear_data") == 0);
+    LinearIndex loaded;
+    loaded.load(fs.root(), gallery);
+    ASSERT_EQ(51, loaded.size());
+    loaded.knn(query_, 5, actual, actualDists);
+    referenced.knn(query_, 5, expected, expectedDists);
+    ASSERT_TRUE(expected == actual);
+    // an order which doesn't match the gallery is recomputed
+    PackedMat narrow(data_.colRange(0, 16).clone(), PackedMat::FLOAT64);
+    LinearIndex other;
+    other.load(fs.root(), narrow);
+    ASSERT_EQ(16, other.dims());
+    other.knn(query_.colRange(0, 16), 1, actual, actualDists);
+    ASSERT_EQ(1, actual.size());
+    std::remove("linear_test.bin");
+}
+
+TEST_F(IndexTest, checkHNSWGallery) {
+    // the samples of a gallery are referenced, not copied
+    PackedMat gallery(data_.clone(), PackedMat::FLOAT64);
+    HNSWIndex copied(4, 20, 16);
+    copied.build(data_);
+    HNSWIndex referenced(4, 20, 16);
+    referenced.build(gallery);
+    ASSERT_EQ(50, referenced.size());
+    ASSERT_EQ(copied.memory(), referenced.memory() + data_.total()*sizeof(double));
+    vector<int> expected, actual;
+    vector<double> expectedDists, actualDists;
+    copied.knn(query_, 5, expected, expectedDists);
+    referenced.knn(query_, 5, actual, actualDists);
+    ASSERT_TRUE(expected == actual);
+    // samples are appended to the gallery before they're added
+    ASSERT_ANY_THROW(referenced.add(query_));
+    gallery.push_back(query_);
+    referenced.add(query_);
+    ASSERT_EQ(51, referenced.size());
+    ASSERT_EQ(50, referenced.nearest(query_));
+    {
+        ModelWriter fs("hnsw_test.bin");
+        referenced.save(fs);
+    }
+    ModelReader good("hnsw_test.bin");
+    HNSWIndex loaded;
+    loaded.load(good.root(), gallery);
+    loaded.knn(query_, 5, actual, actualDists);
+    referenced.knn(query_, 5, expected, expectedDists);
+    ASSERT_TRUE(expected == actual);
+    // graphs which don't match the gallery are rebuilt
+    Mat links, levels;
+    good["hnsw_links"] >> links;
+    good["hnsw_levels"] >> levels;
+    Mat truncated = links.rowRange(0, links.rows / 2).clone();
+    Mat outside = links.clone();
+    outside.at<int>(links.rows - 1) = 1000;
+    Mat trailing = links.clone();
+    trailing.push_back(Mat(1, 1, CV_32SC1, Scalar(0)));
+    Mat corrupt[] = { truncated, outside, trailing };
+    for(int c = 0; c < 3; c++) {
+        {
+            ModelWriter fs("hnsw_test.bin");
+            fs << "hnsw_m" << 4;
+            fs << "hnsw_ef_construction" << 20;
+            fs << "hnsw_ef_search" << 16;
+            fs << "hnsw_entry" << 0;
+            fs << "hnsw_max_level" << 0;
+            fs << "hnsw_levels" << levels;
+            fs << "hnsw_links" << corrupt[c];
+        }
+        ModelReader fs("hnsw_test.bin");
+        HNSWIndex rebuilt(4, 20, 16);
+        rebuilt.load(fs.root(), gallery);
+        ASSERT_EQ(51, rebuilt.size());
+        for(int i = 0; i < 50; i++)
+            ASSERT_NEAR(0.0, norm(data_.row(rebuilt.nearest(data_.row(i))), data_.row(i), NORM_L2), 1e-10);
+    }
+    std::remove("hnsw_test.bin");
+}
+
+TEST_F(IndexTest, checkIVFPQ) {
+    // samples scattered around class means
+    RNG rng(7);
+    Mat means(40, 16, CV_64FC1);
+    rng.fill(means, RNG::NORMAL, 0.0, 1.0);
+    Mat data(2000, 16, CV_64FC1);
+    for(int i = 0; i < data.rows; i++) {
+        Mat row = data.row(i);
+        rng.fill(row, RNG::NORMAL, 0.0, 0.2);
+        add(row, means.row(i % means.rows), row);
+    }
+    LinearIndex linear(data);
+    // 8 bytes per sample, without and with re-ranking
+    IVFPQIndex compressed(16, 8, 4);
+    compressed.build(data);
+    ASSERT_EQ(2000, compressed.size());
+    ASSERT_EQ(GalleryIndex::IVFPQ, compressed.type());
+    ASSERT_LT(compressed.memory() * 2, linear.memory());
+    IVFPQIndex reranked(16, 8, 4, 20);
+    reranked.build(data);
+    // visiting all lists and re-ranking all samples is exact
+    IVFPQIndex exact(16, 8, 16, 2000);
+    exact.build(data);
+    int found = 0, foundReranked = 0;
+    for(int n = 0; n < 100; n++) {
+        Mat query(1, 16, CV_64FC1);
+        rng.fill(query, RNG::NORMAL, 0.0, 0.2);
+        add(query, means.row(n % means.rows), query);
+        vector<int> expected, actual;
+        vector<double> expectedDists, actualDists;
+        linear.knn(query, 10, expected, expectedDists);
+        exact.knn(query, 10, actual, actualDists);
+        ASSERT_TRUE(expected == actual);
+        compressed.knn(query, 10, actual, actualDists);
+        ASSERT_EQ(10, actual.size());
+        for(int k = 0; k < 10; k++)
+            found += std::count(expected.begin(), expected.end(), actual[k]);
+        reranked.knn(query, 10, actual, actualDists);
+        for(int k = 0; k < 10; k++)
+            foundReranked += std::count(expected.begin(), expected.end(), actual[k]);
+        ASSERT_NEAR(expectedDists[0], actualDists[0], 1e-10);
+    }
+    // recall@10
+    ASSERT_GE(found, 600);
+    ASSERT_GE(foundReranked, 900);
+    // the samples can be re-ranked from a file as well
+    IVFPQIndex file(16, 8, 4, 20, "ivfpq_test_samples.bin");
+    file.build(data.rowRange(0, 1000));
+    for(int i = 1000; i < data.rows; i++)
+        file.add(data.row(i));
+    ASSERT_EQ(2000, file.size());
+    for(int i = 0; i < 50; i++)
+        ASSERT_EQ(i, file.nearest(data.row(i)));
+    // which holds the samples instead of the gallery
+    ASSERT_TRUE(file.spills());
+    ASSERT_FALSE(reranked.spills());
+    ASSERT_EQ(0.0, norm(file.samples(), data, NORM_INF));
+    ASSERT_LT(file.memory(), reranked.memory());
+    // a copy writes to a file of its own
+    PackedMat packed(data, PackedMat::FLOAT64);
+    Ptr<GalleryIndex> copy = copyGalleryIndex(file, PackedMat::FLOAT64, packed);
+    ASSERT_TRUE(copy->spills());
+    Mat shifted = data.row(0) + 1.0;
+    copy->add(shifted);
+    ASSERT_EQ(2001, copy->size());
+    ASSERT_EQ(2001, copy->samples().rows);
+    ASSERT_EQ(0.0, norm(file.samples(), data, NORM_INF));
+    std::remove("ivfpq_test_samples.bin.1");
+    // a file written for other samples is rewritten on loading
+    {
+        ModelWriter fs("ivfpq_test.bin");
+        file.save(fs);
+    }
+    Mat scaled = data * 2.0;
+    IVFPQIndex other(16, 8, 4, 20, "ivfpq_test_samples.bin");
+    other.build(scaled);
+    {
+        ModelReader fs("ivfpq_test.bin");
+        IVFPQIndex stale;
+        stale.load(fs.root(), packed);
+        ASSERT_EQ(0.0, norm(stale.samples(), data, NORM_INF));
+        for(int i = 0; i < 50; i++)
+            ASSERT_EQ(i, stale.nearest(data.row(i)));
+    }
+    std::remove("ivfpq_test.bin");
+    std::remove("ivfpq_test_samples.bin");
+    // the samples of a gallery are referenced, not copied
+    PackedMat gallery(data, PackedMat::FLOAT64);
+    IVFPQIndex referenced(16, 8, 4, 20);
+    referenced.build(gallery);
+    ASSERT_EQ(reranked.memory(), referenced.memory() + data.total()*sizeof(double));
+    for(int i = 0; i < 50; i++)
+        ASSERT_EQ(reranked.nearest(data.row(i)), referenced.nearest(data.row(i)));
+    {
+        ModelWriter fs("ivfpq_test.bin");
+        referenced.save(fs);
+    }
+    ModelReader good("ivfpq_test.bin");
+    IVFPQIndex loaded;
+    loaded.load(good.root(), gallery);
+    ASSERT_EQ(2000, loaded.size());
+    for(int i = 0; i < 50; i++)
+        ASSERT_EQ(referenced.nearest(data.row(i)), loaded.nearest(data.row(i)));
+    // codes which don't match the gallery are rebuilt
+    Mat coarse, codebook, sub, ids, codes;
+    good["ivfpq_coarse"] >> coarse;
+    good["ivfpq_codebook"] >> codebook;
+    good["ivfpq_sub"] >> sub;
+    good["ivfpq_ids"] >> ids;
+    good["ivfpq_codes"] >> codes;
+    Mat truncated = ids.rowRange(0, ids.rows / 2).clone();
+    Mat outside = ids.clone();
+    outside.at<int>(ids.rows - 1) = 5000;
+    Mat duplicate = ids.clone();
+    duplicate.at<int>(ids.rows - 1) = duplicate.at<int>(ids.rows - 2);
+    Mat narrow = codes.colRange(0, 4).clone();
+    Mat shortSub = sub.clone();
+    shortSub.at<int>(sub.rows - 1) = 8;
+    Mat corruptIds[] = { truncated, outside, duplicate, ids, ids };
+    Mat corruptCodes[] = { codes, codes, codes, narrow, codes };
+    Mat corruptSub[] = { sub, sub, sub, sub, shortSub };
+    for(int c = 0; c < 5; c++) {
+        {
+            ModelWriter fs("ivfpq_test.bin");
+            fs << "ivfpq_nlist" << 16;
+            fs << "ivfpq_m" << 8;
+            fs << "ivfpq_nprobe" << 4;
+            fs << "ivfpq_rerank" << 20;
+            fs << "ivfpq_filename" << string();
+            fs << "ivfpq_coarse" << coarse;
+            fs << "ivfpq_codebook" << codebook;
+            fs << "ivfpq_sub" << corruptSub[c];
+            fs << "ivfpq_ids" << corruptIds[c];
+            fs << "ivfpq_codes" << corruptCodes[c];
+        }
+        ModelReader fs("ivfpq_test.bin");
+        IVFPQIndex rebuilt(16, 8, 4, 20);
+        rebuilt.load(fs.root(), gallery);
+        ASSERT_EQ(2000, rebuilt.size());
+        for(int i = 0; i < 50; i++)
+            ASSERT_EQ(referenced.nearest(data.row(i)), rebuilt.nearest(data.row(i)));
+    }
+    std::remove("ivfpq_test.bin");
+}
+
+TEST_F(IndexTest, checkHashing) {
+    uint64 a[] = { 0xFFULL, 0x8000000000000001ULL };
+    uint64 b[] = { 0x0FULL, 0x0ULL };
+    ASSERT_EQ(6, cv::impl::hamming(a, b, 2));
+    // samples scattered around class means
+    RNG rng(7);
+    Mat means(40, 32, CV_64FC1);
+    rng.fill(means, RNG::NORMAL, 0.0, 1.0);
+    Mat data(2000, 32, CV_64FC1);
+    for(int i = 0; i < data.rows; i++) {
+        Mat row = data.row(i);
+        rng.fill(row, RNG::NORMAL, 0.0, 0.3);
+        add(row, means.row(i % means.rows), row);
+    }
+    LinearIndex linear(data);
+    HashingIndex itq(64, HashingIndex::ITQ, 100);
+    itq.build(data);
+    HashingIndex random(128, HashingIndex::RANDOM, 100);
+    random.build(data);
+    ASSERT_EQ(GalleryIndex::HASHING, itq.type());
+    ASSERT_EQ(2000, itq.size());
+    // a shortlist of all samples is exact
+    HashingIndex all(64, HashingIndex::ITQ, 2000);
+    all.build(data);
+    int foundItq = 0, foundRandom = 0;
+    for(int n = 0; n < 100; n++) {
+        Mat query(1, 32, CV_64FC1);
+        rng.fill(query, RNG::NORMAL, 0.0, 0.3);
+        add(query, means.row(n % means.rows), query);
+        vector<int> expected, actual;
+        vector<double> expectedDists, actualDists;
+        linear.knn(query, 10, expected, expectedDists);
+        all.knn(query, 10, actual, actualDists);
+        ASSERT_TRUE(expected == actual);
+        itq.knn(query, 10, actual, actualDists);
+        ASSERT_EQ(10, actual.size());
+        for(int k = 0; k < 10; k++)
+            foundItq += std::count(expected.begin(), expected.end(), actual[k]);
+        random.knn(query, 10, actual, actualDists);
+        for(int k = 0; k < 10; k++)
+            foundRandom += std::count(expected.begin(), expected.end(), actual[k]);
+    }
+    // recall@10
+    ASSERT_GE(foundItq, 800);
+    ASSERT_GE(foundRandom, 800);
+    // added duplicates are found after the originals
+    for(int i = 0; i < 50; i++)
+        itq.add(data.row(i));
+    ASSERT_EQ(2050, itq.size());
+    vector<int> indices;
+    vector<double> dists;
+    itq.knn(data.row(3), 2, indices, dists);
+    ASSERT_EQ(3, indices[0]);
+    ASSERT_EQ(2003, indices[1]);
+    ASSERT_ANY_THROW(HashingIndex(100));
+}
+
+TEST_F(IndexTest, checkHashingGallery) {
+    // the samples of a gallery are referenced, not copied
+    PackedMat gallery(data_.clone(), PackedMat::FLOAT16);
+    HashingIndex copied(64, HashingIndex::RANDOM, 10);
+    copied.build(gallery.unpack());
+    HashingIndex referenced(64, HashingIndex::RANDOM, 10);
+    referenced.build(gallery);
+    ASSERT_EQ(50, referenced.size());
+    ASSERT_EQ(copied.memory(), referenced.memory() + data_.total()*sizeof(double));
+    vector<int> expected, actual;
+    vector<double> expectedDists, actualDists;
+    copied.knn(query_, 5, expected, expectedDists);
+    referenced.knn(query_, 5, actual, actualDists);
+    ASSERT_TRUE(expected == actual);
+    for(int k = 0; k < 5; k++)
+        ASSERT_NEAR(expectedDists[k], actualDists[k], 1e-10);
+    // samples are appended to the gallery before they're added
+    ASSERT_ANY_THROW(referenced.add(query_));
+    gallery.push_back(query_);
+    referenced.add(query_);
+    ASSERT_EQ(51, referenced.size());
+    ASSERT_EQ(50, referenced.nearest(query_));
+    {
+        ModelWriter fs("hashing_test.bin");
+        referenced.save(fs);
+    }
+    ModelReader fs("hashing_test.bin");
+    HashingIndex loaded;
+    loaded.load(fs.root(), gallery);
+    ASSERT_EQ(51, loaded.size());
+    loaded.knn(query_, 5, actual, actualDists);
+    referenced.knn(query_, 5, expected, expectedDists);
+    ASSERT_TRUE(expected == actual);
+    // hyperplanes which don't fit the gallery are rebuilt
+    {
+        Mat mean = Mat::zeros(1, 3, CV_64FC1);
+        Mat projection = Mat::zeros(21, 64, CV_64FC1);
+        ModelWriter fs("hashing_test.bin");
+        fs << "hashing_bits" << 64;
+        fs << "hashing_method" << 7;
+        fs << "hashing_shortlist" << 10;
+        fs << "hashing_mean" << mean;
+        fs << "hashing_projection" << projection;
+    }
+    ModelReader corrupt("hashing_test.bin");
+    HashingIndex rebuilt;
+    rebuilt.load(corrupt.root(), gallery);
+    ASSERT_EQ(51, rebuilt.size());
+    ASSERT_EQ(50, rebuilt.nearest(query_));
+    // the default shortlist re-ranks all samples
+    LinearIndex linear(gallery.unpack());
+    linear.knn(query_, 5, expected, expectedDists);
+    rebuilt.knn(query_, 5, actual, actualDists);
+    ASSERT_TRUE(expected == actual);
+    std::remove("hashing_test.bin");
+}
+
+TEST_F(IndexTest, checkPackedLinearIndex) {
+    LinearIndex exact(data_);
+    int precisions[] = { PackedMat::FLOAT16, PackedMat::INT8 };
+    double tolerances[] = { 1e-2, 0.2 };
+    vector<double> expected = distances();
+    for(int p = 0; p < 2; p++) {
+        LinearIndex index(data_, precisions[p]);
+        ASSERT_EQ(precisions[p], index.precision());
+        ASSERT_EQ(50, index.size());
+        ASSERT_LT(index.memory() * 3, exact.memory());
+        vector<int> indices;
+        vector<double> dists;
+        index.knn(query_, 5, indices, dists);
+        ASSERT_EQ(5, indices.size());
+        for(int k = 0; k < 5; k++)
+            ASSERT_NEAR(expected[indices[k]], dists[k], tolerances[p]);
+        // enrolled samples are packed as well
+        index.add(data_.row(7));
+        ASSERT_EQ(51, index.size());
+        index.knn(data_.row(7), 1, indices, dists);
+        ASSERT_TRUE((indices[0] == 7) || (indices[0] == 50));
+        // the packed matrix decodes to nearly the original values
+        PackedMat packed(data_, precisions[p]);
+        Mat decoded = packed.unpack();
+        ASSERT_LT(norm(decoded, data_, NORM_INF), 0.05);
+    }
+}
@@ -84,7 +84,7 @@ TEST_F(LBPTest, checkExtendedLBPAllZero) {
     ASSERT_EQ(1, actual.rows);
     ASSERT_EQ(1, actual.cols);
     // Check LBP Code.
-    ASSERT_EQ(255, actual.at<int>(0,0));
+    ASSERT_EQ(255, actual.at<unsigned char>(0,0));
 }
 
 TEST_F(LBPTest, checkExtendedLBPAllOneCenterZero) {
@@ -94,7 +94,7 @@ TEST_F(LBPTest, checkExtendedLBPAllOneCenterZero) {
     ASSERT_EQ(1, actual.rows);
     ASSERT_EQ(1, actual.cols);
     // Check LBP Code.
-    ASSERT_EQ(255, actual.at<int>(0,0));
+    ASSERT_EQ(255, actual.at<unsigned char>(0,0));
 }
 
 TEST_F(LBPTest, checkExtendedLBPMixed) {
@@ -131,7 +131,7 @@ TEST_F(LBPTest, checkExtendedLBPMixed) {
     ASSERT_EQ(1, actual.rows);
     ASSERT_EQ(1, actual.cols);
     // Check LBP Code.
-    ASSERT_EQ(195, actual.at<int>(0,0));
+    ASSERT_EQ(195, actual.at<unsigned char>(0,0));
 }
 
 TEST_F(LBPTest, checkSpatialHist) {
@@ -162,3 +162,253 @@ TEST_F(LBPTest, checkSpatialHist) {
     ASSERT_EQ(32, actual.total());
     ASSERT_TRUE(isEqual(expected, actual));
 }
+
+TEST_F(LBPTest, checkSpatialHistCounts) {
+    // |7,7|0,6|
+    // |7,9|6,6|
+    //
+    // 9 is out of range for 8 patterns and must be ignored, while the
+    // largest code (7) has to be counted.
+    Mat X = (Mat_<unsigned char>(2,4) << 7,7,0,6,7,9,6,6);
+    Mat expected = (Mat_<float> (1,16) << 0, 0, 0, 0, 0, 0, 0, 3,
+            1, 0, 0, 0, 0, 0, 3, 0);
+    Mat actual = spatial_histogram(X, 8, 2, 1, false);
+    ASSERT_EQ(16, actual.total());
+    ASSERT_TRUE(isEqual(expected, actual));
+}
+
+TEST_F(LBPTest, checkIntegralHistogram) {
+    // a code image that doesn't split evenly into the grid
+    Mat X(13, 11, CV_32SC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<int>(i,j) = (i*7 + j*3) % 17;
+    IntegralHistogram ih(X, 16);
+    // without overlap the cells match the direct computation
+    Mat expected = spatial_histogram(X, 16, 3, 2, true);
+    ASSERT_TRUE(isEqual(expected, spatial_histogram(ih, 3, 2), 1e-6));
+    // any cell equals the histogram of the sub image
+    Rect r(2, 3, 5, 7);
+    Mat cell = ih.histogram(r);
+    Mat direct = spatial_histogram(Mat(X, r), 16, 1, 1, false);
+    for(int b = 0; b < 16; b++)
+        ASSERT_EQ(direct.at<float>(0,b), cell.at<int>(0,b));
+    // overlapping cells and several grids
+    Mat overlapping = spatial_histogram(ih, 3, 3, 0.5, false);
+    ASSERT_EQ(9*16, overlapping.total());
+    vector<Size> grids;
+    grids.push_back(Size(1,1));
+    grids.push_back(Size(3,2));
+    Mat multi = spatial_histogram(ih, grids);
+    ASSERT_EQ(7*16, multi.total());
+    ASSERT_TRUE(isEqual(expected, multi.colRange(16, 7*16), 1e-6));
+    ASSERT_ANY_THROW(ih.histogram(Rect(8, 0, 4, 1)));
+    // the integral at the cell corners only gives the same histograms
+    grids.push_back(Size(3,3));
+    Mat corners = spatial_histogram(X, 16, grids, 0.5, false);
+    Mat full = spatial_histogram(ih, grids, 0.5, false);
+    ASSERT_TRUE(isEqual(full, corners));
+    vector<int> xs, ys;
+    xs.push_back(0); xs.push_back(5); xs.push_back(11);
+    ys.push_back(0); ys.push_back(13);
+    IntegralHistogram coarse(X, 16, xs, ys);
+    ASSERT_LT(coarse.memory() * 20, ih.memory());
+    ASSERT_TRUE(isEqual(ih.histogram(Rect(5, 0, 6, 13)), coarse.histogram(Rect(5, 0, 6, 13))));
+    ASSERT_ANY_THROW(coarse.histogram(Rect(2, 3, 5, 7)));
+    // codes which don't occur take no space
+    Mat sparse = Mat::zeros(13, 11, CV_32SC1);
+    sparse.at<int>(4, 4) = 200;
+    IntegralHistogram few(sparse, 256);
+    ASSERT_EQ(12*14*2*sizeof(int), few.memory());
+    ASSERT_EQ(1, few.histogram(Rect(0, 0, 11, 13)).at<int>(0, 200));
+}
+
+TEST_F(LBPTest, checkOverlappingCellsInside) {
+    // 16 columns in 4 cells overlapping by 0.3 give cells of 5 pixels and a
+    // step of 3.5, which mustn't be rounded up to 4
+    vector<Rect> cells = impl::grid_cells(16, 10, 4, 2, 0.3);
+    ASSERT_EQ(8, cells.size());
+    for(int i = 0; i < cells.size(); i++) {
+        ASSERT_EQ(5, cells[i].width);
+        ASSERT_LE(cells[i].x + cells[i].width, 16);
+        ASSERT_LE(cells[i].y + cells[i].height, 10);
+    }
+    Mat X(10, 16, CV_32SC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<int>(i,j) = (i*5 + j) % 8;
+    IntegralHistogram ih(X, 8);
+    Mat actual = spatial_histogram(ih, 4, 2, 0.3, false);
+    ASSERT_EQ(8*8, actual.total());
+    // the last cell equals the histogram of its sub image
+    Mat direct = spatial_histogram(Mat(X, cells[7]), 8, 1, 1, false);
+    ASSERT_TRUE(isEqual(direct, actual.colRange(7*8, 8*8)));
+}
+
+TEST_F(LBPTest, checkMultiScaleLBP) {
+    Mat X(12, 14, CV_8UC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<unsigned char>(i,j) = (i*37 + j*101 + i*j) % 256;
+    vector<int> radii, neighbors;
+    radii.push_back(1); neighbors.push_back(8);
+    radii.push_back(3); neighbors.push_back(16);
+    radii.push_back(2); neighbors.push_back(8);
+    vector<Mat> actual;
+    multiscale_elbp(X, actual, radii, neighbors);
+    ASSERT_EQ(3, actual.size());
+    // every scale equals elbp, cropped to the border of the largest radius
+    for(int s = 0; s < 3; s++) {
+        Mat expected = elbp(X, radii[s], neighbors[s]);
+        int offset = 3 - radii[s];
+        Mat cropped = expected(Rect(offset, offset, X.cols-6, X.rows-6));
+        ASSERT_TRUE(isEqual(cropped, actual[s]));
+    }
+    neighbors.pop_back();
+    ASSERT_ANY_THROW(multiscale_elbp(X, actual, radii, neighbors));
+}
+
+TEST_F(LBPTest, checkVarianceLBP) {
+    // the bilinear interpolation is exact on a linear ramp, so the neighbors
+    // of each pixel are center + cos(2*pi*n/8), with a sample variance of
+    // (8/2)/(8-1)
+    Mat X(5, 5, CV_32FC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<float>(i,j) = static_cast<float>(j);
+    Mat actual = varlbp(X, 1, 8);
+    ASSERT_EQ(9, actual.total());
+    for(int i = 0; i < 3; i++)
+        for(int j = 0; j < 3; j++)
+            ASSERT_NEAR(4.0/7.0, actual.at<float>(i,j), 1e-5);
+    // a constant image has no variance
+    Mat constant = varlbp(Mat(5, 6, CV_8UC1, Scalar(7)), 1, 8);
+    ASSERT_EQ(3, constant.rows);
+    ASSERT_EQ(4, constant.cols);
+    ASSERT_NEAR(0.0, norm(constant), 1e-6);
+}
+
+TEST_F(LBPTest, checkJointLBPVar) {
+    Mat var = (Mat_<float>(2,3) << 0.5, 1.5, 2.5, 3.5, 4.5, 5.5);
+    vector<Mat> vars(1, var);
+    // three bins of equal frequency
+    vector<float> cuts = varlbp_cuts(vars, 3);
+    ASSERT_EQ(2, cuts.size());
+    ASSERT_FLOAT_EQ(2.5f, cuts[0]);
+    ASSERT_FLOAT_EQ(4.5f, cuts[1]);
+    Mat lbp = (Mat_<int>(2,3) << 0, 1, 2, 3, 4, 255);
+    Mat expected = (Mat_<int>(2,3) << 0, 3, 7, 10, 14, 767);
+    ASSERT_TRUE(isEqual(expected, lbpvar(lbp, var, cuts)));
+    ASSERT_ANY_THROW(lbpvar(lbp, var.colRange(0, 2), cuts));
+}
+
+TEST_F(LBPTest, checkExtendedLBPType) {
+    // the codes are stored with the narrowest type
+    ASSERT_EQ(CV_8UC1, elbp(mMixed_, 1, 4).type());
+    ASSERT_EQ(CV_8UC1, elbp(mMixed_, 1, 8).type());
+    ASSERT_EQ(CV_16UC1, elbp(mMixed_, 1, 16).type());
+    ASSERT_EQ(CV_32SC1, elbp(mMixed_, 1, 17).type());
+}
+
+// The per-neighbor extended LBP, one sweep over the image per neighbor.
+template <typename _Tp>
+static Mat baseline_elbp(const Mat& src, int radius, int neighbors) {
+    Mat dst = Mat::zeros(src.rows-2*radius, src.cols-2*radius, CV_32SC1);
+    for(int n=0; n<neighbors; n++) {
+        float x = static_cast<float>(-radius) * sin(2.0*CV_PI*n/static_cast<float>(neighbors));
+        float y = static_cast<float>(radius) * cos(2.0*CV_PI*n/static_cast<float>(neighbors));
+        int fx = static_cast<int>(floor(x));
+        int fy = static_cast<int>(floor(y));
+        int cx = static_cast<int>(ceil(x));
+        int cy = static_cast<int>(ceil(y));
+        float ty = y - fy;
+        float tx = x - fx;
+        float w1 = (1 - tx) * (1 - ty);
+        float w2 =      tx  * (1 - ty);
+        float w3 = (1 - tx) *      ty;
+        float w4 =      tx  *      ty;
+        for(int i=radius; i < src.rows-radius;i++) {
+            for(int j=radius;j < src.cols-radius;j++) {
+                float t = w1*src.at<_Tp>(i+fy,j+fx) + w2*src.at<_Tp>(i+fy,j+cx) + w3*src.at<_Tp>(i+cy,j+fx) + w4*src.at<_Tp>(i+cy,j+cx);
+                dst.at<int>(i-radius,j-radius) += ((t > src.at<_Tp>(i,j)) || (std::abs(t-src.at<_Tp>(i,j)) < std::numeric_limits<float>::epsilon())) << n;
+            }
+        }
+    }
+    return dst;
+}
+
+// The per-neighbor variance, with the running mean and M2 of all pixels in
+// scratch images.
+template <typename _Tp>
+static Mat baseline_varlbp(const Mat& src, int radius, int neighbors) {
+    Mat dst = Mat::zeros(src.rows-2*radius, src.cols-2*radius, CV_32FC1);
+    Mat mean = Mat::zeros(src.rows, src.cols, CV_32FC1);
+    Mat m2 = Mat::zeros(src.rows, src.cols, CV_32FC1);
+    for(int n=0; n<neighbors; n++) {
+        float x = static_cast<float>(radius) * cos(2.0*CV_PI*n/static_cast<float>(neighbors));
+        float y = static_cast<float>(radius) * -sin(2.0*CV_PI*n/static_cast<float>(neighbors));
+        int fx = static_cast<int>(floor(x));
+        int fy = static_cast<int>(floor(y));
+        int cx = static_cast<int>(ceil(x));
+        int cy = static_cast<int>(ceil(y));
+        float ty = y - fy;
+        float tx = x - fx;
+        float w1 = (1 - tx) * (1 - ty);
+        float w2 =      tx  * (1 - ty);
+        float w3 = (1 - tx) *      ty;
+        float w4 =      tx  *      ty;
+        for(int i=radius; i < src.rows-radius;i++) {
+            for(int j=radius;j < src.cols-radius;j++) {
+                float t = w1*src.at<_Tp>(i+fy,j+fx) + w2*src.at<_Tp>(i+fy,j+cx) + w3*src.at<_Tp>(i+cy,j+fx) + w4*src.at<_Tp>(i+cy,j+cx);
+                float delta = t - mean.at<float>(i,j);
+                mean.at<float>(i,j) = mean.at<float>(i,j) + delta / (1.0*(n+1));
+                m2.at<float>(i,j) = m2.at<float>(i,j) + delta * (t - mean.at<float>(i,j));
+            }
+        }
+    }
+    for(int i = radius; i < src.rows-radius; i++)
+        for(int j = radius; j < src.cols-radius; j++)
+            dst.at<float>(i-radius, j-radius) = m2.at<float>(i,j) / (1.0*(neighbors-1));
+    return dst;
+}
+
+TEST_F(LBPTest, checkSpecializedLBP) {
+    Mat X(15, 17, CV_8UC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<unsigned char>(i,j) = (i*53 + j*29 + i*j*7) % 256;
+    Mat Xf;
+    X.convertTo(Xf, CV_32FC1, 1.0/255.0);
+    // the constant-folded kernels equal the per-neighbor algorithm, the
+    // unrolled (3,8) and generic (1,4) kernels as well
+    int configs[6][2] = { {1,8}, {2,8}, {2,16}, {3,24}, {3,8}, {1,4} };
+    for(int k = 0; k < 6; k++) {
+        int radius = configs[k][0];
+        int neighbors = configs[k][1];
+        Mat codes;
+        elbp(X, radius, neighbors).convertTo(codes, CV_32SC1);
+        ASSERT_TRUE(isEqual(baseline_elbp<unsigned char>(X, radius, neighbors), codes));
+        ASSERT_TRUE(isEqual(baseline_varlbp<unsigned char>(X, radius, neighbors), varlbp(X, radius, neighbors)));
+        elbp(Xf, radius, neighbors).convertTo(codes, CV_32SC1);
+        ASSERT_TRUE(isEqual(baseline_elbp<float>(Xf, radius, neighbors), codes));
+        ASSERT_TRUE(isEqual(baseline_varlbp<float>(Xf, radius, neighbors), varlbp(Xf, radius, neighbors)));
+    }
+}
+
+TEST_F(LBPTest, checkParallelLBP) {
+    // large enough to be split into bands
+    Mat X(300, 260, CV_8UC1);
+    for(int i = 0; i < X.rows; i++)
+        for(int j = 0; j < X.cols; j++)
+            X.at<unsigned char>(i,j) = (i*53 + j*29 + i*j*7) % 256;
+    // serial computation of all rows
+    Mat expectedOLBP = Mat::zeros(X.rows-2, X.cols-2, CV_8UC1);
+    Mat expectedELBP = Mat::zeros(X.rows-4, X.cols-4, CV_16UC1);
+    Mat expectedVar = Mat::zeros(X.rows-4, X.cols-4, CV_32FC1);
+    cv::impl::OLBPInvoker<unsigned char>(X, expectedOLBP)(Range(0, expectedOLBP.rows));
+    cv::impl::ELBPInvoker<unsigned char, unsigned short, 2, 16>(X, expectedELBP, 2, 16)(Range(0, expectedELBP.rows));
+    cv::impl::VarLBPInvoker<unsigned char, 2, 16>(X, expectedVar, 2, 16)(Range(0, expectedVar.rows));
+    ASSERT_TRUE(isEqual(expectedOLBP, olbp(X)));
+    ASSERT_TRUE(isEqual(expectedELBP, elbp(X, 2, 16)));
+    ASSERT_TRUE(isEqual(expectedVar, varlbp(X, 2, 16)));
+}
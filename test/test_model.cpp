@@ -0,0 +1,645 @@
+#include "test_precomp.hpp"
+#include "opencv2/opencv.hpp"
+#include "opencv2/ts/ts.hpp"
+
+// some helper methods for testing
+#include "test_funs.hpp"
+
+// includes objects under test
+#include "facerec.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+using namespace cv;
+using namespace std;
+
+// The fixture for testing the binary model format.
+class ModelTest : public ::testing::Test {
+ protected:
+
+  // Once setup for all tests.
+  ModelTest() : filename_("test_model.bin") {
+      // 12 random faces of 6 persons
+      RNG rng(42);
+      for(int i = 0; i < 12; i++) {
+          Mat face(20, 18, CV_8UC1);
+          rng.fill(face, RNG::UNIFORM, 0, 256);
+          images_.push_back(face);
+          labels_.push_back(i / 2);
+      }
+  }
+
+  virtual ~ModelTest() {}
+
+  virtual void SetUp() {}
+
+  virtual void TearDown() {
+      std::remove(filename_.c_str());
+  }
+
+  // Objects declared here can be used by all tests in the test case.
+  string filename_;
+  vector<Mat> images_;
+  vector<int> labels_;
+};
+
+TEST_F(ModelTest, checkSections) {
+    Mat doubles(3, 5, CV_64FC1);
+    randu(doubles, -1.0, 1.0);
+    Mat bytes(7, 3, CV_8UC1);
+    randu(bytes, 0, 256);
+    vector<int> ints;
+    for(int i = 0; i < 10; i++)
+        ints.push_back(i * i - 5);
+    {
+        ModelWriter fs(filename_);
+        ASSERT_TRUE(fs.isOpened());
+        fs << "doubles" << doubles;
+        // non-continuous matrices are written row by row
+        fs << "columns" << doubles.colRange(1, 3);
+        fs << "bytes" << bytes;
+        fs << "int" << 42;
+        fs << "double" << 0.25;
+        fs << "string" << "eigenfaces";
+        fs << "ints" << ints;
+        fs << "empty" << Mat();
+        fs << "nested" << "{";
+        fs << "int" << 7;
+        fs << "}";
+        fs.release();
+    }
+    ASSERT_TRUE(isModelFile(filename_));
+    ASSERT_TRUE(isModelFilename(filename_));
+    ASSERT_FALSE(isModelFilename("model.yml"));
+    ModelReader fs(filename_);
+    ASSERT_TRUE(fs.isOpened());
+    ASSERT_EQ(MODEL_VERSION, fs.version());
+    Mat m;
+    fs["doubles"] >> m;
+    ASSERT_TRUE(isEqual(doubles, m));
+    fs["columns"] >> m;
+    ASSERT_TRUE(isEqual(doubles.colRange(1, 3), m));
+    fs["bytes"] >> m;
+    ASSERT_EQ(CV_8UC1, m.type());
+    ASSERT_TRUE(isEqual(bytes, m));
+    int i;
+    double d;
+    string s;
+    vector<int> v;
+    fs["int"] >> i;
+    fs["double"] >> d;
+    fs["string"] >> s;
+    fs["ints"] >> v;
+    ASSERT_EQ(42, i);
+    ASSERT_EQ(0.25, d);
+    ASSERT_EQ("eigenfaces", s);
+    ASSERT_TRUE(ints == v);
+    fs["empty"] >> m;
+    ASSERT_TRUE(m.empty());
+    fs["nested"]["int"] >> i;
+    ASSERT_EQ(7, i);
+    ASSERT_FALSE(fs["nested"].empty());
+    // the sections are aligned
+    ASSERT_EQ(0, fs.section("doubles")->offset % MODEL_ALIGNMENT);
+    ASSERT_EQ(0, fs.section("bytes")->offset % MODEL_ALIGNMENT);
+    // missing sections give default values, like cv::FileStorage
+    ASSERT_TRUE(fs["missing"].empty());
+    fs["missing"] >> i;
+    fs["missing"] >> m;
+    ASSERT_EQ(0, i);
+    ASSERT_TRUE(m.empty());
+}
+
+TEST_F(ModelTest, checkEigenfaces) {
+    int types[] = { GalleryIndex::LINEAR, GalleryIndex::HNSW };
+    for(int t = 0; t < 2; t++) {
+        Eigenfaces model(images_, labels_, 0, types[t]);
+        model.save(filename_);
+        ASSERT_TRUE(isModelFile(filename_));
+        Eigenfaces loaded;
+        loaded.load(filename_);
+        ASSERT_EQ(model.num_components(), loaded.num_components());
+        ASSERT_TRUE(isEqual(model.eigenvectors(), loaded.eigenvectors()));
+        ASSERT_TRUE(isEqual(model.projections(), loaded.projections()));
+        ASSERT_EQ(types[t], loaded.index()->type());
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    }
+}
+
+TEST_F(ModelTest, checkSpilledProjections) {
+    // an IVFPQ index with a file of samples holds the projections
+    Eigenfaces model(images_, labels_);
+    Mat projections = model.projections();
+    model.setIndex(new IVFPQIndex(2, 4, 2, 12, "ivfpq_model_samples.bin"));
+    ASSERT_TRUE(model.index()->spills());
+    ASSERT_TRUE(isEqual(projections, model.projections()));
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(labels_[i], model.predict(images_[i]));
+    model.save(filename_);
+    Eigenfaces loaded;
+    loaded.load(filename_);
+    ASSERT_TRUE(loaded.index()->spills());
+    ASSERT_TRUE(isEqual(projections, loaded.projections()));
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(labels_[i], loaded.predict(images_[i]));
+    std::remove("ivfpq_model_samples.bin");
+}
+
+TEST_F(ModelTest, checkCopy) {
+    // a copy keeps working after the original is gone
+    RNG rng(7);
+    Mat face(20, 18, CV_8UC1);
+    rng.fill(face, RNG::UNIFORM, 0, 256);
+    int types[] = { GalleryIndex::LINEAR, GalleryIndex::HNSW };
+    for(int t = 0; t < 2; t++) {
+        Eigenfaces* model = new Eigenfaces(images_, labels_, 0, types[t]);
+        vector<int> expected;
+        for(int i = 0; i < images_.size(); i++)
+            expected.push_back(model->predict(images_[i]));
+        Eigenfaces copied(*model);
+        Eigenfaces assigned;
+        assigned = *model;
+        delete model;
+        ASSERT_EQ(types[t], copied.index()->type());
+        for(int i = 0; i < images_.size(); i++) {
+            ASSERT_EQ(expected[i], copied.predict(images_[i]));
+            ASSERT_EQ(expected[i], assigned.predict(images_[i]));
+        }
+        // the index of a copy is checked against its own projections
+        copied.enroll(face, 100);
+        ASSERT_EQ(100, copied.predict(face));
+        ASSERT_EQ(images_.size() + 1, copied.index()->size());
+        ASSERT_EQ(images_.size(), assigned.index()->size());
+    }
+    Fisherfaces* model = new Fisherfaces(images_, labels_);
+    vector<int> expected;
+    for(int i = 0; i < images_.size(); i++)
+        expected.push_back(model->predict(images_[i]));
+    Fisherfaces copied(*model);
+    delete model;
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(expected[i], copied.predict(images_[i]));
+}
+
+TEST_F(ModelTest, checkLBPH) {
+    int formats[] = { HistogramGallery::DENSE, HistogramGallery::SPARSE, HistogramGallery::QUANTIZED_8U };
+    for(int f = 0; f < 3; f++) {
+        LBPH model(images_, labels_, 1, 8, 4, 4, formats[f]);
+        model.save(filename_);
+        // the cells of the cascade are stored with the model
+        {
+            ModelReader fs(filename_);
+            vector<int> cells;
+            fs["cascade_cells"] >> cells;
+            ASSERT_EQ(8, cells.size());
+        }
+        LBPH loaded;
+        loaded.load(filename_);
+        ASSERT_EQ(formats[f], loaded.format());
+        ASSERT_EQ(4, loaded.grid_x());
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    }
+}
+
+TEST_F(ModelTest, checkLBPHGrids) {
+    // overlapping cells of a 4x4 grid and a further 2x2 grid
+    vector<Size> grids(1, Size(2,2));
+    LBPH model(images_, labels_, 1, 8, 4, 4, HistogramGallery::DENSE,
+            HistogramMetric::CHISQUARE, Mat(), 0, 0, false, 0.25, grids);
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(labels_[i], model.predict(images_[i]));
+    string filenames[] = { filename_, "test_model.yml" };
+    for(int f = 0; f < 2; f++) {
+        model.save(filenames[f]);
+        LBPH loaded;
+        loaded.load(filenames[f]);
+        ASSERT_EQ(0.25, loaded.overlap());
+        ASSERT_EQ(1, loaded.grids().size());
+        ASSERT_EQ(Size(2,2), loaded.grids()[0]);
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    }
+    std::remove("test_model.yml");
+    ASSERT_ANY_THROW(LBPH(1, 8, 4, 4, HistogramGallery::DENSE, HistogramMetric::CHISQUARE,
+            Mat(), 0, 0, false, 1.0));
+}
+
+TEST_F(ModelTest, checkProjectedLBPH) {
+    LBPH model(images_, labels_, 1, 4, 2, 2, HistogramGallery::DENSE,
+            HistogramMetric::CHISQUARE, Mat(), 0, 8);
+    ASSERT_EQ(8, model.num_components());
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(labels_[i], model.predict(images_[i]));
+    model.save(filename_);
+    LBPH loaded;
+    loaded.load(filename_);
+    ASSERT_EQ(8, loaded.num_components());
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    {
+        ModelReader fs(filename_);
+        Mat projections;
+        fs["projections"] >> projections;
+        ASSERT_EQ(images_.size(), projections.rows);
+        ASSERT_EQ(8, projections.cols);
+    }
+    // the components are clipped to the samples, but not the requested number
+    vector<Mat> few(images_.begin(), images_.begin() + 4);
+    vector<int> fewLabels(labels_.begin(), labels_.begin() + 4);
+    model.train(few, fewLabels);
+    ASSERT_EQ(8, model.num_components());
+    model.train(images_, labels_);
+    model.save(filename_);
+    ModelReader fs(filename_);
+    Mat projections;
+    fs["projections"] >> projections;
+    ASSERT_EQ(8, projections.cols);
+}
+
+TEST_F(ModelTest, checkMultiScaleLBPH) {
+    vector<int> radii, neighbors;
+    radii.push_back(1);
+    radii.push_back(2);
+    neighbors.push_back(8);
+    neighbors.push_back(4);
+    vector<double> weights;
+    weights.push_back(1.0);
+    weights.push_back(0.5);
+    MultiScaleLBPH model(images_, labels_, radii, neighbors, weights, 4, 4);
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(labels_[i], model.predict(images_[i]));
+    // noisy queries
+    RNG rng(7);
+    vector<Mat> queries;
+    for(int i = 0; i < images_.size(); i++) {
+        Mat noise(images_[i].size(), CV_8UC1);
+        rng.fill(noise, RNG::UNIFORM, 0, 16);
+        Mat query;
+        add(images_[i], noise, query);
+        queries.push_back(query);
+    }
+    // a scale of weight zero is ignored
+    weights[1] = 0.0;
+    MultiScaleLBPH first(images_, labels_, radii, neighbors, weights, 4, 4);
+    LBPH single(images_, labels_, 1, 8, 4, 4);
+    for(int i = 0; i < queries.size(); i++)
+        ASSERT_EQ(single.predict(queries[i]), first.predict(queries[i]));
+    // a weight for each scale, nonnegative
+    ASSERT_ANY_THROW(MultiScaleLBPH(radii, neighbors, vector<double>(1, 1.0)));
+    ASSERT_ANY_THROW(MultiScaleLBPH(radii, neighbors, vector<double>(2, -1.0)));
+    ASSERT_ANY_THROW(MultiScaleLBPH(radii, vector<int>(1, 8)));
+    // the scales are nested structures of both formats
+    string filenames[] = { filename_, "test_model.yml" };
+    for(int f = 0; f < 2; f++) {
+        model.save(filenames[f]);
+        // the configuration is replaced by the loaded one
+        MultiScaleLBPH loaded(vector<int>(1, 3), vector<int>(1, 8));
+        loaded.load(filenames[f]);
+        ASSERT_TRUE(radii == loaded.radii());
+        ASSERT_TRUE(neighbors == loaded.neighbors());
+        ASSERT_EQ(2, loaded.scale_weights().size());
+        ASSERT_EQ(0.5, loaded.scale_weights()[1]);
+        ASSERT_EQ(4, loaded.grid_x());
+        for(int i = 0; i < queries.size(); i++)
+            ASSERT_EQ(model.predict(queries[i]), loaded.predict(queries[i]));
+    }
+    std::remove(filenames[1].c_str());
+    ModelReader fs(filename_);
+    ASSERT_TRUE(fs.section("scale_0/histograms") != 0);
+    ASSERT_TRUE(fs.section("scale_1/histograms") != 0);
+    Mat scale;
+    fs["scale_1"]["histograms"] >> scale;
+    ASSERT_EQ(images_.size(), scale.rows);
+    ASSERT_EQ(4 * 4 * 16, scale.cols);
+}
+
+TEST_F(ModelTest, checkMap) {
+    Mat doubles(4, 6, CV_64FC1);
+    randu(doubles, -1.0, 1.0);
+    {
+        ModelWriter fs(filename_);
+        fs << "doubles" << doubles;
+        fs << "int" << 42;
+    }
+    ModelReader fs(filename_, ModelReader::MAP);
+    ASSERT_TRUE(fs.isOpened());
+    Mat a, b;
+    fs["doubles"] >> a;
+    fs["doubles"] >> b;
+    ASSERT_TRUE(isEqual(doubles, a));
+    // the sections are not copied
+    ASSERT_EQ(a.data, b.data);
+    ASSERT_EQ(fs.mapping()->data() + fs.section("doubles")->offset, a.data);
+    int i;
+    fs["int"] >> i;
+    ASSERT_EQ(42, i);
+    ASSERT_FALSE(ModelReader("missing.bin", ModelReader::MAP).isOpened());
+}
+
+TEST_F(ModelTest, checkMapEigenfaces) {
+    Eigenfaces model(images_, labels_);
+    model.save(filename_);
+    Eigenfaces mapped;
+    mapped.map(filename_);
+    ASSERT_TRUE(isEqual(model.eigenvectors(), mapped.eigenvectors()));
+    // the index scans the mapped projections
+    ASSERT_EQ(model.projections().cols * sizeof(int), mapped.index()->memory());
+    for(int i = 0; i < images_.size(); i++)
+        ASSERT_EQ(model.predict(images_[i]), mapped.predict(images_[i]));
+    // enrolling into a mapped model doesn't change the file
+    Mat face(20, 18, CV_8UC1);
+    randu(face, 0, 256);
+    mapped.enroll(face, 100);
+    ASSERT_EQ(100, mapped.predict(face));
+    Eigenfaces loaded;
+    loaded.load(filename_);
+    ASSERT_EQ(labels_[0], loaded.predict(images_[0]));
+    // swap to another model, which replaces the file atomically (the old
+    // mapping keeps the old file)
+    vector<int> labels(labels_.size(), 7);
+    Eigenfaces other(images_, labels);
+    other.save("test_model_new.bin");
+    ASSERT_EQ(0, std::rename("test_model_new.bin", filename_.c_str()));
+    Mat W = mapped.eigenvectors();
+    Mat mean = mapped.mean();
+    mapped.map(filename_);
+    ASSERT_EQ(7, mapped.predict(images_[0]));
+    // matrices obtained from the old model are copies, which outlive its
+    // mapping
+    ASSERT_TRUE(isEqual(model.eigenvectors(), W));
+    ASSERT_TRUE(isEqual(model.mean(), mean));
+}
+
+TEST_F(ModelTest, checkModelFile) {
+    Eigenfaces model(images_, labels_);
+    model.save(filename_);
+    ModelFile fs(filename_);
+    ASSERT_TRUE(fs.isOpened());
+    ASSERT_TRUE(fs.contains("projections"));
+    // the sizes are known without reading the sections
+    ASSERT_EQ(model.eigenvectors().size(), fs.size("eigenvectors"));
+    ASSERT_EQ(CV_64FC1, fs.type("eigenvectors"));
+    ASSERT_EQ((int) images_.size(), fs.size("projections").height);
+    ASSERT_EQ(Size(), fs.size("missing"));
+    ASSERT_EQ(-1, fs.type("missing"));
+    // the sections are read once
+    Mat W = fs.mat("eigenvectors");
+    ASSERT_TRUE(isEqual(model.eigenvectors(), W));
+    ASSERT_EQ(W.data, fs.mat("eigenvectors").data);
+    ASSERT_TRUE(fs.mat("missing").empty());
+    vector<int> labels;
+    fs.read("labels", labels);
+    ASSERT_TRUE(labels_ == labels);
+    vector<string> names = fs.names();
+    ASSERT_TRUE(std::find(names.begin(), names.end(), "mean") != names.end());
+}
+
+TEST_F(ModelTest, checkJournal) {
+    string journal = "test_journal.dat";
+    std::remove(journal.c_str());
+    vector<Mat> images(images_.begin(), images_.begin() + 10);
+    vector<int> labels(labels_.begin(), labels_.begin() + 10);
+    Eigenfaces model(images, labels);
+    model.save(filename_);
+    model.openJournal(journal);
+    model.enroll(images_[10], 50);
+    model.enroll(images_[11], 51);
+    // an interrupted append leaves a partial record
+    {
+        std::ofstream file(journal.c_str(), std::ios::binary | std::ios::app);
+        file.write("abc", 3);
+    }
+    // the enrollments are replayed on the base model
+    Eigenfaces replayed;
+    replayed.load(filename_);
+    replayed.openJournal(journal);
+    ASSERT_EQ(12, replayed.projections().rows);
+    ASSERT_EQ(50, replayed.predict(images_[10]));
+    ASSERT_EQ(51, replayed.predict(images_[11]));
+    // a model saved with the enrollments skips them
+    model.save(filename_);
+    Eigenfaces saved;
+    saved.load(filename_);
+    saved.openJournal(journal);
+    ASSERT_EQ(12, saved.projections().rows);
+    // the journal is folded into the model
+    replayed.compact(filename_);
+    replayed.enroll(images_[0], 52);
+    Eigenfaces compacted;
+    compacted.load(filename_);
+    ASSERT_EQ(12, compacted.projections().rows);
+    compacted.openJournal(journal);
+    ASSERT_EQ(13, compacted.projections().rows);
+    ASSERT_EQ(51, compacted.predict(images_[11]));
+    std::remove(journal.c_str());
+}
+
+TEST_F(ModelTest, checkPrecision) {
+    Eigenfaces reference(images_, labels_);
+    reference.save(filename_);
+    int64 referenceSize = ModelReader(filename_).section("eigenvectors")->size;
+    int precisions[] = { PackedMat::FLOAT16, PackedMat::INT8 };
+    for(int p = 0; p < 2; p++) {
+        Eigenfaces model(images_, labels_, 0, GalleryIndex::LINEAR, precisions[p]);
+        ASSERT_EQ(precisions[p], model.precision());
+        ASSERT_LT(norm(model.eigenvectors(), reference.eigenvectors(), NORM_INF), 0.01);
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(labels_[i], model.predict(images_[i]));
+        model.save(filename_);
+        ASSERT_LT(ModelReader(filename_).section("eigenvectors")->size * 3, referenceSize);
+        Eigenfaces loaded;
+        loaded.load(filename_);
+        ASSERT_EQ(precisions[p], loaded.precision());
+        Ptr<GalleryIndex> index = loaded.index();
+        ASSERT_EQ(precisions[p], dynamic_cast<LinearIndex*>((GalleryIndex*) index)->precision());
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(labels_[i], loaded.predict(images_[i]));
+    }
+}
+
+TEST_F(ModelTest, checkStream) {
+    int types[] = { GalleryIndex::LINEAR, GalleryIndex::HNSW };
+    for(int t = 0; t < 2; t++) {
+        Eigenfaces model(images_, labels_, 0, types[t]);
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        model.save(stream);
+        Eigenfaces loaded;
+        loaded.load(stream);
+        ASSERT_TRUE(isEqual(model.eigenvectors(), loaded.eigenvectors()));
+        ASSERT_EQ(types[t], loaded.index()->type());
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    }
+    int formats[] = { HistogramGallery::DENSE, HistogramGallery::SPARSE, HistogramGallery::QUANTIZED_8U };
+    for(int f = 0; f < 3; f++) {
+        LBPH model(images_, labels_, 1, 8, 4, 4, formats[f]);
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        model.save(stream);
+        LBPH loaded;
+        loaded.load(stream);
+        ASSERT_EQ(formats[f], loaded.format());
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+    }
+}
+
+TEST_F(ModelTest, checkStreamSections) {
+    Mat doubles(3, 5, CV_64FC1);
+    randu(doubles, -1.0, 1.0);
+    std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+    {
+        ModelWriter fs(stream);
+        fs << "doubles" << doubles;
+        fs << "int" << 42;
+        fs << "string" << "eigenfaces";
+    }
+    // two models in a row
+    {
+        ModelWriter fs(stream);
+        fs << "int" << 7;
+    }
+    ModelReader fs(stream);
+    ASSERT_TRUE(fs.isOpened());
+    ASSERT_EQ(MODEL_VERSION, fs.version());
+    int i;
+    string s;
+    Mat m;
+    // sections in front of the requested one are kept
+    fs["string"] >> s;
+    fs["doubles"] >> m;
+    fs["int"] >> i;
+    ASSERT_EQ("eigenfaces", s);
+    ASSERT_TRUE(isEqual(doubles, m));
+    ASSERT_EQ(42, i);
+    ASSERT_TRUE(fs["missing"].empty());
+    fs["missing"] >> m;
+    ASSERT_TRUE(m.empty());
+    // each section of a stream is read once
+    ASSERT_THROW(fs["int"] >> i, cv::Exception);
+    ModelReader second(stream);
+    second["int"] >> i;
+    ASSERT_EQ(7, i);
+}
+
+TEST_F(ModelTest, checkFileDescriptor) {
+    Eigenfaces model(images_, labels_);
+    int fd = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    {
+        ModelWriter fs(fd);
+        model.save(fs);
+    }
+    ::close(fd);
+    // the file has no table, but can still be read and mapped
+    Eigenfaces loaded;
+    loaded.load(filename_);
+    ASSERT_TRUE(isEqual(model.eigenvectors(), loaded.eigenvectors()));
+    Eigenfaces mapped;
+    mapped.map(filename_);
+    ASSERT_EQ(labels_[3], mapped.predict(images_[3]));
+    fd = ::open(filename_.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    {
+        ModelReader fs(fd);
+        Eigenfaces streamed;
+        streamed.load(fs);
+        for(int i = 0; i < images_.size(); i++)
+            ASSERT_EQ(model.predict(images_[i]), streamed.predict(images_[i]));
+    }
+    ::close(fd);
+}
+
+TEST_F(ModelTest, checkCompression) {
+    // zeros, small counts, repeated and random bytes
+    RNG rng(7);
+    Mat data = Mat::zeros(1, 3*MODEL_BLOCK_SIZE + 100, CV_8UC1);
+    for(int i = 0; i < data.cols; i += 97)
+        data.at<uchar>(i) = (uchar) rng.uniform(0, 4);
+    Mat random(1, 1000, CV_8UC1);
+    rng.fill(random, RNG::UNIFORM, 0, 256);
+    Mat first = data.colRange(1000, 2000);
+    Mat second = data.colRange(5000, 6000);
+    random.copyTo(first);
+    random.copyTo(second);
+    vector<uchar> compressed(data.cols);
+    size_t size = cv::impl::lz_compress(data.ptr(), data.cols, &compressed[0], compressed.size());
+    ASSERT_GT(size, 0u);
+    ASSERT_LT(size * 10, (size_t) data.cols);
+    Mat decompressed(data.size(), CV_8UC1);
+    ASSERT_TRUE(cv::impl::lz_decompress(&compressed[0], size, decompressed.ptr(), decompressed.cols));
+    ASSERT_TRUE(isEqual(data, decompressed));
+    // corrupted input is detected
+    ASSERT_FALSE(cv::impl::lz_decompress(&compressed[0], size / 2, decompressed.ptr(), decompressed.cols));
+    ASSERT_FALSE(cv::impl::lz_decompress(&compressed[0], size, decompressed.ptr(), decompressed.cols - 1));
+    // random data doesn't fit
+    ASSERT_EQ(0u, cv::impl::lz_compress(random.ptr(), random.cols, &compressed[0], random.cols - 1));
+    // the histogram sections are compressed if the writer is told to
+    int formats[] = { HistogramGallery::DENSE, HistogramGallery::SPARSE, HistogramGallery::QUANTIZED_8U };
+    const char* sections[] = { "histograms", "bins", "counts" };
+    // the sparse format stores the non-zero bins only
+    int factors[] = { 4, 1, 4 };
+    for(int f = 0; f < 3; f++) {
+        LBPH model(images_, labels_, 1, 8, 4, 4, formats[f]);
+        {
+            ModelWriter fs(filename_);
+            model.save(fs);
+        }
+        Mat plain, decoded;
+        int64 plainSize;
+        {
+            ModelReader fs(filename_);
+            ASSERT_EQ(0, fs.section(sections[f])->flags);
+            plainSize = fs.section(sections[f])->size;
+            fs[sections[f]] >> plain;
+        }
+        model.save(filename_, ModelWriter::COMPRESS);
+        ModelReader fs(filename_);
+        ASSERT_EQ(cv::impl::SECTION_COMPRESSED, fs.section(sections[f])->flags);
+        ASSERT_LT(fs.section(sections[f])->size * factors[f], plainSize);
+        fs[sections[f]] >> decoded;
+        ASSERT_TRUE(isEqual(plain, decoded));
+        LBPH loaded, mapped, streamed;
+        loaded.load(filename_);
+        mapped.map(filename_);
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        model.save(stream, ModelWriter::COMPRESS);
+        streamed.load(stream);
+        for(int i = 0; i < images_.size(); i++) {
+            ASSERT_EQ(model.predict(images_[i]), loaded.predict(images_[i]));
+            ASSERT_EQ(model.predict(images_[i]), mapped.predict(images_[i]));
+            ASSERT_EQ(model.predict(images_[i]), streamed.predict(images_[i]));
+        }
+        // a file descriptor can't seek, the sizes of the blocks are only in
+        // front of them
+        int fd = ::open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GE(fd, 0);
+        {
+            ModelWriter fs(fd, ModelWriter::COMPRESS);
+            model.save(fs);
+        }
+        ::close(fd);
+        ModelReader unpatched(filename_);
+        ASSERT_EQ(cv::impl::SECTION_COMPRESSED, unpatched.section(sections[f])->flags);
+        unpatched[sections[f]] >> decoded;
+        ASSERT_TRUE(isEqual(plain, decoded));
+        LBPH scanned, scannedMap, piped;
+        scanned.load(filename_);
+        scannedMap.map(filename_);
+        fd = ::open(filename_.c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+        {
+            ModelReader fs(fd);
+            piped.load(fs);
+        }
+        ::close(fd);
+        for(int i = 0; i < images_.size(); i++) {
+            ASSERT_EQ(model.predict(images_[i]), scanned.predict(images_[i]));
+            ASSERT_EQ(model.predict(images_[i]), scannedMap.predict(images_[i]));
+            ASSERT_EQ(model.predict(images_[i]), piped.predict(images_[i]));
+        }
+    }
+}